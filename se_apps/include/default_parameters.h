@@ -40,6 +40,7 @@ const bool default_no_gui = false;
 const bool default_render_volume_fullsize = false;
 const bool default_bilateralFilter = false;
 const std::string default_dump_volume_file = "";
+const std::string default_dump_point_cloud_file = "";
 const std::string default_input_file = "";
 const std::string default_log_file = "";
 const int default_color_integration = false;
@@ -47,6 +48,22 @@ const int default_multi_resolution = false;
 const bool default_bayesian = false;
 const std::string default_groundtruth_file = "";
 const Eigen::Matrix4f default_gt_transform = Eigen::Matrix4f::Identity();
+const std::string default_trajectory_file = "";
+const bool default_replay_raycast = false;
+const unsigned int default_integration_batch = 0;
+const float default_frame_budget = 0.f;
+const bool default_integration_gating = false;
+const Eigen::Vector4f default_gating_thresholds(0.02f, 0.035f, 0.01f, 0.01f);
+const unsigned int default_converged_visits = 0;
+const unsigned int default_revisit_period = 4;
+const float default_multires_distance = 0.f;
+const unsigned int default_multires_scales = 2;
+const bool default_image_normals = false;
+const int default_render_downsample = 4;
+const std::string default_checkpoint_file = "";
+const int default_checkpoint_rate = 100;
+const std::string default_dump_frames_dir = "";
+const bool default_dump_frames_raw = false;
 
 inline std::string pyramid2str(std::vector<int> v) {
   std::ostringstream ss;
@@ -56,7 +73,7 @@ inline std::string pyramid2str(std::vector<int> v) {
 
 }
 
-static std::string short_options = "a:qc:d:f:g:G:hi:l:m:k:o:p:r:s:t:v:y:z:FC:M";
+static std::string short_options = "a:qc:d:f:g:G:hi:l:m:k:o:p:r:s:t:v:y:z:FC:MT:RW:XY:K:D:NU:P:E:O:I:";
 
 static struct option long_options[] =
 {
@@ -86,6 +103,19 @@ static struct option long_options[] =
   {"bayesian",           no_argument, 0, 'h'},
   {"ground-truth",       required_argument, 0, 'g'},
   {"gt-transform",       required_argument, 0, 'G'},
+  {"trajectory-file",    required_argument, 0, 'T'},
+  {"replay-raycast",     no_argument,       0, 'R'},
+  {"integration-batch",  required_argument, 0, 'I'},
+  {"frame-budget",       required_argument, 0, 'W'},
+  {"integration-gating", no_argument,       0, 'X'},
+  {"gating-thresholds",  required_argument, 0, 'Y'},
+  {"skip-converged",     required_argument, 0, 'K'},
+  {"multires-distance",  required_argument, 0, 'D'},
+  {"image-normals",      no_argument,       0, 'N'},
+  {"render-downsample",  required_argument, 0, 'U'},
+  {"dump-point-cloud",   required_argument, 0, 'P'},
+  {"checkpoint",         required_argument, 0, 'E'},
+  {"dump-frames",        required_argument, 0, 'O'},
   {0, 0, 0, 0}
 };
 
@@ -95,6 +125,7 @@ void print_arguments() {
   std::cerr << "-c  (--compute-size-ratio)                : default is " << default_compute_size_ratio << "   (same size)      " << std::endl;
   std::cerr << "-e  (--invert-y)                          : default is False: Block on read " << std::endl;
   std::cerr << "-d  (--dump-volume) <filename>            : Output volume file              " << std::endl;
+  std::cerr << "-P  (--dump-point-cloud) <filename>       : Output surface points, binary PLY if .ply else raw floats" << std::endl;
   std::cerr << "-f  (--fps)                               : default is " << default_fps       << std::endl;
   std::cerr << "-F  (--bilateral-filter                   : default is disabled"               << std::endl;
   std::cerr << "-h  (--bayesian                           : default is disabled"               << std::endl;
@@ -113,6 +144,18 @@ void print_arguments() {
   std::cerr << "-z  (--rendering-rate)                    : default is " << default_rendering_rate << std::endl;
   std::cerr << "-g  (--ground-truth) <filename>           : Ground truth file" << std::endl;
   std::cerr << "-G  (--gt-transform) tx,ty,tz,qx,qy,qz,qw : Ground truth pose tranform (translation and/or rotation)" << std::endl;
+  std::cerr << "-T  (--trajectory-file) <filename>        : Output camera trajectory, replayable with -g" << std::endl;
+  std::cerr << "-R  (--replay-raycast)                    : default is False: Raycast when replaying ground truth poses" << std::endl;
+  std::cerr << "-I  (--integration-batch) n               : default is " << default_integration_batch << " (disabled): Integrate frames n at a time, one block traversal per batch" << std::endl;
+  std::cerr << "-W  (--frame-budget) <ms>                 : default is " << default_frame_budget << " (disabled): Adapt rates to this frame time" << std::endl;
+  std::cerr << "-X  (--integration-gating)                : default is False: Skip integrating redundant frames" << std::endl;
+  std::cerr << "-Y  (--gating-thresholds) t,r,n,e         : default is " << default_gating_thresholds.x() << "," << default_gating_thresholds.y() << "," << default_gating_thresholds.z() << "," << default_gating_thresholds.w() << " (metres, radians, new block fraction, metres)" << std::endl;
+  std::cerr << "-K  (--skip-converged) n[,p]              : default is " << default_converged_visits << " (disabled): Integrate blocks unchanged for n frames every p frames (default " << default_revisit_period << ")" << std::endl;
+  std::cerr << "-D  (--multires-distance) d[,s]           : default is " << default_multires_distance << " (disabled): Integrate SDF blocks beyond d metres at up to s coarser scales (default " << default_multires_scales << ")" << std::endl;
+  std::cerr << "-N  (--image-normals)                     : default is False: Estimate raycast normals from the vertex map" << std::endl;
+  std::cerr << "-U  (--render-downsample) n               : default is " << default_render_downsample << ": First render free viewpoints every n pixels, then refine" << std::endl;
+  std::cerr << "-E  (--checkpoint) <filename>[,n]         : default is disabled: Checkpoint every n frames (default " << default_checkpoint_rate << "), resume from the file if it exists" << std::endl;
+  std::cerr << "-O  (--dump-frames) <directory>[,raw]     : default is disabled: Write renders as numbered PNGs in the background, uncompressed with raw" << std::endl;
 }
 
 inline Eigen::Vector3f atof3(char * optarg) {
@@ -207,10 +250,30 @@ Configuration parseArgs(unsigned int argc, char ** argv) {
   //invert_y = false;
 
   config.dump_volume_file = default_dump_volume_file;
+  config.dump_point_cloud_file = default_dump_point_cloud_file;
   config.input_file = default_input_file;
   config.log_file = default_log_file;
   config.groundtruth_file = default_groundtruth_file;
   config.gt_transform = default_gt_transform;
+  config.trajectory_file = default_trajectory_file;
+  config.replay_raycast = default_replay_raycast;
+  config.integration_batch = default_integration_batch;
+  config.frame_budget = default_frame_budget;
+  config.integration_gating = default_integration_gating;
+  config.gating_translation = default_gating_thresholds.x();
+  config.gating_rotation = default_gating_thresholds.y();
+  config.gating_new_blocks = default_gating_thresholds.z();
+  config.gating_residual = default_gating_thresholds.w();
+  config.converged_visits = default_converged_visits;
+  config.revisit_period = default_revisit_period;
+  config.multires_distance = default_multires_distance;
+  config.multires_scales = default_multires_scales;
+  config.image_normals = default_image_normals;
+  config.render_downsample = default_render_downsample;
+  config.checkpoint_file = default_checkpoint_file;
+  config.checkpoint_rate = default_checkpoint_rate;
+  config.dump_frames_dir = default_dump_frames_dir;
+  config.dump_frames_raw = default_dump_frames_raw;
 
   config.mu = default_mu;
   config.fps = default_fps;
@@ -269,6 +332,11 @@ Configuration parseArgs(unsigned int argc, char ** argv) {
         std::cerr << "update dump_volume_file to "
           << config.dump_volume_file << std::endl;
         break;
+      case 'P':
+        config.dump_point_cloud_file = optarg;
+        std::cerr << "update dump_point_cloud_file to "
+          << config.dump_point_cloud_file << std::endl;
+        break;
       case 'e':
         //config.invert_y = true;
         //std::cerr << "Inverting Y axis (ICL-NUIM Fix)" << std::endl;
@@ -445,6 +513,139 @@ Configuration parseArgs(unsigned int argc, char ** argv) {
                 config.multiResolution = true;
                 std::cerr << "using multi-resolution integration" << std::endl;
                 break;
+      case 'T':
+                config.trajectory_file = optarg;
+                std::cerr << "update trajectory_file to "
+                  << config.trajectory_file << std::endl;
+                break;
+      case 'R':
+                config.replay_raycast = true;
+                std::cerr << "raycasting when replaying poses" << std::endl;
+                break;
+      case 'I':
+                if (atoi(optarg) < 0) {
+                  std::cerr << "ERROR: --integration-batch (-I) must be >= 0 "
+                    << "(was " << optarg << ")\n";
+                  flagErr++;
+                  break;
+                }
+                config.integration_batch = atoi(optarg);
+                std::cerr << "update integration_batch to "
+                  << config.integration_batch << std::endl;
+                break;
+      case 'W':
+                config.frame_budget = atof(optarg);
+                std::cerr << "update frame_budget to " << config.frame_budget
+                  << " ms" << std::endl;
+                if (config.frame_budget < 0.f) {
+                  std::cerr << "ERROR: --frame-budget (-W) must be >= 0 (was "
+                    << optarg << ")\n";
+                  flagErr++;
+                }
+                break;
+      case 'X':
+                config.integration_gating = true;
+                std::cerr << "skipping redundant frames" << std::endl;
+                break;
+      case 'Y': {
+                  const Eigen::Vector4f thresholds = atof4(optarg);
+                  config.gating_translation = thresholds.x();
+                  config.gating_rotation = thresholds.y();
+                  config.gating_new_blocks = thresholds.z();
+                  config.gating_residual = thresholds.w();
+                }
+                std::cerr << "update gating thresholds to "
+                  << config.gating_translation << ","
+                  << config.gating_rotation << ","
+                  << config.gating_new_blocks << ","
+                  << config.gating_residual << std::endl;
+                break;
+      case 'K':
+                tokens = splitString(optarg, ',');
+                if (tokens.size() < 1 || tokens.size() > 2 ||
+                    std::stoi(tokens[0]) < 0 ||
+                    (tokens.size() == 2 && std::stoi(tokens[1]) < 1)) {
+                  std::cerr << "ERROR: --skip-converged (-K) expects n or n,p "
+                    << "with n >= 0 and p >= 1 (was " << optarg << ")\n";
+                  flagErr++;
+                  break;
+                }
+                config.converged_visits = std::stoi(tokens[0]);
+                if (tokens.size() == 2)
+                  config.revisit_period = std::stoi(tokens[1]);
+                std::cerr << "update converged block skipping to "
+                  << config.converged_visits << ","
+                  << config.revisit_period << std::endl;
+                break;
+      case 'D':
+                tokens = splitString(optarg, ',');
+                if (tokens.size() < 1 || tokens.size() > 2 ||
+                    std::stof(tokens[0]) < 0.f ||
+                    (tokens.size() == 2 && (std::stoi(tokens[1]) < 0 ||
+                                            std::stoi(tokens[1]) > 2))) {
+                  std::cerr << "ERROR: --multires-distance (-D) expects d or "
+                    << "d,s with d >= 0 and 0 <= s <= 2 (was " << optarg 
+                    << ")\n";
+                  flagErr++;
+                  break;
+                }
+                config.multires_distance = std::stof(tokens[0]);
+                if (tokens.size() == 2)
+                  config.multires_scales = std::stoi(tokens[1]);
+                std::cerr << "update multi-resolution integration to "
+                  << config.multires_distance << ","
+                  << config.multires_scales << std::endl;
+                break;
+      case 'N':
+                config.image_normals = true;
+                std::cerr << "estimate raycast normals from the vertex map"
+                  << std::endl;
+                break;
+      case 'U':
+                config.render_downsample = atoi(optarg);
+                if (config.render_downsample < 1 || config.render_downsample > 64 ||
+                    (config.render_downsample & (config.render_downsample - 1))) {
+                  std::cerr << "ERROR: --render-downsample (-U) must be a power "
+                    << "of two between 1 and 64 (was " << optarg << ")\n";
+                  flagErr++;
+                  break;
+                }
+                std::cerr << "update render_downsample to "
+                  << config.render_downsample << std::endl;
+                break;
+      case 'E':
+                tokens = splitString(optarg, ',');
+                if (tokens.size() < 1 || tokens.size() > 2 || 
+                    tokens[0].empty() ||
+                    (tokens.size() == 2 && std::stoi(tokens[1]) < 1)) {
+                  std::cerr << "ERROR: --checkpoint (-E) expects filename or "
+                    << "filename,n with n >= 1 (was " << optarg << ")\n";
+                  flagErr++;
+                  break;
+                }
+                config.checkpoint_file = tokens[0];
+                if (tokens.size() == 2)
+                  config.checkpoint_rate = std::stoi(tokens[1]);
+                std::cerr << "update checkpoint to "
+                  << config.checkpoint_file << ","
+                  << config.checkpoint_rate << std::endl;
+                break;
+      case 'O':
+                tokens = splitString(optarg, ',');
+                if (tokens.size() < 1 || tokens.size() > 2 || 
+                    tokens[0].empty() ||
+                    (tokens.size() == 2 && tokens[1] != "raw")) {
+                  std::cerr << "ERROR: --dump-frames (-O) expects directory "
+                    << "or directory,raw (was " << optarg << ")\n";
+                  flagErr++;
+                  break;
+                }
+                config.dump_frames_dir = tokens[0];
+                config.dump_frames_raw = (tokens.size() == 2);
+                std::cerr << "update dump_frames to "
+                  << config.dump_frames_dir
+                  << (config.dump_frames_raw ? ",raw" : "") << std::endl;
+                break;
       case 0:
       case '?':
                 std::cerr << "Unknown option character -" << char(optopt)
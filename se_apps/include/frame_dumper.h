@@ -0,0 +1,225 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef FRAME_DUMPER_H
+#define FRAME_DUMPER_H
+
+#include <lodepng.h>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * Writes RGBA renders to numbered PNG files on background threads, so that
+ * encoding never stalls the SLAM loop. Images are copied into a bounded
+ * queue. When the encoders fall behind and the queue is full the new image
+ * is dropped rather than waiting for a free slot. Copy buffers are recycled
+ * so that steady state dumping does not allocate.
+ */
+class FrameDumper {
+  public:
+    /**
+     * \param[in] directory Output directory, created if missing.
+     * \param[in] raw Store the PNG data uncompressed and unfiltered. The
+     * files are several times larger but cost almost nothing to encode.
+     * \param[in] num_threads Number of encoder threads.
+     * \param[in] capacity Maximum number of images waiting to be encoded.
+     */
+    FrameDumper(const std::string& directory, bool raw,
+        unsigned int num_threads = default_threads,
+        unsigned int capacity = default_capacity) :
+      directory_(directory),
+      raw_(raw),
+      capacity_(capacity > 0 ? capacity : 1),
+      done_(false),
+      written_(0),
+      dropped_(0),
+      failed_(0) {
+        mkdir(directory_.c_str(), 0755);
+        if (num_threads == 0) num_threads = 1;
+        for (unsigned int i = 0; i < num_threads; ++i)
+          workers_.emplace_back(&FrameDumper::work, this);
+      }
+
+    ~FrameDumper() { finish(); }
+
+    FrameDumper(const FrameDumper&) = delete;
+    FrameDumper& operator=(const FrameDumper&) = delete;
+
+    /**
+     * Queue an image for writing to <directory>/<name>_<frame>.png. Never
+     * blocks on encoding.
+     *
+     * \param[in] name Prefix of the file name, e.g. "depth".
+     * \param[in] frame Frame number appended to the file name.
+     * \param[in] rgba Row major RGBA pixels, copied before returning.
+     * \param[in] width Image width in pixels.
+     * \param[in] height Image height in pixels.
+     * \return false if the queue was full and the image was dropped.
+     */
+    bool push(const std::string& name, unsigned int frame,
+        const unsigned char* rgba, unsigned int width, unsigned int height) {
+      const size_t bytes = 4 * size_t(width) * height;
+      Image image;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done_ || queue_.size() >= capacity_) {
+          ++dropped_;
+          return false;
+        }
+        if (!free_.empty()) {
+          image.pixels.swap(free_.back());
+          free_.pop_back();
+        }
+      }
+      image.pixels.resize(bytes);
+      std::memcpy(image.pixels.data(), rgba, bytes);
+      image.width = width;
+      image.height = height;
+      image.filename = filename(name, frame);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(image));
+      }
+      ready_.notify_one();
+      return true;
+    }
+
+    /**
+     * Write the queued images and stop the encoder threads. Further pushes
+     * are dropped.
+     */
+    void finish() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+      }
+      ready_.notify_all();
+      for (auto& worker : workers_)
+        if (worker.joinable()) worker.join();
+    }
+
+    unsigned int written() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return written_;
+    }
+
+    unsigned int dropped() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return dropped_;
+    }
+
+    unsigned int failed() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return failed_;
+    }
+
+  private:
+    static constexpr unsigned int default_threads = 2;
+    static constexpr unsigned int default_capacity = 24;
+
+    struct Image {
+      std::vector<unsigned char> pixels;
+      unsigned int width = 0;
+      unsigned int height = 0;
+      std::string filename;
+    };
+
+    std::string filename(const std::string& name, unsigned int frame) const {
+      char number[16];
+      std::snprintf(number, sizeof(number), "%06u", frame);
+      return directory_ + "/" + name + "_" + number + ".png";
+    }
+
+    unsigned encode(const Image& image) const {
+      lodepng::State state;
+      state.info_raw.colortype = LCT_RGBA;
+      state.info_raw.bitdepth = 8;
+      state.info_png.color.colortype = LCT_RGBA;
+      state.info_png.color.bitdepth = 8;
+      // Keep the input colour type, scanning for a smaller one costs as
+      // much as compressing
+      state.encoder.auto_convert = LAC_NO;
+      if (raw_) {
+        state.encoder.zlibsettings.btype = 0;
+        state.encoder.filter_strategy = LFS_ZERO;
+      }
+      std::vector<unsigned char> png;
+      const unsigned error = lodepng::encode(png, image.pixels, image.width,
+          image.height, state);
+      if (error) return error;
+      return lodepng_save_file(png.data(), png.size(),
+          image.filename.c_str());
+    }
+
+    void work() {
+      while (true) {
+        Image image;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          ready_.wait(lock, [this]{ return done_ || !queue_.empty(); });
+          if (queue_.empty()) return;
+          image = std::move(queue_.front());
+          queue_.pop_front();
+        }
+        const unsigned error = encode(image);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error) {
+          ++failed_;
+        } else {
+          ++written_;
+        }
+        free_.push_back(std::move(image.pixels));
+      }
+    }
+
+    const std::string directory_;
+    const bool raw_;
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Image> queue_;
+    std::vector<std::vector<unsigned char> > free_;
+    std::vector<std::thread> workers_;
+    bool done_;
+    unsigned int written_;
+    unsigned int dropped_;
+    unsigned int failed_;
+};
+
+#endif
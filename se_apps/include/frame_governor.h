@@ -0,0 +1,197 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef FRAME_GOVERNOR_H
+#define FRAME_GOVERNOR_H
+
+#include <se/config.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * Adapts the integration rate, rendering rate and ICP iterations to hold a
+ * target computation time per frame. The cost of every pipeline stage is
+ * tracked with an exponential moving average. While the total exceeds the
+ * budget the setting driving the most expensive stage is degraded by one
+ * step. Once there is enough headroom the steps are undone in reverse order.
+ * At startup and after every change the governor waits a few frames, so
+ * that the averages reflect the current settings before the next decision.
+ */
+class FrameGovernor {
+  public:
+    enum Stage {
+      PREPROCESSING, TRACKING, INTEGRATION, RAYCASTING, RENDERING, NUM_STAGES
+    };
+
+    /**
+     * \param[in] config The settings of Configuration are the best quality
+     * the governor restores to. A Configuration.frame_budget of 0 disables
+     * it.
+     */
+    FrameGovernor(const Configuration& config) :
+      budget_(config.frame_budget / 1000.f),
+      base_integration_rate_(config.integration_rate),
+      base_rendering_rate_(config.rendering_rate),
+      base_iterations_(config.pyramid),
+      integration_rate_(config.integration_rate),
+      rendering_rate_(config.rendering_rate),
+      iterations_(config.pyramid),
+      iteration_shift_(0),
+      frames_(0),
+      cooldown_(cooldown_frames),
+      decision_("-") {
+        std::fill(cost_, cost_ + NUM_STAGES, 0.0);
+      }
+
+    bool enabled() const { return budget_ > 0.f; }
+
+    /**
+     * Account the stage timings of the last frame and possibly change one
+     * setting.
+     *
+     * \param[in] stage_times The time in seconds spent in each ::Stage.
+     * \return true if a setting changed.
+     */
+    bool update(const double stage_times[NUM_STAGES]) {
+      decision_ = "-";
+      if (!enabled()) return false;
+
+      const double alpha = frames_ == 0 ? 1.0 : 0.1;
+      double total = 0.0;
+      for (int s = 0; s < NUM_STAGES; ++s) {
+        cost_[s] = alpha * stage_times[s] + (1.0 - alpha) * cost_[s];
+        total += cost_[s];
+      }
+      ++frames_;
+
+      if (cooldown_ > 0) {
+        --cooldown_;
+        return false;
+      }
+
+      if (total > budget_) {
+        return degrade();
+      } else if (total < restore_ratio * budget_ && !steps_.empty()) {
+        return restore();
+      }
+      return false;
+    }
+
+    int integrationRate() const { return integration_rate_; }
+
+    int renderingRate() const { return rendering_rate_; }
+
+    const std::vector<int>& iterations() const { return iterations_; }
+
+    /**
+     * The change made by the last call to update(), or "-" if none.
+     */
+    const std::string& decision() const { return decision_; }
+
+  private:
+    enum Knob { INTEGRATION_RATE, RENDERING_RATE, ICP_ITERATIONS };
+
+    static constexpr float restore_ratio = 0.75f;
+    static constexpr int cooldown_frames = 10;
+    static constexpr int max_rate_factor = 8;
+    static constexpr int max_iteration_shift = 3;
+
+    bool degrade() {
+      // Pick the most expensive stage whose setting can still be lowered
+      Knob knob = INTEGRATION_RATE;
+      double worst = -1.0;
+      if (integration_rate_ < max_rate_factor * base_integration_rate_ &&
+          cost_[INTEGRATION] > worst) {
+        knob = INTEGRATION_RATE;
+        worst = cost_[INTEGRATION];
+      }
+      if (rendering_rate_ < max_rate_factor * base_rendering_rate_ &&
+          cost_[RENDERING] > worst) {
+        knob = RENDERING_RATE;
+        worst = cost_[RENDERING];
+      }
+      if (iteration_shift_ < max_iteration_shift && cost_[TRACKING] > worst) {
+        knob = ICP_ITERATIONS;
+        worst = cost_[TRACKING];
+      }
+      if (worst < 0.0) return false;
+
+      step(knob, true);
+      steps_.push_back(knob);
+      return true;
+    }
+
+    bool restore() {
+      const Knob knob = steps_.back();
+      steps_.pop_back();
+      step(knob, false);
+      return true;
+    }
+
+    void step(Knob knob, bool down) {
+      switch (knob) {
+        case INTEGRATION_RATE:
+          integration_rate_ = down ? integration_rate_ * 2 
+                                   : integration_rate_ / 2;
+          decision_ = "integration_rate=" + std::to_string(integration_rate_);
+          break;
+        case RENDERING_RATE:
+          rendering_rate_ = down ? rendering_rate_ * 2 : rendering_rate_ / 2;
+          decision_ = "rendering_rate=" + std::to_string(rendering_rate_);
+          break;
+        case ICP_ITERATIONS:
+          iteration_shift_ += down ? 1 : -1;
+          for (unsigned int i = 0; i < iterations_.size(); ++i) {
+            iterations_[i] = std::max(1, base_iterations_[i] >> iteration_shift_);
+          }
+          decision_ = "icp_iterations=" + std::to_string(iterations_[0]);
+          break;
+      }
+      cooldown_ = cooldown_frames;
+    }
+
+    const float budget_;
+    const int base_integration_rate_;
+    const int base_rendering_rate_;
+    const std::vector<int> base_iterations_;
+    int integration_rate_;
+    int rendering_rate_;
+    std::vector<int> iterations_;
+    int iteration_shift_;
+    unsigned int frames_;
+    int cooldown_;
+    double cost_[NUM_STAGES];
+    std::vector<Knob> steps_;
+    std::string decision_;
+};
+
+#endif
@@ -18,6 +18,7 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -181,12 +182,27 @@ class SceneDepthReader: public DepthReader {
 
     std::string _dir;
     uint2 _inSize;
+    // Conversion buffer, reused across frames
+    std::vector<float> _floatDepth;
 
   public:
     ~SceneDepthReader() { };
 
     SceneDepthReader(const ReaderConfiguration& config)
-      : SceneDepthReader(config.data_path, config.fps, config.blocking_read){ }
+      : SceneDepthReader(config.data_path, config.fps, config.blocking_read){
+        _groundtruth_path = config.groundtruth_path;
+        _transform = config.transform;
+        // Open ground truth association file if supplied
+        if (_groundtruth_path != "") {
+          _gt_file.open(_groundtruth_path.c_str());
+          if(!_gt_file.is_open()) {
+            std::cout << "Failed to open ground truth association file "
+              << _groundtruth_path << std::endl;
+            cameraOpen = false;
+          }
+          _pose_num = -1;
+        }
+      }
 
     SceneDepthReader(std::string dir, int fps, bool blocking_read) :
       DepthReader(), _dir(dir), _inSize(make_uint2(640, 480)) {
@@ -226,18 +242,23 @@ class SceneDepthReader: public DepthReader {
 
     inline bool readNextDepthFrame(uchar3*, unsigned short int * depthMap) {
 
-      float* FloatdepthMap = (float*) malloc(
-          _inSize.x * _inSize.y * sizeof(float));
+      _floatDepth.resize(_inSize.x * _inSize.y);
+      float* FloatdepthMap = _floatDepth.data();
       bool res = readNextDepthFrame(FloatdepthMap);
 
       for (unsigned int i = 0; i < _inSize.x * _inSize.y; i++) {
         depthMap[i] = FloatdepthMap[i] * 1000.0f;
       }
-      free(FloatdepthMap);
       return res;
 
     }
 
+    inline bool readNextData(uchar3*          rgb_image,
+                             uint16_t*        depth_image,
+                             Eigen::Matrix4f& pose) {
+      return readNextPose(pose) && readNextDepthFrame(rgb_image, depth_image);
+    }
+
     inline bool readNextDepthFrame(float * depthMap) {
 
       std::ostringstream filename;
@@ -287,6 +308,8 @@ class RawDepthReader: public DepthReader {
   private:
     FILE* _rawFilePtr;
     uint2 _inSize;
+    // Conversion buffer, reused across frames
+    std::vector<unsigned short int> _uintDepth;
 
   public:
     /**
@@ -305,6 +328,8 @@ class RawDepthReader: public DepthReader {
             std::cout << "Failed to open ground truth association file "
               << _groundtruth_path << std::endl;
             _rawFilePtr = NULL;
+            cameraOpen = false;
+            cameraActive = false;
             return;
           }
           _pose_num = -1;
@@ -447,14 +472,13 @@ class RawDepthReader: public DepthReader {
 
     inline bool readNextDepthFrame(float * depthMap) {
 
-      unsigned short int* UintdepthMap = (unsigned short int*) malloc(
-          _inSize.x * _inSize.y * sizeof(unsigned short int));
+      _uintDepth.resize(_inSize.x * _inSize.y);
+      unsigned short int* UintdepthMap = _uintDepth.data();
       bool res = readNextDepthFrame(NULL, UintdepthMap);
 
       for (unsigned int i = 0; i < _inSize.x * _inSize.y; i++) {
         depthMap[i] = (float) UintdepthMap[i] / 1000.0f;
       }
-      free(UintdepthMap);
       return res;
     }
 
@@ -533,6 +557,8 @@ class OpenNIDepthReader: public DepthReader {
   private:
     FILE* _pFile;
     uint2 _inSize;
+    // Conversion buffer, reused across frames
+    std::vector<unsigned short int> _uintDepth;
 
     openni::Device device;
     openni::VideoStream depth;
@@ -755,13 +781,13 @@ class OpenNIDepthReader: public DepthReader {
 
     inline bool readNextDepthFrame(float * depthMap) {
 
-      unsigned short int* UintdepthMap = (unsigned short int*) malloc(_inSize.x * _inSize.y * sizeof(unsigned short int));
+      _uintDepth.resize(_inSize.x * _inSize.y);
+      unsigned short int* UintdepthMap = _uintDepth.data();
       bool res = readNextDepthFrame(NULL,UintdepthMap);
 
       for (unsigned int i = 0; i < _inSize.x * _inSize.y; i++) {
         depthMap[i] = (float) UintdepthMap[i] / 1000.0f;
       }
-      free(UintdepthMap);
       return res;
     }
 
@@ -112,6 +112,20 @@ static void newDenseSLAMSystem(bool resetPose) {
 			480 / config->compute_size_ratio);
 	reset = true;
 }
+// Restarts the reconstruction with an unchanged configuration, keeping the
+// memory of the current DenseSLAMSystem
+static void resetDenseSLAMSystem() {
+	Eigen::Matrix<float, 6, 1> twist;
+	twist << config->initial_pos_factor.x() * config->volume_size.x(),
+			config->initial_pos_factor.y() * config->volume_size.x(),
+			config->initial_pos_factor.z() * config->volume_size.x(), 0, 0, 0;
+	trans = Sophus::SE3<float>::exp(twist);
+	rot = Sophus::SE3<float>();
+	Eigen::Vector3f init_pose =
+			config->initial_pos_factor.cwiseProduct(config->volume_size);
+	(*pipeline_pp)->reset(se::math::toMatrix4f(init_pose));
+	reset = true;
+}
 static void continueWithNewDenseSLAMSystem() {
 	newDenseSLAMSystem(false);
 }
@@ -225,7 +239,7 @@ void qtIdle(void) {
 		int finished = processAll((*reader_pp), true, true, config, reset);
 		if (finished) {
 			if (loopEnabled) {
-				newDenseSLAMSystem(true);
+				resetDenseSLAMSystem();
 				(*reader_pp)->restart();
 			} else {
 				(*reader_pp)->cameraActive = false;
@@ -10,8 +10,12 @@
 #include <se/DenseSLAMSystem.h>
 #include <interface.h>
 #include <default_parameters.h>
+#include <frame_governor.h>
+#include <frame_dumper.h>
 #include <stdint.h>
 #include <vector>
+#include <memory>
+#include <fstream>
 #include <sstream>
 #include <string>
 #include <cstring>
@@ -58,13 +62,35 @@ int main(int argc, char ** argv) {
 
 	DepthReader * reader;
 
-	if (is_file(config.input_file)) {
-		reader = new RawDepthReader(config.input_file, config.fps,
-				config.blocking_read);
+	ReaderConfiguration reader_config;
+	reader_config.fps = config.fps;
+	reader_config.blocking_read = config.blocking_read;
+	reader_config.data_path = config.input_file;
+	reader_config.groundtruth_path = config.groundtruth_file;
+	reader_config.transform = config.gt_transform;
 
+	if (is_file(config.input_file)) {
+		reader = new RawDepthReader(reader_config);
 	} else {
-		reader = new SceneDepthReader(config.input_file, config.fps,
-				config.blocking_read);
+		reader = new SceneDepthReader(reader_config);
+	}
+	if (!reader->isValid()) {
+		std::cerr << "Could not open the input." << std::endl;
+		exit(1);
+	}
+
+	// When a ground truth file is given the poses are replayed from it and
+	// tracking is skipped, which isolates the mapping pipeline
+	const bool replay = (config.groundtruth_file != "");
+	if (replay && config.integration_gating)
+		std::cerr << "Integration gating: replayed poses have no ICP residual, "
+			<< "frames are gated on motion and new blocks only" << std::endl;
+	std::ofstream trajectory;
+	if (config.trajectory_file != "") {
+		trajectory.open(config.trajectory_file.c_str());
+		trajectory << "# frame tx ty tz qx qy qz qw" << std::endl;
+		trajectory.setf(std::ios::fixed, std::ios::floatfield);
+		trajectory.precision(9);
 	}
 
 	std::cout.precision(10);
@@ -104,15 +130,41 @@ int main(int argc, char ** argv) {
       init_pose,
       config.pyramid, config);
      
+	FrameGovernor governor(config);
+
+	std::unique_ptr<FrameDumper> dumper;
+	if (config.dump_frames_dir != "")
+		dumper.reset(new FrameDumper(config.dump_frames_dir,
+				config.dump_frames_raw));
+
 	std::chrono::time_point<std::chrono::steady_clock> timings[7];
 	timings[0] = std::chrono::steady_clock::now();
 
 	*logstream
 			<< "frame\tacquisition\tpreprocessing\ttracking\tintegration\traycasting\trendering\tcomputation\ttotal    \tX          \tY          \tZ         \ttracked   \tintegrated"
+			<< (governor.enabled() ? "\tintegration_rate\trendering_rate\ticp_iterations\tgovernor" : "")
+			<< (config.integration_gating ? "\tskipped\tdelta_t\tdelta_r\tnew_blocks\tresidual" : "")
 			<< std::endl;
 	logstream->setf(std::ios::fixed, std::ios::floatfield);
 
-    while (reader->readNextDepthFrame(inputDepth)) {
+	Eigen::Matrix4f gt_pose;
+	if (config.checkpoint_file != "" && is_file(config.checkpoint_file)) {
+		if (pipeline.restore(config.checkpoint_file, frame)) {
+			std::cerr << "Resuming from frame " << frame << std::endl;
+			// Skip the frames already fused into the restored map
+			for (uint i = 0; i < frame; ++i) {
+				if (!(replay ? reader->readNextData(NULL, inputDepth, gt_pose)
+				             : reader->readNextDepthFrame(inputDepth)))
+					break;
+			}
+		} else {
+			std::cerr << "Could not restore " << config.checkpoint_file
+				<< ", starting from the first frame" << std::endl;
+		}
+	}
+
+	while (replay ? reader->readNextData(NULL, inputDepth, gt_pose)
+	              : reader->readNextDepthFrame(inputDepth)) {
 
 		bool tracked = false, integrated = false;
 
@@ -123,9 +175,13 @@ int main(int argc, char ** argv) {
 
 		timings[2] = std::chrono::steady_clock::now();
 
-		tracked = pipeline.tracking(camera, config.icp_threshold,
-				config.tracking_rate, frame);
-
+		if (replay) {
+			pipeline.setPose(gt_pose);
+			tracked = true;
+		} else {
+			tracked = pipeline.tracking(camera, config.icp_threshold,
+					config.tracking_rate, frame);
+		}
 
 		timings[3] = std::chrono::steady_clock::now();
 
@@ -135,11 +191,25 @@ int main(int argc, char ** argv) {
 		float yt = pose(1, 3) - init_pose.y();
 		float zt = pose(2, 3) - init_pose.z();
 
+		if (trajectory.is_open()) {
+			const Eigen::Quaternionf q(Eigen::Matrix3f(pose.topLeftCorner<3,3>()));
+			trajectory << frame << " " << xt << " " << yt << " " << zt << " "
+				<< q.x() << " " << q.y() << " " << q.z() << " " << q.w()
+				<< std::endl;
+		}
 
 		// Integrate only if tracking was successful or it is one of the first
 		// 4 frames.
-		if (tracked || (frame <=3)) {
-			integrated = pipeline.integration(camera, config.integration_rate,
+		if (config.integration_batch > 0) {
+			// Queued frames count as integrated, the log shows the time of
+			// the batch on the frame that completes it
+			integrated = (tracked || (frame <= 3)) &&
+				(frame % governor.integrationRate() == 0 || frame <= 3);
+			if (integrated)
+				pipeline.queueIntegration(camera, config.mu, frame, 
+						config.integration_batch);
+		} else if (tracked || (frame <=3)) {
+			integrated = pipeline.integration(camera, governor.integrationRate(),
 					config.mu, frame);
 		} else {
 			integrated = false;
@@ -147,18 +217,41 @@ int main(int argc, char ** argv) {
 
 		timings[4] = std::chrono::steady_clock::now();
 
-		pipeline.raycasting(camera, config.mu, frame);
+		if (!replay || config.replay_raycast) {
+			pipeline.raycasting(camera, config.mu, frame);
+		}
 
 		timings[5] = std::chrono::steady_clock::now();
 
 		pipeline.renderDepth( (unsigned char*)depthRender, Eigen::Vector2i(computationSize.x, computationSize.y));
 		pipeline.renderTrack( (unsigned char*)trackRender, Eigen::Vector2i(computationSize.x, computationSize.y));
-		pipeline.renderVolume((unsigned char*)volumeRender, 
+		const bool volume_rendered = pipeline.renderVolume(
+				(unsigned char*)volumeRender, 
         Eigen::Vector2i(computationSize.x, computationSize.y), frame,
-				config.rendering_rate, camera, 0.75 * config.mu);
+				governor.renderingRate(), camera, 0.75 * config.mu);
 
 		timings[6] = std::chrono::steady_clock::now();
 
+		if (dumper) {
+			dumper->push("depth", frame, (unsigned char*)depthRender,
+					computationSize.x, computationSize.y);
+			dumper->push("track", frame, (unsigned char*)trackRender,
+					computationSize.x, computationSize.y);
+			// The volume is only re-rendered every rendering rate frames
+			if (volume_rendered)
+				dumper->push("volume", frame, (unsigned char*)volumeRender,
+						computationSize.x, computationSize.y);
+		}
+
+		double stage_times[FrameGovernor::NUM_STAGES];
+		for (int s = 0; s < FrameGovernor::NUM_STAGES; ++s) {
+			stage_times[s] = std::chrono::duration<double>(
+					timings[s + 2] - timings[s + 1]).count();
+		}
+		if (governor.update(stage_times)) {
+			pipeline.setIterations(governor.iterations());
+		}
+
 		*logstream << frame << "\t" 
       << std::chrono::duration<double>(timings[1] - timings[0]).count() << "\t" //  acquisition
       << std::chrono::duration<double>(timings[2] - timings[1]).count() << "\t"     //  preprocessing
@@ -169,14 +262,37 @@ int main(int argc, char ** argv) {
       << std::chrono::duration<double>(timings[5] - timings[1]).count() << "\t"     //  computation
       << std::chrono::duration<double>(timings[6] - timings[0]).count() << "\t"     //  total
       << xt << "\t" << yt << "\t" << zt << "\t"     //  X,Y,Z
-      << tracked << "        \t" << integrated // tracked and integrated flags
-      << std::endl;
+      << tracked << "        \t" << integrated; // tracked and integrated flags
+		if (governor.enabled()) {
+			*logstream << "\t" << governor.integrationRate() << "\t"
+				<< governor.renderingRate() << "\t" << governor.iterations()[0]
+				<< "\t" << governor.decision();
+		}
+		if (config.integration_gating) {
+			const GatingStats& gating = pipeline.getGatingStats();
+			*logstream << "\t" << gating.skipped << "\t" << gating.translation
+				<< "\t" << gating.rotation << "\t" << gating.new_blocks << "\t"
+				<< gating.residual;
+		}
+		*logstream << std::endl;
 
 		frame++;
+		if (config.checkpoint_file != "" && 
+				frame % config.checkpoint_rate == 0)
+			pipeline.checkpoint(config.checkpoint_file, frame);
 		timings[0] = std::chrono::steady_clock::now();
 	}
+	pipeline.flushIntegration(config.mu);
+	if (config.checkpoint_file != "")
+		pipeline.waitCheckpoint();
+	if (dumper) {
+		dumper->finish();
+		std::cerr << dumper->written() << " renders written to "
+			<< config.dump_frames_dir << ", " << dumper->dropped()
+			<< " dropped, " << dumper->failed() << " failed" << std::endl;
+	}
 
-    std::shared_ptr<se::Octree<FieldType> > map_ptr;
+    std::shared_ptr<DiscreteMap<FieldType> > map_ptr;
     pipeline.getMap(map_ptr);
     map_ptr->save("test.bin");
     
@@ -189,6 +305,20 @@ int main(int argc, char ** argv) {
     std::cout << "Mesh generated in " << (e - s).count() << " seconds" << std::endl;
   }
 
+  if (config.dump_point_cloud_file != "") {
+    auto s = std::chrono::steady_clock::now();
+    const long num_points = 
+      pipeline.dump_point_cloud(config.dump_point_cloud_file);
+    auto e = std::chrono::steady_clock::now();
+    if (num_points < 0)
+      std::cerr << "Could not write " << config.dump_point_cloud_file 
+        << std::endl;
+    else
+      std::cout << num_points << " points written in " 
+        << std::chrono::duration<double>(e - s).count() << " seconds" 
+        << std::endl;
+  }
+
 	//  =========  FREE BASIC BUFFERS  =========
 
 	free(inputDepth);
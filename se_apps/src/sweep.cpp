@@ -0,0 +1,461 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+ * Runs a benchmark binary over the cartesian product of a parameter grid.
+ * Runs execute concurrently, each pinned to its own disjoint set of CPUs and
+ * in its own directory, and their timings, peak memory and trajectory error
+ * are collected into a single table.
+ *
+ * se-sweep -j 2 -g v:128,256 -g m:0.05,0.1 -g y:10/5/4,5/3/2 \
+ *   -r reference.txt -- ./se-denseslam-sdf-benchmark -i scene.raw -s 4.8
+ */
+
+#include <str_utils.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef std::map<unsigned int, std::array<double, 3> > Trajectory;
+
+struct Axis {
+  std::string option;
+  std::vector<std::string> values;
+};
+
+struct Run {
+  unsigned int id = 0;
+  std::vector<std::string> values;
+  std::string directory;
+  pid_t pid = -1;
+  int slot = -1;
+  std::chrono::steady_clock::time_point start;
+  double wall = 0.0;
+  std::string status = "pending";
+  long max_rss_kb = 0;
+  unsigned int frames = 0;
+  double computation = 0.0;
+  double total = 0.0;
+  double tracked = 0.0;
+  double ate = std::numeric_limits<double>::quiet_NaN();
+  bool pareto = false;
+};
+
+static void print_usage() {
+  std::cerr << "se-sweep [options] -- <benchmark> [fixed arguments]" 
+    << std::endl;
+  std::cerr << "-g  (--grid) <option>:<v1>,<v2>,...  : Values of a benchmark option, repeat for every axis. Separate the components of vector values with / (e.g. y:10/5/4,5/3/2)" << std::endl;
+  std::cerr << "-j  (--jobs) n                       : default is 1: Concurrent runs, each pinned to its share of the CPUs" << std::endl;
+  std::cerr << "-w  (--work-dir) <directory>         : default is sweep: Holds one directory per run" << std::endl;
+  std::cerr << "-o  (--output) <filename>            : default is <work-dir>/results.tsv: Results table" << std::endl;
+  std::cerr << "-r  (--reference) <filename>         : Trajectory, as written by -T, to compute the error of every run against" << std::endl;
+}
+
+static std::string trim(const std::string& s) {
+  const size_t first = s.find_first_not_of(" \t");
+  if (first == std::string::npos) return "";
+  return s.substr(first, s.find_last_not_of(" \t") + 1 - first);
+}
+
+static bool parse_axis(const std::string& spec, Axis& axis) {
+  const size_t colon = spec.find(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == spec.size())
+    return false;
+  axis.option = spec.substr(0, colon);
+  axis.values = splitString(spec.substr(colon + 1), ',');
+  for (auto& value : axis.values) {
+    if (value.empty()) return false;
+    std::replace(value.begin(), value.end(), '/', ',');
+  }
+  return !axis.values.empty();
+}
+
+/*
+ * Every run executes in its own directory, so relative paths to existing
+ * files are made absolute.
+ */
+static std::string absolute(const std::string& arg) {
+  if (arg.empty() || arg[0] == '/' || arg[0] == '-' ||
+      access(arg.c_str(), F_OK) != 0)
+    return arg;
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) return arg;
+  return std::string(cwd) + "/" + arg;
+}
+
+static std::vector<std::vector<int> > split_cpus(unsigned int jobs) {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+  }
+  std::vector<std::vector<int> > slots(jobs);
+  if (cpus.empty()) return slots;
+  for (size_t i = 0; i < cpus.size(); ++i)
+    slots[i * jobs / cpus.size()].push_back(cpus[i]);
+  return slots;
+}
+
+static pid_t launch(const Run& run, const std::vector<std::string>& args,
+    const std::vector<int>& cpus) {
+  const pid_t pid = fork();
+  if (pid != 0) return pid;
+
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+    setenv("OMP_NUM_THREADS", std::to_string(cpus.size()).c_str(), 1);
+  }
+  if (chdir(run.directory.c_str()) != 0) _exit(127);
+  const int out = open("output", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out >= 0) {
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    close(out);
+  }
+  std::vector<char*> argv;
+  for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(NULL);
+  execvp(argv[0], argv.data());
+  _exit(127);
+}
+
+static void parse_log(const std::string& filename, Run& run) {
+  std::ifstream log(filename.c_str());
+  std::string line;
+  if (!std::getline(log, line)) return;
+  const std::vector<std::string> header = splitString(line, '\t');
+  int computation = -1, total = -1, tracked = -1;
+  for (size_t i = 0; i < header.size(); ++i) {
+    const std::string name = trim(header[i]);
+    if (name == "computation") computation = i;
+    else if (name == "total") total = i;
+    else if (name == "tracked") tracked = i;
+  }
+  while (std::getline(log, line)) {
+    const std::vector<std::string> fields = splitString(line, '\t');
+    if (fields.size() < header.size()) continue;
+    if (computation >= 0) run.computation += std::atof(fields[computation].c_str());
+    if (total >= 0) run.total += std::atof(fields[total].c_str());
+    if (tracked >= 0) run.tracked += std::atof(fields[tracked].c_str());
+    ++run.frames;
+  }
+  if (run.frames > 0) {
+    run.computation /= run.frames;
+    run.total /= run.frames;
+    run.tracked /= run.frames;
+  }
+}
+
+static Trajectory read_trajectory(const std::string& filename) {
+  Trajectory trajectory;
+  std::ifstream file(filename.c_str());
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream fields(line);
+    unsigned int frame;
+    std::array<double, 3> t;
+    if (fields >> frame >> t[0] >> t[1] >> t[2]) trajectory[frame] = t;
+  }
+  return trajectory;
+}
+
+/*
+ * Root mean square of the position error over the frames both trajectories
+ * hold. Both start at the same pose, so no alignment is needed.
+ */
+static double trajectory_error(const Trajectory& reference, 
+    const Trajectory& trajectory) {
+  double sum = 0.0;
+  unsigned int count = 0;
+  for (const auto& pose : trajectory) {
+    const auto it = reference.find(pose.first);
+    if (it == reference.end()) continue;
+    for (int i = 0; i < 3; ++i) {
+      const double d = pose.second[i] - it->second[i];
+      sum += d * d;
+    }
+    ++count;
+  }
+  return count ? std::sqrt(sum / count) 
+    : std::numeric_limits<double>::quiet_NaN();
+}
+
+/*
+ * Flags the runs no other run beats in both computation time and error.
+ */
+static void mark_pareto(std::vector<Run>& runs) {
+  for (auto& run : runs) {
+    if (run.status != "ok" || std::isnan(run.ate)) continue;
+    run.pareto = true;
+    for (const auto& other : runs) {
+      if (other.status != "ok" || std::isnan(other.ate)) continue;
+      if (other.computation <= run.computation && other.ate <= run.ate &&
+          (other.computation < run.computation || other.ate < run.ate)) {
+        run.pareto = false;
+        break;
+      }
+    }
+  }
+}
+
+static void write_table(std::ostream& out, const std::vector<Axis>& axes,
+    const std::vector<Run>& runs, bool reference) {
+  out << "run";
+  for (const auto& axis : axes) out << "\t" << axis.option;
+  out << "\tstatus\tframes\twall_s\tcomputation_ms\ttotal_ms\ttracked"
+    << "\tmax_rss_mb";
+  if (reference) out << "\tate_rmse_m\tpareto";
+  out << std::endl;
+  out << std::fixed;
+  for (const auto& run : runs) {
+    out << run.id;
+    for (const auto& value : run.values) out << "\t" << value;
+    out << "\t" << run.status << "\t" << run.frames
+      << "\t" << std::setprecision(3) << run.wall
+      << "\t" << 1000.0 * run.computation << "\t" << 1000.0 * run.total
+      << "\t" << run.tracked << "\t" << run.max_rss_kb / 1024.0;
+    if (reference) 
+      out << "\t" << std::setprecision(6) << run.ate << "\t" << run.pareto;
+    out << std::endl;
+  }
+}
+
+int main(int argc, char ** argv) {
+  std::vector<Axis> axes;
+  unsigned int jobs = 1;
+  std::string work_dir = "sweep";
+  std::string output;
+  std::string reference_file;
+
+  static struct option long_options[] = {
+    {"grid",      required_argument, 0, 'g'},
+    {"jobs",      required_argument, 0, 'j'},
+    {"work-dir",  required_argument, 0, 'w'},
+    {"output",    required_argument, 0, 'o'},
+    {"reference", required_argument, 0, 'r'},
+    {"help",      no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+  int c;
+  int option_index = 0;
+  while ((c = getopt_long(argc, argv, "+g:j:w:o:r:h", long_options,
+          &option_index)) != -1) {
+    switch (c) {
+      case 'g': {
+                  Axis axis;
+                  if (!parse_axis(optarg, axis)) {
+                    std::cerr << "ERROR: --grid (-g) expects option:v1,v2,... "
+                      << "(was " << optarg << ")" << std::endl;
+                    return 1;
+                  }
+                  axes.push_back(axis);
+                  break;
+                }
+      case 'j':
+                if (std::atoi(optarg) < 1) {
+                  std::cerr << "ERROR: --jobs (-j) expects n >= 1 (was " 
+                    << optarg << ")" << std::endl;
+                  return 1;
+                }
+                jobs = std::atoi(optarg);
+                break;
+      case 'w':
+                work_dir = optarg;
+                break;
+      case 'o':
+                output = optarg;
+                break;
+      case 'r':
+                reference_file = optarg;
+                break;
+      case 'h':
+                print_usage();
+                return 0;
+      default:
+                print_usage();
+                return 1;
+    }
+  }
+  if (optind >= argc) {
+    std::cerr << "No benchmark given." << std::endl;
+    print_usage();
+    return 1;
+  }
+  if (output == "") output = work_dir + "/results.tsv";
+
+  std::vector<std::string> command;
+  for (int i = optind; i < argc; ++i) command.push_back(absolute(argv[i]));
+
+  Trajectory reference;
+  if (reference_file != "") {
+    reference = read_trajectory(reference_file);
+    if (reference.empty()) {
+      std::cerr << "Could not read a trajectory from " << reference_file 
+        << std::endl;
+      return 1;
+    }
+  }
+
+  // Expand the grid, the last axis varies fastest
+  std::vector<Run> runs;
+  std::vector<size_t> index(axes.size(), 0);
+  while (true) {
+    Run run;
+    run.id = runs.size();
+    for (size_t a = 0; a < axes.size(); ++a)
+      run.values.push_back(axes[a].values[index[a]]);
+    run.directory = work_dir + "/run_" + std::to_string(run.id);
+    runs.push_back(run);
+    int a = axes.size() - 1;
+    for (; a >= 0; --a) {
+      if (++index[a] < axes[a].values.size()) break;
+      index[a] = 0;
+    }
+    if (a < 0) break;
+  }
+
+  std::vector<std::vector<int> > slots = split_cpus(jobs);
+  size_t num_cpus = 0;
+  for (const auto& cpus : slots) num_cpus += cpus.size();
+  if (num_cpus > 0 && jobs > num_cpus) {
+    std::cerr << "Only " << num_cpus << " CPUs available, running " 
+      << num_cpus << " jobs" << std::endl;
+    jobs = num_cpus;
+    slots = split_cpus(jobs);
+  }
+
+  if (mkdir(work_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Could not create " << work_dir << std::endl;
+    return 1;
+  }
+
+  std::vector<bool> busy(jobs, false);
+  size_t next = 0, running = 0, done = 0;
+  while (done < runs.size()) {
+    while (running < jobs && next < runs.size()) {
+      Run& run = runs[next++];
+      mkdir(run.directory.c_str(), 0755);
+      std::vector<std::string> args = command;
+      for (size_t a = 0; a < axes.size(); ++a) {
+        if (axes[a].option.size() == 1) {
+          args.push_back("-" + axes[a].option);
+          args.push_back(run.values[a]);
+        } else {
+          args.push_back("--" + axes[a].option + "=" + run.values[a]);
+        }
+      }
+      args.push_back("-o");
+      args.push_back("log");
+      args.push_back("-T");
+      args.push_back("trajectory");
+      run.slot = std::find(busy.begin(), busy.end(), false) - busy.begin();
+      run.start = std::chrono::steady_clock::now();
+      run.pid = launch(run, args, slots[run.slot]);
+      if (run.pid < 0) {
+        run.status = "failed";
+        ++done;
+        continue;
+      }
+      busy[run.slot] = true;
+      run.status = "running";
+      ++running;
+    }
+
+    int status;
+    struct rusage usage;
+    const pid_t pid = wait4(-1, &status, 0, &usage);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    auto it = std::find_if(runs.begin(), runs.end(), 
+        [pid](const Run& run){ return run.pid == pid; });
+    if (it == runs.end()) continue;
+    Run& run = *it;
+    run.wall = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - run.start).count();
+    run.max_rss_kb = usage.ru_maxrss;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      run.status = "ok";
+    } else if (WIFEXITED(status)) {
+      run.status = "exit_" + std::to_string(WEXITSTATUS(status));
+    } else {
+      run.status = "signal_" + std::to_string(WTERMSIG(status));
+    }
+    parse_log(run.directory + "/log", run);
+    if (!reference.empty())
+      run.ate = trajectory_error(reference, 
+          read_trajectory(run.directory + "/trajectory"));
+    busy[run.slot] = false;
+    --running;
+    ++done;
+    std::cerr << "[" << done << "/" << runs.size() << "] run " << run.id
+      << " " << run.status << " in " << run.wall << " s" << std::endl;
+  }
+
+  mark_pareto(runs);
+  std::ofstream table(output.c_str());
+  if (!table.is_open()) {
+    std::cerr << "Could not write " << output << std::endl;
+  } else {
+    write_table(table, axes, runs, !reference.empty());
+  }
+  write_table(std::cout, axes, runs, !reference.empty());
+  return 0;
+}
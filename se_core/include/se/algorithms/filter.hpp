@@ -26,6 +26,7 @@
 #ifndef ACTIVE_LIST_HPP
 #define ACTIVE_LIST_HPP
 
+#include <memory>
 #include "../utils/math_utils.h" 
 #include "../node.hpp"
 #include "../utils/memory_pool.hpp"
@@ -58,17 +59,25 @@ namespace algorithms {
       return predicate(el) || satisfies(el, others...);
     }
 
+  /*! \brief Collects into out the blocks of block_array satisfying any of
+   * the predicates. Temporaries are drawn from the allocator of out, e.g. a
+   * se::ScratchAllocator to avoid per-call heap allocations.
+   */
 #ifdef _OPENMP
-  template <typename BlockType, typename... Predicates>
-    void filter(std::vector<BlockType *>& out,
+  template <typename BlockType, typename Allocator, typename... Predicates>
+    void filter(std::vector<BlockType *, Allocator>& out,
         const se::MemoryPool<BlockType>& block_array, Predicates... ps) {
 
-      std::vector<BlockType *> temp;
+      typedef typename std::allocator_traits<Allocator>::template 
+        rebind_alloc<int> IntAllocator;
       int num_elem = block_array.size();
-      temp.resize(num_elem);
+      std::vector<BlockType *, Allocator> temp(num_elem, nullptr, 
+          out.get_allocator());
 
-      int * thread_start = new int[omp_get_max_threads()];
-      int * thread_end = new int[omp_get_max_threads()];
+      std::vector<int, IntAllocator> thread_start(omp_get_max_threads(), 0, 
+          IntAllocator(out.get_allocator()));
+      std::vector<int, IntAllocator> thread_end(omp_get_max_threads(), 0, 
+          IntAllocator(out.get_allocator()));
       int spawn_threads;
 #pragma omp parallel
       {
@@ -106,8 +115,8 @@ namespace algorithms {
     }
 
 #else
-  template <typename BlockType, typename... Predicates>
-    void filter(std::vector<BlockType *>& out,
+  template <typename BlockType, typename Allocator, typename... Predicates>
+    void filter(std::vector<BlockType *, Allocator>& out,
         const se::MemoryPool<BlockType>& block_array, Predicates... ps) {
       for(unsigned int i = 0; i < block_array.size(); ++i) {
         if(satisfies(block_array[i], ps...)){
@@ -156,25 +156,26 @@ namespace meshing {
 
 }
 namespace algorithms {
-  template <typename FieldType, typename FieldSelector, 
-            typename InsidePredicate, typename TriangleType>
-    void marching_cube(Octree<FieldType>& volume, FieldSelector select, 
+  template <typename FieldType, template <typename FieldT> class MapT,
+            typename FieldSelector, typename InsidePredicate,
+            typename TriangleType>
+    void marching_cube(MapT<FieldType>& volume, FieldSelector select, 
         InsidePredicate inside, std::vector<TriangleType>& triangles)
     {
 
       using namespace meshing;
-      std::stringstream points, polygons;
-      std::vector<se::VoxelBlock<FieldType>*> blocklist;
       std::mutex lck;
       const int size = volume.size();
       const float dim = volume.dim();
-      volume.getBlockList(blocklist, false);
+      // Every allocated block is visited, straight from the memory pool
+      const se::MemoryPool<se::VoxelBlock<FieldType> >& blocklist = 
+        volume.getBlockBuffer();
       std::cout << "Blocklist size: " << blocklist.size() << std::endl;
       
 
 #pragma omp parallel for
       for(size_t i = 0; i < blocklist.size(); i++){
-        se::VoxelBlock<FieldType> * leaf = static_cast<se::VoxelBlock<FieldType> *>(blocklist[i]);  
+        se::VoxelBlock<FieldType> * leaf = blocklist[i];  
         int edge = se::VoxelBlock<FieldType>::side;
         int x, y, z ; 
         const Eigen::Vector3i& start = leaf->coordinates();
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2016 Emanuele Vespa, Imperial College London 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * */
+
+#ifndef POINT_CLOUD_HPP
+#define POINT_CLOUD_HPP
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../node.hpp"
+#include "../utils/memory_pool.hpp"
+
+namespace se {
+namespace algorithms {
+
+  /*! \brief Extracts the points where the surface crosses the edges between
+   * neighbouring observed voxels (positive y), i.e. the voxel pairs on
+   * which inside disagrees, interpolating select linearly to zero along the
+   * edge as marching cubes does. Points are in metres, normals are the normalised
+   * gradient of select oriented from the inside voxel to the outside one.
+   * Blocks are processed in parallel into per-thread buffers, concatenated
+   * into points and normals at the end.
+   */
+  template <typename FieldType, template <typename FieldT> class MapT,
+            typename FieldSelector, typename InsidePredicate>
+    void zero_crossings(MapT<FieldType>& volume, FieldSelector select, 
+        InsidePredicate inside, std::vector<Eigen::Vector3f>& points,
+        std::vector<Eigen::Vector3f>& normals) {
+
+      typedef typename MapT<FieldType>::value_type value_type;
+      const int side = se::VoxelBlock<FieldType>::side;
+      const int size = volume.size();
+      const float voxel_size = volume.dim() / volume.size();
+      const se::MemoryPool<se::VoxelBlock<FieldType> >& blocklist = 
+        volume.getBlockBuffer();
+
+#ifdef _OPENMP
+      const int num_threads = omp_get_max_threads();
+#else
+      const int num_threads = 1;
+#endif
+      std::vector<std::vector<Eigen::Vector3f> > thread_points(num_threads);
+      std::vector<std::vector<Eigen::Vector3f> > thread_normals(num_threads);
+
+#pragma omp parallel for schedule(dynamic, 16)
+      for(size_t i = 0; i < blocklist.size(); i++) {
+#ifdef _OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        std::vector<Eigen::Vector3f>& out_points = thread_points[thread];
+        std::vector<Eigen::Vector3f>& out_normals = thread_normals[thread];
+        const se::VoxelBlock<FieldType> * block = blocklist[i];
+        const Eigen::Vector3i start = block->coordinates();
+
+        for(int z = 0; z < side; ++z)
+          for(int y = 0; y < side; ++y)
+            for(int x = 0; x < side; ++x) {
+              const Eigen::Vector3i local(x, y, z);
+              const value_type source = block->data(start + local);
+              if(!(source.y > 0.f)) continue;
+              const bool source_inside = inside(source);
+
+              for(int axis = 0; axis < 3; ++axis) {
+                const Eigen::Vector3i dest = start + local + 
+                  Eigen::Vector3i::Unit(axis);
+                if(dest(axis) >= size) continue;
+                // Neighbours across the block faces live in other blocks
+                const value_type other = local(axis) < side - 1 ? 
+                  block->data(dest) : 
+                  volume.get_fine(dest(0), dest(1), dest(2));
+                if(!(other.y > 0.f) || inside(other) == source_inside) continue;
+
+                const float v1 = select(source);
+                const float v2 = select(other);
+                const float t = v2 != v1 ? 
+                  std::min(std::max((0.f - v1) / (v2 - v1), 0.f), 1.f) : 0.5f;
+                const Eigen::Vector3f point = (start + local).template cast<float>() + 
+                  t * Eigen::Vector3f::Unit(axis);
+                Eigen::Vector3f normal = volume.grad(point, select);
+                if(normal.norm() == 0.f) 
+                  normal = Eigen::Vector3f::Unit(axis);
+                // The outside voxel lies along +axis if the source is inside
+                const float outward = source_inside ? 1.f : -1.f;
+                if(outward * normal(axis) < 0.f)
+                  normal = -normal;
+                out_points.push_back(voxel_size * point);
+                out_normals.push_back(normal.normalized());
+              }
+            }
+      }
+
+      points.clear();
+      normals.clear();
+      for(int t = 0; t < num_threads; ++t) {
+        points.insert(points.end(), thread_points[t].begin(), 
+            thread_points[t].end());
+        normals.insert(normals.end(), thread_normals[t].begin(), 
+            thread_normals[t].end());
+      }
+    }
+}
+}
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2016 Emanuele Vespa, Imperial College London 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * */
+
+#ifndef UPSAMPLE_HPP
+#define UPSAMPLE_HPP
+#include <type_traits>
+#include "../node.hpp"
+
+namespace se {
+namespace algorithms {
+  namespace internal {
+    /*
+     * Interpolation between two samples through the voxel traits, for fields
+     * whose traits define interpolate(a, b, t). t may exceed one when
+     * extrapolating past the last sample of a block.
+     */
+    template <typename FieldType, typename ValueType>
+    inline auto interpolate(const ValueType& a, const ValueType& b, 
+        const float t, int) -> 
+      decltype(voxel_traits<FieldType>::interpolate(a, b, t)) {
+      return voxel_traits<FieldType>::interpolate(a, b, t);
+    }
+
+    /*
+     * Other fields take the nearest sample.
+     */
+    template <typename FieldType, typename ValueType>
+    inline ValueType interpolate(const ValueType& a, const ValueType& b, 
+        const float t, long) {
+      return t < 0.5f ? a : b;
+    }
+  }
+
+  /*! \brief Fills the voxels of block which are not multiples of 2^scale
+   * along every axis from the ones that are, one axis at a time. Voxels past
+   * the last sample are extrapolated from the last two samples, a block with
+   * a single sample is filled with it.
+   */
+  template <typename FieldType>
+    void upsample(se::VoxelBlock<FieldType> * block, const unsigned int scale) {
+      typedef typename se::VoxelBlock<FieldType>::value_type value_type;
+      const int side = se::VoxelBlock<FieldType>::side;
+      const int stride = 1 << scale;
+      if (stride <= 1) return;
+      value_type * data = block->getBlockRawPtr();
+      const int axis_offset[3] = {1, side, side*side};
+
+      for (int axis = 0; axis < 3; ++axis) {
+        const int offset = axis_offset[axis];
+        // Axes already filled are walked densely, the others only at samples
+        for (int v = 0; v < side; v += (axis > 1 ? 1 : stride))
+          for (int u = 0; u < side; u += (axis > 0 ? 1 : stride)) {
+            const int base = axis == 0 ? u*side + v*side*side :
+                             axis == 1 ? u + v*side*side : u + v*side;
+            for (int i = 0; i < side; ++i) {
+              if (i % stride == 0) continue;
+              int lower = (i / stride) * stride;
+              if (lower + stride >= side) {
+                if (lower == 0) {
+                  data[base + i*offset] = data[base];
+                  continue;
+                }
+                lower -= stride;
+              }
+              const float t = static_cast<float>(i - lower) / stride;
+              data[base + i*offset] = internal::interpolate<FieldType>(
+                  data[base + lower*offset], 
+                  data[base + (lower + stride)*offset], t, 0);
+            }
+          }
+      }
+    }
+}
+}
+#endif
@@ -0,0 +1,169 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SE_BLOCK_RAY_ITERATOR_HPP
+#define SE_BLOCK_RAY_ITERATOR_HPP
+#include <cmath>
+#include "node.hpp"
+#include "Eigen/Dense"
+
+namespace se {
+
+/*****************************************************************************
+ *
+ *
+ * Block ray iterator implementation
+ *
+ * Marches a ray through the uniform grid of voxel blocks (3D-DDA, Amanatides
+ * and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing") and returns
+ * the allocated blocks in traversal order. Only relies on fetch, hence it
+ * works on any map type. Provides the same interface of se::ray_iterator, used
+ * for maps without a hierarchy to descend such as se::HashedMap.
+ *
+*****************************************************************************/
+
+template <typename T, template <typename> class MapT>
+class block_ray_iterator {
+
+  public:
+    block_ray_iterator(const MapT<T>& m, const Eigen::Vector3f& origin,
+        const Eigen::Vector3f& direction, float nearPlane, float farPlane) :
+      map_(m), origin_(origin) {
+
+      const float dim = map_.dim();
+      const int side = VoxelBlock<T>::side;
+      block_size_ = side * dim / map_.size();
+      num_blocks_ = map_.size() / side;
+
+      static const float epsilon = 1e-7f;
+      for(int i = 0; i < 3; ++i) {
+        direction_(i) = fabsf(direction(i)) < epsilon ?
+          copysignf(epsilon, direction(i)) : direction(i);
+      }
+      const Eigen::Vector3f inv_dir = direction_.cwiseInverse();
+
+      /* Find the min-max t ranges of the voxel cube. */
+      const Eigen::Vector3f t_bottom = -1.f * origin_.cwiseProduct(inv_dir);
+      const Eigen::Vector3f t_top = (Eigen::Vector3f::Constant(dim) - origin_)
+        .cwiseProduct(inv_dir);
+      t_min_init_ = fmaxf(t_bottom.cwiseMin(t_top).maxCoeff(), nearPlane);
+      t_max_init_ = fminf(t_bottom.cwiseMax(t_top).minCoeff(), farPlane);
+      t_min_ = 0.f;
+      t_ = t_min_init_;
+
+      if(t_min_init_ >= t_max_init_) {
+        state_ = FINISHED;
+        return;
+      }
+      state_ = ADVANCE;
+
+      /* Initialise the DDA state at the block containing the entry point. */
+      const Eigen::Vector3f entry = origin_ + t_min_init_ * direction_;
+      for(int i = 0; i < 3; ++i) {
+        block_(i) = std::min(std::max(
+              static_cast<int>(floorf(entry(i) / block_size_)), 0), 
+            num_blocks_ - 1);
+        step_(i) = direction_(i) > 0.f ? 1 : -1;
+        t_delta_(i) = block_size_ * fabsf(inv_dir(i));
+        const float boundary = (block_(i) + (step_(i) > 0)) * block_size_;
+        t_next_(i) = (boundary - origin_(i)) * inv_dir(i);
+      }
+    };
+
+    /*
+     * Returns the next allocated block along the ray direction.
+     */
+    VoxelBlock<T>* next() {
+      while(state_ == ADVANCE) {
+        VoxelBlock<T> * block = map_.fetch(block_(0) * VoxelBlock<T>::side,
+            block_(1) * VoxelBlock<T>::side, block_(2) * VoxelBlock<T>::side);
+        const float t_entry = t_;
+        advance_ray();
+        if(block) {
+          t_min_ = t_entry;
+          return block;
+        }
+      }
+      return nullptr;
+    }
+
+    /*
+     * \brief Returns the minimum distance in meters to be travelled along
+     * the ray to intersect the voxel cube.
+     */
+    float tmin() const { return t_min_init_; }
+
+    /*
+     * \brief Returns the minimum distance in meters to be travelled along
+     * the ray to exit the voxel cube.
+     */
+    float tmax() const { return t_max_init_; }
+
+    /*
+     * \brief Returns the minimum distance in meters to be travelled along
+     * the ray to reach the currently intersected block, zero if no block has
+     * been intersected.
+     */
+    float tcmin() const { return t_min_; }
+
+  private:
+    typedef enum STATE {
+      ADVANCE,
+      FINISHED
+    } STATE;
+
+    inline void advance_ray() {
+      int axis = t_next_(0) < t_next_(1) ? 0 : 1;
+      axis = t_next_(2) < t_next_(axis) ? 2 : axis;
+      t_ = t_next_(axis);
+      block_(axis) += step_(axis);
+      t_next_(axis) += t_delta_(axis);
+      if(t_ > t_max_init_ || block_(axis) < 0 || block_(axis) >= num_blocks_)
+        state_ = FINISHED;
+    }
+
+    const MapT<T>& map_;
+    Eigen::Vector3f origin_;
+    Eigen::Vector3f direction_;
+    Eigen::Vector3i block_;
+    Eigen::Vector3i step_;
+    Eigen::Vector3f t_delta_;
+    Eigen::Vector3f t_next_;
+    float block_size_;
+    int num_blocks_;
+    float t_;
+    float t_min_;
+    float t_min_init_;
+    float t_max_init_;
+    STATE state_;
+};
+}
+#endif
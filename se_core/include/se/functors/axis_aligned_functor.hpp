@@ -37,6 +37,8 @@
 #include "node.hpp"
 #include "functors/data_handler.hpp"
 #include "geometry/aabb_collision.hpp"
+#include "geometry/regions.hpp"
+#include "region_iterator.hpp"
 
 namespace se {
   namespace functor {
@@ -48,11 +50,11 @@ namespace se {
         public:
         axis_aligned(MapT<FieldType>& map, UpdateF f) : _map(map), _function(f),
         _min(Eigen::Vector3i::Constant(0)), 
-        _max(Eigen::Vector3i::Constant(map.size())){ }
+        _max(Eigen::Vector3i::Constant(map.size())), _bounded(false){ }
 
         axis_aligned(MapT<FieldType>& map, UpdateF f, const Eigen::Vector3i min,
             const Eigen::Vector3i max) : _map(map), _function(f),
-        _min(min), _max(max){ }
+        _min(min), _max(max), _bounded(true){ }
 
         void update_block(se::VoxelBlock<FieldType> * block) {
           Eigen::Vector3i blockCoord = block->coordinates();
@@ -88,6 +90,11 @@ namespace se {
 
         void apply() {
 
+          if(_bounded) {
+            apply_region();
+            return;
+          }
+
           auto& block_list = _map.getBlockBuffer();
           size_t list_size = block_list.size();
 #pragma omp parallel for
@@ -103,11 +110,35 @@ namespace se {
           }
         }
 
+        /*! \brief Updates only the octants overlapping the [_min, _max) box, 
+         * found by pruned descent of the map, so that the cost scales with
+         * the size of the region rather than with the size of the map.
+         */
+        void apply_region() {
+
+          const geometry::aabb_region region(_min, _max);
+          std::vector<se::Node<FieldType> *> nodes_list;
+          std::vector<se::VoxelBlock<FieldType> *> block_list;
+          region_octants(_map, region, nodes_list, block_list);
+          size_t list_size = block_list.size();
+#pragma omp parallel for
+          for(unsigned int i = 0; i < list_size; ++i){
+            update_block(block_list[i]);
+          }
+
+          list_size = nodes_list.size();
+#pragma omp parallel for
+          for(unsigned int i = 0; i < list_size; ++i){
+            update_node(nodes_list[i]);
+          }
+        }
+
       private:
         MapT<FieldType>& _map; 
         UpdateF _function; 
         Eigen::Vector3i _min;
         Eigen::Vector3i _max;
+        bool _bounded;
       };
 
     /*!
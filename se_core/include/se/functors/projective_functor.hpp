@@ -29,17 +29,135 @@
 
 #ifndef PROJECTIVE_FUNCTOR_HPP
 #define PROJECTIVE_FUNCTOR_HPP
+#include <algorithm>
+#include <cassert>
 #include <functional>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 #include <sophus/se3.hpp>
 #include "../utils/math_utils.h"
+#include "../utils/scratch_arena.hpp"
 #include "../algorithms/filter.hpp"
+#include "../algorithms/upsample.hpp"
 #include "../node.hpp"
 #include "../functors/data_handler.hpp"
+#include "../geometry/regions.hpp"
+#include "../image/depth_pyramid.hpp"
 
 namespace se {
 namespace functor {
+
+  /*!
+   * \brief Skipping of converged blocks, for update functions returning
+   * whether the voxel they updated is still changing. A block converges after
+   * stable_visits consecutive visits without changing voxels. From then on it
+   * is updated only once every revisit_period visits, and it is re-enabled as
+   * soon as one of these updates reports a change. A stable_visits of 0
+   * disables skipping.
+   */
+  struct convergence_policy {
+    unsigned int stable_visits;
+    unsigned int revisit_period;
+  };
+
+  /*!
+   * \brief Culling of blocks against a min/max depth pyramid of the frame. A
+   * block is skipped when its footprint holds no valid depth, when it lies
+   * more than back behind the farthest depth, or more than front in front of
+   * the nearest one. back and front should bound the band within which the
+   * update function changes voxels, update functions carving free space need
+   * an infinite front. A null pyramid disables culling.
+   */
+  struct depth_culling {
+    const DepthPyramid * pyramid;
+    float front;
+    float back;
+  };
+
+  /*!
+   * \brief Depth-dependent update scale. Blocks whose centre lies at depth d
+   * from the camera are updated at scale s, with s the largest integer not
+   * above max_scale such that d >= distance * 2^(s-1): only every 2^s-th voxel
+   * along each axis is updated, the others are interpolated from them. A
+   * block is never updated at a coarser scale than the finest it has been
+   * updated at, see se::VoxelBlock::scale(). A distance of 0 disables it.
+   */
+  struct scale_policy {
+    float distance;
+    unsigned int max_scale;
+
+    unsigned int scale(const float depth) const {
+      if (distance <= 0.f) return 0;
+      unsigned int s = 0;
+      while (s < max_scale && depth >= distance * (1 << s)) ++s;
+      return s;
+    }
+  };
+
+  namespace internal {
+    /*
+     * Applies f to a voxel and returns whether the voxel is still changing.
+     * Update functions returning void never let a block converge.
+     */
+    template <typename UpdateF, typename... Args>
+    inline typename std::enable_if<std::is_void<
+      typename std::result_of<UpdateF&(Args&&...)>::type>::value, bool>::type
+    apply_update(UpdateF& f, Args&&... args) {
+      f(std::forward<Args>(args)...);
+      return true;
+    }
+
+    template <typename UpdateF, typename... Args>
+    inline typename std::enable_if<!std::is_void<
+      typename std::result_of<UpdateF&(Args&&...)>::type>::value, bool>::type
+    apply_update(UpdateF& f, Args&&... args) {
+      return f(std::forward<Args>(args)...);
+    }
+
+    /*
+     * Tests the bounds of a block seen from Tcw through K against the depth
+     * pyramid of culling. The voxel samples span side - 1 voxels from the
+     * block coordinates, and each of them reads the depth at its nearest
+     * pixel.
+     */
+    template <typename FieldType>
+    bool culled(const se::VoxelBlock<FieldType> * block, 
+        const float voxel_size, const Sophus::SE3f& Tcw, 
+        const Eigen::Matrix4f& K, const depth_culling& culling) {
+      if (!culling.pyramid) return false;
+
+      const Eigen::Vector3f base = voxel_size * 
+        block->coordinates().template cast<float>();
+      const float extent = (se::VoxelBlock<FieldType>::side - 1) * voxel_size;
+      Eigen::Vector2f lower = Eigen::Vector2f::Constant(
+          std::numeric_limits<float>::max());
+      Eigen::Vector2f upper = -lower;
+      float near = std::numeric_limits<float>::max();
+      float far = 0.f;
+      for (int i = 0; i < 8; ++i) {
+        const Eigen::Vector3f corner = Tcw * (base + extent * 
+            Eigen::Vector3f((i & 1) > 0, (i & 2) > 0, (i & 4) > 0));
+        if (corner.z() < 0.0001f) return false;
+        const Eigen::Vector3f pixel = K.topLeftCorner<3,3>() * corner;
+        const Eigen::Vector2f p = pixel.head<2>() / pixel.z();
+        lower = lower.cwiseMin(p);
+        upper = upper.cwiseMax(p);
+        near = std::min(near, corner.z());
+        far = std::max(far, corner.z());
+      }
+
+      float min_depth, max_depth;
+      if (!culling.pyramid->range(
+            (lower.array() + 0.5f).floor().matrix().template cast<int>(),
+            (upper.array() + 0.5f).floor().matrix().template cast<int>(),
+            min_depth, max_depth)) return true;
+      return near > max_depth + culling.back || 
+             far < min_depth - culling.front;
+    }
+  }
+
   template <typename FieldType, template <typename FieldT> class MapT, 
             typename UpdateF>
   class projective_functor {
@@ -47,8 +165,16 @@ namespace functor {
     public:
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
       projective_functor(MapT<FieldType>& map, UpdateF f, const Sophus::SE3f& Tcw, 
-          const Eigen::Matrix4f& K, const Eigen::Vector2i framesize) : 
-        _map(map), _function(f), _Tcw(Tcw), _K(K), _frame_size(framesize) {
+          const Eigen::Matrix4f& K, const Eigen::Vector2i framesize, 
+          ScratchArena& scratch, 
+          const convergence_policy& policy = convergence_policy{0, 1},
+          const depth_culling& culling = depth_culling{nullptr, 0.f, 0.f},
+          const scale_policy& scales = scale_policy{0.f, 0}) : 
+        _map(map), _function(f), _Tcw(Tcw), _K(K), _frame_size(framesize),
+        _policy(policy), _culling(culling), _scales(scales),
+        _active_list(ScratchAllocator<se::VoxelBlock<FieldType>*>(scratch)) {
+        assert(_policy.revisit_period > 0);
+        assert(_scales.max_scale < se::VoxelBlock<FieldType>::max_scale);
       } 
 
       void build_active_list() {
@@ -59,9 +185,12 @@ namespace functor {
 
         /* Predicates definition */
         const float voxel_size = _map.dim()/_map.size();
+        // Evaluated here, binding the product expression would keep a
+        // reference to the temporary pose matrix
+        const Eigen::Matrix4f P = _K * _Tcw.matrix();
         auto in_frustum_predicate = 
           std::bind(algorithms::in_frustum<se::VoxelBlock<FieldType>>, _1, 
-              voxel_size, _K*_Tcw.matrix(), _frame_size); 
+              voxel_size, P, _frame_size); 
         auto is_active_predicate = [](const se::VoxelBlock<FieldType>* b) {
           return b->active();
         };
@@ -70,26 +199,54 @@ namespace functor {
             in_frustum_predicate);
       }
 
+      bool culled(const se::VoxelBlock<FieldType> * block, 
+          const float voxel_size) const {
+        return internal::culled(block, voxel_size, _Tcw, _K, _culling);
+      }
+
       void update_block(se::VoxelBlock<FieldType> * block, const float voxel_size) {
 
+        // Culled blocks are left out of the active list, frustum culling
+        // brings them back once they are in view again
+        if (culled(block, voxel_size)) {
+          block->active(false);
+          return;
+        }
+
+        // Converged blocks are only revisited periodically
+        const unsigned int stable = block->stable();
+        if (_policy.stable_visits > 0 && stable >= _policy.stable_visits &&
+            (stable - _policy.stable_visits) % _policy.revisit_period != 0) {
+          block->stable(stable + 1);
+          return;
+        }
+
         const Eigen::Vector3i blockCoord = block->coordinates();
+        unsigned int y, z, blockSide; 
+        blockSide = se::VoxelBlock<FieldType>::side;
+
+        const float depth = (_Tcw * (voxel_size * (blockCoord.cast<float>() + 
+            Eigen::Vector3f::Constant(0.5f * blockSide)))).z();
+        const unsigned int scale = std::min(block->scale(), 
+            _scales.scale(depth));
+        const unsigned int stride = 1 << scale;
+
         const Eigen::Vector3f delta = _Tcw.rotationMatrix() * Eigen::Vector3f(voxel_size, 0, 0);
         const Eigen::Vector3f cameraDelta = _K.topLeftCorner<3,3>() * delta;
         bool is_visible = false;
+        bool changed = false;
 
-        unsigned int y, z, blockSide; 
-        blockSide = se::VoxelBlock<FieldType>::side;
         unsigned int ylast = blockCoord(1) + blockSide;
         unsigned int zlast = blockCoord(2) + blockSide;
 
-        for(z = blockCoord(2); z < zlast; ++z)
-          for (y = blockCoord(1); y < ylast; ++y){
+        for(z = blockCoord(2); z < zlast; z += stride)
+          for (y = blockCoord(1); y < ylast; y += stride){
             Eigen::Vector3i pix = Eigen::Vector3i(blockCoord(0), y, z);
             Eigen::Vector3f start = _Tcw * Eigen::Vector3f((pix(0)) * voxel_size, 
                 (pix(1)) * voxel_size, (pix(2)) * voxel_size);
             Eigen::Vector3f camerastart = _K.topLeftCorner<3,3>() * start;
-#pragma omp simd
-            for (unsigned int x = 0; x < blockSide; ++x){
+#pragma omp simd reduction(|:is_visible, changed)
+            for (unsigned int x = 0; x < blockSide; x += stride){
               pix(0) = x + blockCoord(0); 
               const Eigen::Vector3f camera_voxel = camerastart + (x*cameraDelta);
               const Eigen::Vector3f pos = start + (x*delta);
@@ -104,10 +261,16 @@ namespace functor {
               is_visible = true;
 
               VoxelBlockHandler<FieldType> handler = {block, pix};
-              _function(handler, pix, pos, pixel);
+              changed |= internal::apply_update(_function, handler, pix, pos, 
+                  pixel);
             }
           }
+        if (is_visible) {
+          algorithms::upsample(block, scale);
+          block->scale(scale);
+        }
         block->active(is_visible);
+        block->stable(changed ? 0 : stable + 1);
       }
 
       void update_node(se::Node<FieldType> * node, const float voxel_size) { 
@@ -161,17 +324,261 @@ namespace functor {
       Sophus::SE3f _Tcw;
       Eigen::Matrix4f _K;
       Eigen::Vector2i _frame_size;
-      std::vector<se::VoxelBlock<FieldType>*> _active_list;
+      convergence_policy _policy;
+      depth_culling _culling;
+      scale_policy _scales;
+      scratch_vector<se::VoxelBlock<FieldType>*> _active_list;
+  };
+
+  /*!
+   * \brief A camera taking part in a multi-camera projective update: its
+   * pose, intrinsics and image size, the function object bound to its frame
+   * and the culling of blocks against that frame.
+   */
+  template <typename UpdateF>
+  struct projective_camera {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Sophus::SE3f Tcw;
+    Eigen::Matrix4f K;
+    Eigen::Vector2i frame_size;
+    UpdateF function;
+    depth_culling culling;
   };
 
+  /*!
+   * \brief Maximum number of cameras of a multi-camera projective update.
+   */
+  static const unsigned int max_projective_cameras = 32;
+
+  template <typename UpdateF>
+  using projective_cameras = std::vector<projective_camera<UpdateF>, 
+        Eigen::aligned_allocator<projective_camera<UpdateF> > >;
+
+  /*!
+   * \brief Projective update from several cameras in a single traversal. A
+   * block is visited once and updated in turn from every camera whose frustum
+   * intersects it, so that the block memory is streamed once per frame rather
+   * than once per camera. Cameras are applied in order, at most
+   * max_projective_cameras of them, each skipping the blocks culled against
+   * its own frame.
+   */
+  template <typename FieldType, template <typename FieldT> class MapT, 
+            typename UpdateF>
+  class multi_projective_functor {
+
+    public:
+      multi_projective_functor(MapT<FieldType>& map, 
+          projective_cameras<UpdateF>& cameras, ScratchArena& scratch) : 
+        _map(map), _cameras(cameras),
+        _active_list(ScratchAllocator<se::VoxelBlock<FieldType>*>(scratch)),
+        _camera_masks(ScratchAllocator<unsigned int>(scratch)) {
+        assert(_cameras.size() <= max_projective_cameras);
+      } 
+
+      void build_active_list(const float voxel_size) {
+        const se::MemoryPool<se::VoxelBlock<FieldType> >& block_array = 
+          _map.getBlockBuffer();
+        const int block_side = se::VoxelBlock<FieldType>::side;
+
+        std::vector<geometry::frustum_region, 
+          ScratchAllocator<geometry::frustum_region> > frusta(
+              ScratchAllocator<geometry::frustum_region>(
+                *_active_list.get_allocator().arena()));
+        for(const auto& camera : _cameras) {
+          frusta.emplace_back(camera.K * camera.Tcw.matrix(), 
+              camera.frame_size, voxel_size, 0.f, 
+              std::numeric_limits<float>::max());
+        }
+        auto in_frustum_predicate = [&frusta, block_side](
+            const se::VoxelBlock<FieldType>* b) {
+          for(const auto& frustum : frusta) {
+            if(frustum.intersects(b->coordinates(), block_side)) return true;
+          }
+          return false;
+        };
+        auto is_active_predicate = [](const se::VoxelBlock<FieldType>* b) {
+          return b->active();
+        };
+        algorithms::filter(_active_list, block_array, is_active_predicate,
+            in_frustum_predicate);
+
+        // Cameras whose frustum intersects each block
+        _camera_masks.resize(_active_list.size());
+#pragma omp parallel for
+        for(unsigned int i = 0; i < _active_list.size(); ++i) {
+          unsigned int mask = 0;
+          for(unsigned int c = 0; c < frusta.size(); ++c) {
+            if(frusta[c].intersects(_active_list[i]->coordinates(), block_side))
+              mask |= 1u << c;
+          }
+          _camera_masks[i] = mask;
+        }
+      }
+
+      void update_block(se::VoxelBlock<FieldType> * block, 
+          const unsigned int camera_mask, const float voxel_size) {
+
+        const Eigen::Vector3i blockCoord = block->coordinates();
+        bool is_visible = false;
+
+        unsigned int y, z, blockSide; 
+        blockSide = se::VoxelBlock<FieldType>::side;
+        unsigned int ylast = blockCoord(1) + blockSide;
+        unsigned int zlast = blockCoord(2) + blockSide;
+
+        // Cameras in the outer loop: the block stays in cache while the
+        // depth accesses of each camera remain local. Every voxel still sees
+        // the cameras in order.
+        for(unsigned int c = 0; c < _cameras.size(); ++c) {
+          if(!(camera_mask & (1u << c))) continue;
+          const projective_camera<UpdateF>& camera = _cameras[c];
+          if(internal::culled(block, voxel_size, camera.Tcw, camera.K, 
+                camera.culling)) continue;
+          UpdateF function = camera.function;
+          const float xlimit = camera.frame_size(0) - 1.5f;
+          const float ylimit = camera.frame_size(1) - 1.5f;
+          const Eigen::Matrix3f R = camera.Tcw.rotationMatrix();
+          const Eigen::Vector3f t = camera.Tcw.translation();
+          const Eigen::Matrix3f K = camera.K.template topLeftCorner<3,3>();
+          const Eigen::Vector3f delta = R * Eigen::Vector3f(voxel_size, 0, 0);
+          const Eigen::Vector3f cameraDelta = K * delta;
+
+          for(z = blockCoord(2); z < zlast; ++z)
+            for (y = blockCoord(1); y < ylast; ++y){
+              Eigen::Vector3i pix = Eigen::Vector3i(blockCoord(0), y, z);
+              Eigen::Vector3f start = R * Eigen::Vector3f((pix(0)) * voxel_size,
+                  (pix(1)) * voxel_size, (pix(2)) * voxel_size) + t;
+              Eigen::Vector3f camerastart = K * start;
+#pragma omp simd reduction(|:is_visible)
+              for (unsigned int x = 0; x < blockSide; ++x){
+                pix(0) = x + blockCoord(0); 
+                const Eigen::Vector3f camera_voxel = camerastart + (x*cameraDelta);
+                const Eigen::Vector3f pos = start + (x*delta);
+                if (pos(2) < 0.0001f) continue;
+
+                const float inverse_depth = 1.f / camera_voxel(2);
+                const Eigen::Vector2f pixel = Eigen::Vector2f(
+                    camera_voxel(0) * inverse_depth + 0.5f,
+                    camera_voxel(1) * inverse_depth + 0.5f);
+                if (pixel(0) < 0.5f || pixel(0) > xlimit || 
+                    pixel(1) < 0.5f || pixel(1) > ylimit) continue;
+                is_visible = true;
+
+                VoxelBlockHandler<FieldType> handler = {block, pix};
+                function(handler, pix, pos, pixel);
+              }
+            }
+        }
+        // Every voxel is updated at full resolution, later single-camera
+        // updates must not coarsen the block again
+        if (is_visible) block->scale(0);
+        block->active(is_visible);
+        // Convergence is not tracked across cameras
+        block->stable(0);
+      }
+
+      void update_node(se::Node<FieldType> * node, const float voxel_size) { 
+        const Eigen::Vector3i voxel = Eigen::Vector3i(unpack_morton(node->code_));
+        for(auto& camera : _cameras) {
+          const Eigen::Vector3f delta = camera.Tcw.rotationMatrix() * 
+            Eigen::Vector3f::Constant(0.5f * voxel_size * node->side_);
+          const Eigen::Vector3f delta_c = 
+            camera.K.template topLeftCorner<3,3>() * delta;
+          Eigen::Vector3f base_cam = camera.Tcw * 
+            (voxel_size * voxel.cast<float> ());
+          Eigen::Vector3f basepix_hom = 
+            camera.K.template topLeftCorner<3,3>() * base_cam;
+
+#pragma omp simd
+          for(int i = 0; i < 8; ++i) {
+            const Eigen::Vector3i dir =  Eigen::Vector3i((i & 1) > 0, (i & 2) > 0, (i & 4) > 0);
+            const Eigen::Vector3f vox_cam = base_cam + dir.cast<float>().cwiseProduct(delta); 
+            const Eigen::Vector3f pix_hom = basepix_hom + dir.cast<float>().cwiseProduct(delta_c); 
+
+            if (vox_cam(2) < 0.0001f) continue;
+            const float inverse_depth = 1.f / pix_hom(2);
+            const Eigen::Vector2f pixel = Eigen::Vector2f(
+                pix_hom(0) * inverse_depth + 0.5f,
+                pix_hom(1) * inverse_depth + 0.5f);
+            if (pixel(0) < 0.5f || pixel(0) > camera.frame_size(0) - 1.5f || 
+                pixel(1) < 0.5f || pixel(1) > camera.frame_size(1) - 1.5f) continue;
+
+            NodeHandler<FieldType> handler = {node, i};
+            camera.function(handler, voxel + dir, vox_cam, pixel);
+          }
+        }
+      }
+
+      void apply() {
+
+        const float voxel_size = _map.dim() / _map.size();
+        build_active_list(voxel_size);
+        size_t list_size = _active_list.size();
+#pragma omp parallel for
+        for(unsigned int i = 0; i < list_size; ++i){
+          update_block(_active_list[i], _camera_masks[i], voxel_size);
+        }
+        _active_list.clear();
+
+        auto& nodes_list = _map.getNodesBuffer();
+        list_size = nodes_list.size();
+#pragma omp parallel for
+          for(unsigned int i = 0; i < list_size; ++i){
+            update_node(nodes_list[i], voxel_size);
+         }
+      }
+
+    private:
+      MapT<FieldType>& _map; 
+      projective_cameras<UpdateF>& _cameras;
+      scratch_vector<se::VoxelBlock<FieldType>*> _active_list;
+      scratch_vector<unsigned int> _camera_masks;
+  };
+
+  /*!
+   * \brief Applies a function object to each voxel/octant in the map falling
+   * within the camera frustum. Temporaries are drawn from scratch, which the
+   * caller is expected to reset once per frame. Converged blocks are skipped
+   * according to policy, blocks away from the observed depths according to
+   * culling, and far blocks are updated at the coarser scales of scales.
+   */
   template <typename FieldType, template <typename FieldT> class MapT, 
             typename UpdateF>
   void projective_map(MapT<FieldType>& map, const Sophus::SE3f& Tcw, 
           const Eigen::Matrix4f& K, const Eigen::Vector2i framesize,
-          UpdateF funct) {
+          UpdateF funct, ScratchArena& scratch, 
+          const convergence_policy& policy = convergence_policy{0, 1},
+          const depth_culling& culling = depth_culling{nullptr, 0.f, 0.f},
+          const scale_policy& scales = scale_policy{0.f, 0}) {
 
     projective_functor<FieldType, MapT, UpdateF> 
-      it(map, funct, Tcw, K, framesize);
+      it(map, funct, Tcw, K, framesize, scratch, policy, culling, scales);
+    it.apply();
+  }
+
+  template <typename FieldType, template <typename FieldT> class MapT, 
+            typename UpdateF>
+  void projective_map(MapT<FieldType>& map, const Sophus::SE3f& Tcw, 
+          const Eigen::Matrix4f& K, const Eigen::Vector2i framesize,
+          UpdateF funct) {
+
+    ScratchArena scratch;
+    projective_map(map, Tcw, K, framesize, funct, scratch);
+  }
+
+  /*!
+   * \brief Applies each camera's function object to the voxels/octants of
+   * the map falling within its frustum, visiting every block only once.
+   * At most max_projective_cameras cameras are supported. Temporaries are
+   * drawn from scratch, which the caller is expected to reset once per frame.
+   */
+  template <typename FieldType, template <typename FieldT> class MapT, 
+            typename UpdateF>
+  void projective_map(MapT<FieldType>& map, 
+          projective_cameras<UpdateF>& cameras, ScratchArena& scratch) {
+
+    multi_projective_functor<FieldType, MapT, UpdateF> 
+      it(map, cameras, scratch);
     it.apply();
   }
 }
@@ -0,0 +1,305 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef RAY_FUNCTOR_HPP
+#define RAY_FUNCTOR_HPP
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+#include "../utils/math_utils.h"
+#include "../utils/scratch_arena.hpp"
+#include "../node.hpp"
+#include "../octant_ops.hpp"
+#include "../functors/data_handler.hpp"
+#include "../functors/projective_functor.hpp"
+
+namespace se {
+namespace functor {
+
+  namespace internal {
+    /*
+     * Visits the cells of a uniform grid of cell_size crossed by the ray
+     * origin + t * direction for t in [t_min, t_max], in traversal order
+     * (3D-DDA, Amanatides and Woo). Only the cells within the inclusive
+     * index box [lower, upper] are visited.
+     */
+    template <typename VisitF>
+    inline void traverse_grid(const Eigen::Vector3f& origin, 
+        const Eigen::Vector3f& direction, float t_min, float t_max, 
+        const float cell_size, const Eigen::Vector3i& lower, 
+        const Eigen::Vector3i& upper, VisitF visit) {
+      static const float epsilon = 1e-7f;
+      Eigen::Vector3f dir;
+      for(int i = 0; i < 3; ++i) {
+        dir(i) = fabsf(direction(i)) < epsilon ? 
+          copysignf(epsilon, direction(i)) : direction(i);
+      }
+      const Eigen::Vector3f inv_dir = dir.cwiseInverse();
+      const Eigen::Vector3f t_bottom = (cell_size * lower.cast<float>() - 
+          origin).cwiseProduct(inv_dir);
+      const Eigen::Vector3f t_top = (cell_size * (upper + 
+            Eigen::Vector3i::Ones()).cast<float>() - origin).cwiseProduct(inv_dir);
+      t_min = fmaxf(t_min, t_bottom.cwiseMin(t_top).maxCoeff());
+      t_max = fminf(t_max, t_bottom.cwiseMax(t_top).minCoeff());
+      if(t_min >= t_max) return;
+
+      const Eigen::Vector3f entry = origin + t_min * dir;
+      Eigen::Vector3i cell, step;
+      Eigen::Vector3f t_delta, t_next;
+      for(int i = 0; i < 3; ++i) {
+        cell(i) = math::clamp(static_cast<int>(floorf(entry(i) / cell_size)), 
+            lower(i), upper(i));
+        step(i) = dir(i) > 0.f ? 1 : -1;
+        t_delta(i) = cell_size * fabsf(inv_dir(i));
+        t_next(i) = ((cell(i) + (step(i) > 0)) * cell_size - origin(i)) * 
+          inv_dir(i);
+      }
+
+      while(true) {
+        visit(cell);
+        int axis = t_next(0) < t_next(1) ? 0 : 1;
+        axis = t_next(2) < t_next(axis) ? 2 : axis;
+        if(t_next(axis) >= t_max) break;
+        cell(axis) += step(axis);
+        if(cell(axis) < lower(axis) || cell(axis) > upper(axis)) break;
+        t_next(axis) += t_delta(axis);
+      }
+    }
+  }
+
+  /*!
+   * \brief Integration of point measurements with their own sensor origins,
+   * e.g. LiDAR scans, without a depth image. The i-th ray goes from
+   * origins[i] through points[i] and is updated over the segment from front
+   * in front of the point to back behind it.
+   *
+   * The blocks crossed by the segments are found with a block-level DDA and
+   * the missing ones are allocated. The (block, ray) pairs are then sorted
+   * by block key, so that every block is updated by a single thread from all
+   * the rays crossing it, each ray visiting the voxels of its segment with a
+   * voxel-level DDA.
+   *
+   * The update function sees every ray as the optical axis of a one pixel
+   * camera: a voxel at distance t along ray i is passed as position (0, 0, t)
+   * and pixel (i + 0.5, 0.5). Update functions reading the measurement of
+   * their pixel from a num_points x 1 image of the ranges |points[i] -
+   * origins[i]|, such as the projective ones, apply unchanged.
+   */
+  template <typename FieldType, template <typename FieldT> class MapT, 
+            typename UpdateF>
+  class ray_functor {
+
+    public:
+      struct block_ray {
+        key_t key;
+        unsigned int ray;
+        bool operator<(const block_ray& other) const {
+          return key < other.key || (key == other.key && ray < other.ray);
+        }
+      };
+
+      ray_functor(MapT<FieldType>& map, UpdateF f, 
+          const Eigen::Vector3f * points, const Eigen::Vector3f * origins, 
+          const size_t num_points, const float front, const float back, 
+          ScratchArena& scratch) : 
+        _map(map), _function(f), _points(points), _origins(origins), 
+        _num_points(num_points), _front(front), _back(back),
+        _pairs(ScratchAllocator<block_ray>(scratch)),
+        _counts(ScratchAllocator<unsigned int>(scratch)),
+        _keys(ScratchAllocator<key_t>(scratch)),
+        _runs(ScratchAllocator<size_t>(scratch)) {
+        // Rays are identified by a float pixel coordinate
+        assert(num_points <= (1u << 24));
+      }
+
+      /*
+       * Segment of ray i in the voxel grid. Returns false for degenerate
+       * rays.
+       */
+      bool segment(const unsigned int i, Eigen::Vector3f& origin, 
+          Eigen::Vector3f& direction, float& t_min, float& t_max) const {
+        const float inverse_voxel_size = _map.size() / _map.dim();
+        origin = inverse_voxel_size * _origins[i];
+        direction = _points[i] - _origins[i];
+        const float range = direction.norm();
+        if(range <= 0.f || !std::isfinite(range)) return false;
+        direction /= range;
+        t_min = inverse_voxel_size * fmaxf(0.f, range - _front);
+        t_max = inverse_voxel_size * (range + _back);
+        return true;
+      }
+
+      /*
+       * Block-level DDA of every ray, in two passes to fill the pairs in
+       * parallel: count, then write at the prefix-summed offsets.
+       */
+      void build_pairs() {
+        const int side = VoxelBlock<FieldType>::side;
+        const Eigen::Vector3i last = Eigen::Vector3i::Constant(
+            _map.size() / side - 1);
+        _counts.assign(_num_points + 1, 0);
+
+#pragma omp parallel for
+        for(unsigned int i = 0; i < _num_points; ++i) {
+          Eigen::Vector3f origin, direction;
+          float t_min, t_max;
+          if(!segment(i, origin, direction, t_min, t_max)) continue;
+          unsigned int count = 0;
+          internal::traverse_grid(origin, direction, t_min, t_max, side,
+              Eigen::Vector3i::Zero(), last, 
+              [&count](const Eigen::Vector3i&) { ++count; });
+          _counts[i + 1] = count;
+        }
+        for(unsigned int i = 0; i < _num_points; ++i) {
+          _counts[i + 1] += _counts[i];
+        }
+
+        _pairs.resize(_counts[_num_points]);
+#pragma omp parallel for
+        for(unsigned int i = 0; i < _num_points; ++i) {
+          Eigen::Vector3f origin, direction;
+          float t_min, t_max;
+          if(!segment(i, origin, direction, t_min, t_max)) continue;
+          unsigned int offset = _counts[i];
+          internal::traverse_grid(origin, direction, t_min, t_max, side,
+              Eigen::Vector3i::Zero(), last, 
+              [this, &offset, i, side](const Eigen::Vector3i& block) {
+                const Eigen::Vector3i base = side * block;
+                _pairs[offset++] = {_map.hash(base(0), base(1), base(2)), i};
+              });
+        }
+        std::sort(_pairs.begin(), _pairs.end());
+      }
+
+      /*
+       * Allocates the blocks of the pairs which are not allocated yet.
+       */
+      void allocate_blocks() {
+        for(size_t p = 0; p < _pairs.size(); ++p) {
+          if(p > 0 && _pairs[p].key == _pairs[p - 1].key) continue;
+          const Eigen::Vector3i base = keyops::decode(_pairs[p].key);
+          if(!_map.fetch(base(0), base(1), base(2))) {
+            _keys.push_back(_pairs[p].key);
+          }
+        }
+        if(!_keys.empty()) {
+          _map.allocate(_keys.data(), _keys.size());
+        }
+      }
+
+      void update_block(const size_t begin, const size_t end) {
+        const Eigen::Vector3i base = keyops::decode(_pairs[begin].key);
+        VoxelBlock<FieldType> * block = _map.fetch(base(0), base(1), base(2));
+        if(!block) return;
+        const int side = VoxelBlock<FieldType>::side;
+        const Eigen::Vector3i last = base + Eigen::Vector3i::Constant(side - 1);
+        const float voxel_size = _map.dim() / _map.size();
+
+        for(size_t p = begin; p < end; ++p) {
+          const unsigned int i = _pairs[p].ray;
+          Eigen::Vector3f origin, direction;
+          float t_min, t_max;
+          if(!segment(i, origin, direction, t_min, t_max)) continue;
+          const Eigen::Vector2f pixel(i + 0.5f, 0.5f);
+          internal::traverse_grid(origin, direction, t_min, t_max, 1.f, 
+              base, last, 
+              [&](const Eigen::Vector3i& voxel) {
+                // Distance along the ray of the voxel sample, its corner as
+                // in the projective update
+                const float t = voxel_size * 
+                  (voxel.cast<float>() - origin).dot(direction);
+                if(t < 0.0001f) return;
+                VoxelBlockHandler<FieldType> handler = {block, voxel};
+                internal::apply_update(_function, handler, voxel, 
+                    Eigen::Vector3f(0.f, 0.f, t), pixel);
+              });
+        }
+        block->active(true);
+        block->stable(0);
+      }
+
+      void apply() {
+        build_pairs();
+        allocate_blocks();
+
+        // Runs of pairs sharing a block
+        for(size_t p = 0; p < _pairs.size(); ++p) {
+          if(p == 0 || _pairs[p].key != _pairs[p - 1].key) _runs.push_back(p);
+        }
+        _runs.push_back(_pairs.size());
+
+        const int num_runs = _runs.size() - 1;
+#pragma omp parallel for schedule(dynamic)
+        for(int r = 0; r < num_runs; ++r) {
+          update_block(_runs[r], _runs[r + 1]);
+        }
+        _pairs.clear();
+        _counts.clear();
+        _keys.clear();
+        _runs.clear();
+      }
+
+    private:
+      MapT<FieldType>& _map; 
+      UpdateF _function; 
+      const Eigen::Vector3f * _points;
+      const Eigen::Vector3f * _origins;
+      size_t _num_points;
+      float _front;
+      float _back;
+      scratch_vector<block_ray> _pairs;
+      scratch_vector<unsigned int> _counts;
+      scratch_vector<key_t> _keys;
+      scratch_vector<size_t> _runs;
+  };
+
+  /*!
+   * \brief Allocates and updates the map along the rays from origins[i]
+   * through points[i], between front in front of and back behind every
+   * point. Points and origins are in the map frame, in meters. See
+   * se::functor::ray_functor.
+   */
+  template <typename FieldType, template <typename FieldT> class MapT, 
+            typename UpdateF>
+  void ray_map(MapT<FieldType>& map, const Eigen::Vector3f * points, 
+      const Eigen::Vector3f * origins, const size_t num_points, 
+      const float front, const float back, UpdateF funct, 
+      ScratchArena& scratch) {
+    ray_functor<FieldType, MapT, UpdateF> 
+      it(map, funct, points, origins, num_points, front, back, scratch);
+    it.apply();
+  }
+}
+}
+#endif
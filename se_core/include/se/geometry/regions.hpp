@@ -0,0 +1,143 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef REGIONS_HPP
+#define REGIONS_HPP
+#include <cmath>
+#include "Eigen/Dense"
+
+namespace se {
+namespace geometry {
+
+  /*! \brief Axis aligned box spanning the voxels in [min, max). Regions expose
+   * intersects and contains tests against the cubic octant with lower corner
+   * corner and edge side, all in voxel coordinates.
+   */
+  struct aabb_region {
+    aabb_region(const Eigen::Vector3i& min, const Eigen::Vector3i& max) : 
+      min_(min), max_(max) { }
+
+    bool intersects(const Eigen::Vector3i& corner, const int side) const {
+      return (corner.array() < max_.array()).all() && 
+             ((corner.array() + side) > min_.array()).all();
+    }
+
+    bool contains(const Eigen::Vector3i& corner, const int side) const {
+      return (corner.array() >= min_.array()).all() && 
+             ((corner.array() + side) <= max_.array()).all();
+    }
+
+    Eigen::Vector3i min_;
+    Eigen::Vector3i max_;
+  };
+
+  /*! \brief Ball of given centre and radius, both in voxel units.
+   */
+  struct sphere_region {
+    sphere_region(const Eigen::Vector3f& centre, const float radius) :
+      centre_(centre), radius_(radius) { }
+
+    bool intersects(const Eigen::Vector3i& corner, const int side) const {
+      const Eigen::Vector3f lower = corner.cast<float>();
+      const Eigen::Vector3f upper = lower + Eigen::Vector3f::Constant(side);
+      const Eigen::Vector3f closest = centre_.cwiseMax(lower).cwiseMin(upper);
+      return (closest - centre_).squaredNorm() <= radius_ * radius_;
+    }
+
+    bool contains(const Eigen::Vector3i& corner, const int side) const {
+      const Eigen::Vector3f lower = corner.cast<float>() - centre_;
+      const Eigen::Vector3f upper = lower + Eigen::Vector3f::Constant(side);
+      const Eigen::Vector3f farthest = lower.cwiseAbs().cwiseMax(upper.cwiseAbs());
+      return farthest.squaredNorm() <= radius_ * radius_;
+    }
+
+    Eigen::Vector3f centre_;
+    float radius_;
+  };
+
+  /*! \brief Viewing frustum of a pinhole camera, bounded by the image borders
+   * and by the near and far planes. The tests are conservative: octants close
+   * to the frustum edges might be reported as intersecting.
+   */
+  struct frustum_region {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    /*! \brief 
+     * \param camera projection matrix K * Tcw, mapping world points in
+     * metres to homogeneous pixel coordinates
+     * \param frame_size image width and height in pixels
+     * \param voxel_size voxel edge in metres
+     * \param near_plane minimum depth in metres
+     * \param far_plane maximum depth in metres
+     */
+    frustum_region(const Eigen::Matrix4f& camera, 
+        const Eigen::Vector2i& frame_size, const float voxel_size, 
+        const float near_plane, const float far_plane) {
+      const Eigen::Vector4f u = camera.row(0);
+      const Eigen::Vector4f v = camera.row(1);
+      const Eigen::Vector4f w = camera.row(2);
+      planes_[0] = u;
+      planes_[1] = frame_size(0) * w - u;
+      planes_[2] = v;
+      planes_[3] = frame_size(1) * w - v;
+      planes_[4] = w - Eigen::Vector4f(0, 0, 0, near_plane);
+      planes_[5] = Eigen::Vector4f(0, 0, 0, far_plane) - w;
+      // Express the planes in voxel coordinates
+      for(int i = 0; i < 6; ++i) planes_[i].head<3>() *= voxel_size;
+    }
+
+    bool intersects(const Eigen::Vector3i& corner, const int side) const {
+      const Eigen::Vector3f lower = corner.cast<float>();
+      for(int i = 0; i < 6; ++i) {
+        const Eigen::Vector3f n = planes_[i].head<3>();
+        // Box corner farthest along the plane normal
+        const Eigen::Vector3f p = lower + 
+          (n.array() > 0.f).cast<float>().matrix() * side;
+        if(n.dot(p) + planes_[i](3) < 0.f) return false;
+      }
+      return true;
+    }
+
+    bool contains(const Eigen::Vector3i& corner, const int side) const {
+      const Eigen::Vector3f lower = corner.cast<float>();
+      for(int i = 0; i < 6; ++i) {
+        const Eigen::Vector3f n = planes_[i].head<3>();
+        // Box corner closest along the plane normal
+        const Eigen::Vector3f p = lower + 
+          (n.array() < 0.f).cast<float>().matrix() * side;
+        if(n.dot(p) + planes_[i](3) < 0.f) return false;
+      }
+      return true;
+    }
+
+    Eigen::Vector4f planes_[6];
+  };
+}
+}
+#endif
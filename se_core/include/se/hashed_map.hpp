@@ -0,0 +1,651 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef HASHED_MAP_HPP
+#define HASHED_MAP_HPP
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include "utils/math_utils.h"
+#include "octree_defines.h"
+#include "voxel_traits.hpp"
+#include "utils/morton_utils.hpp"
+#include "octant_ops.hpp"
+#include "node.hpp"
+#include "utils/memory_pool.hpp"
+#include "io/block_codec.hpp"
+#include "interpolation/interp_gather.hpp"
+#include "geometry/regions.hpp"
+
+namespace se {
+
+/*! \brief Flat spatial hash of voxel blocks. Exposes the same access,
+ * allocation and interpolation interface of se::Octree, so that it can be used
+ * as a drop-in DiscreteMapT for VolumeTemplate and the functors. Blocks are
+ * indexed by their morton key in an open-addressing table with linear probing;
+ * insertion is lock-free so that allocate can run in parallel. No intermediate
+ * nodes are stored, hence getNodesBuffer() is always empty.
+ */
+template <typename T>
+class HashedMap
+{
+
+public:
+
+  typedef voxel_traits<T> traits_type;
+  typedef typename traits_type::value_type value_type;
+  value_type empty() const { return traits_type::empty(); }
+  value_type init_val() const { return traits_type::initValue(); }
+
+  // Compile-time constant expressions
+  // # of voxels per side in a voxel block
+  static constexpr unsigned int blockSide = BLOCK_SIDE;
+  // maximum tree depth in bits
+  static constexpr unsigned int max_depth = ((sizeof(key_t)*8)/3);
+  // Tree depth at which blocks are found
+  static constexpr unsigned int block_depth = max_depth - math::log2_const(BLOCK_SIDE);
+
+  HashedMap() : size_(0), dim_(0.f), max_level_(0), block_level_(0),
+    capacity_(0), hash_shift_(0), keys_(nullptr), slots_(nullptr) {
+  };
+
+  ~HashedMap(){
+    delete[] keys_;
+    delete[] slots_;
+  }
+
+  /*! \brief Initialises the map attributes
+   * \param size number of voxels per side of the cube
+   * \param dim cube extension per side, in meter
+   */
+  void init(int size, float dim);
+
+  /*! \brief Removes every block. The block pool and the hash table keep
+   * their memory, blocks allocated afterwards are reinitialised as they are
+   * reused.
+   */
+  void clear();
+
+  inline int size() const { return size_; }
+  inline float dim() const { return dim_; }
+
+  /*! \brief Sets the voxel value at coordinates (x,y,z). If the containing
+   * block is not allocated the call has no effect.
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   */
+  void set(const int x, const int y, const int z, const value_type val);
+
+  /*! \brief Retrieves voxel value at coordinates (x,y,z)
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   */
+  value_type get(const int x, const int y, const int z) const;
+  value_type get_fine(const int x, const int y, const int z) const;
+
+  /*! \brief Fetch the voxel block at which contains voxel  (x,y,z)
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   */
+  VoxelBlock<T> * fetch(const int x, const int y, const int z) const;
+
+  /*! \brief Fetch the octant (x,y,z) at level depth. Only voxel blocks are
+   * stored, hence any depth returns the containing block, if allocated.
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   * \param depth maximum depth to be searched
+   */
+  Node<T> * fetch_octant(const int x, const int y, const int z,
+      const int depth) const;
+
+  /*! \brief Insert the block containing voxel (x,y,z). The table may be
+   * rehashed to make room, so calls are serialised with each other and with
+   * allocate, but must not overlap lookups such as fetch or get. Use
+   * allocate to insert many blocks in parallel.
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   */
+  VoxelBlock<T> * insert(const int x, const int y, const int z);
+
+  /*! \brief Interp voxel value at voxel position  (x,y,z)
+   * \param pos three-dimensional coordinates in which each component belongs
+   * to the interval [0, size]
+   * \return signed distance function value at voxel position (x, y, z)
+   */
+  template <typename FieldSelect>
+  float interp(const Eigen::Vector3f& pos, FieldSelect f) const;
+
+  /*! \brief Compute the gradient at voxel position  (x,y,z)
+   * \param pos three-dimensional coordinates in which each component belongs
+   * to the interval [0, size]
+   * \return gradient at voxel position pos
+   */
+  Eigen::Vector3f grad(const Eigen::Vector3f& pos) const;
+
+  template <typename FieldSelect>
+  Eigen::Vector3f grad(const Eigen::Vector3f& pos, FieldSelect selector) const;
+
+  /*! \brief Get the list of allocated block. If the active switch is set to
+   * true then only the visible blocks are retrieved.
+   * \param blocklist output vector of allocated blocks
+   * \param active boolean switch. Set to true to retrieve visible, allocated
+   * blocks, false to retrieve all allocated blocks.
+   */
+  void getBlockList(std::vector<VoxelBlock<T> *>& blocklist, bool active);
+  MemoryPool<VoxelBlock<T> >& getBlockBuffer(){ return block_buffer_; };
+  const MemoryPool<VoxelBlock<T> >& getBlockBuffer() const { 
+    return block_buffer_; 
+  };
+  MemoryPool<Node<T> >& getNodesBuffer(){ return nodes_buffer_; };
+
+  /*! \brief Computes the morton code of the block containing voxel
+   * at coordinates (x,y,z)
+   * \param x x coordinate in interval [0, size]
+   * \param y y coordinate in interval [0, size]
+   * \param z z coordinate in interval [0, size]
+   */
+  key_t hash(const int x, const int y, const int z) {
+    return keyops::encode(x, y, z, block_level_, max_level_);
+  }
+
+  key_t hash(const int x, const int y, const int z, key_t scale) {
+    return keyops::encode(x, y, z, scale, max_level_);
+  }
+
+  /*! \brief allocate a set of voxel blocks via their positional key. Keys
+   * referring to octants coarser than a voxel block are ignored, finer ones
+   * allocate their enclosing block.
+   * \param keys collection of voxel block keys to be allocated (i.e. their
+   * morton number)
+   * \param number of keys in the keys array
+   */
+  bool allocate(key_t *keys, int num_elem);
+
+  /*! \brief Writes the map in the layout of Octree::save, which
+   * Octree::load and HashedMap::load both read.
+   */
+  void save(const std::string& filename);
+  void save(std::ostream& os);
+
+  /*! \brief Copies the map into snapshot, see Octree::snapshot.
+   */
+  void snapshot(MapSnapshot<T>& snapshot) const {
+    snapshot.copy(size_, dim_, nullptr, block_buffer_);
+  }
+
+  /*! \brief Reads a map written by Octree::save or HashedMap::save.
+   * \return false if the data is truncated or malformed
+   */
+  void load(const std::string& filename);
+  bool load(std::istream& is);
+
+  /*! \brief Counts the number of blocks allocated
+   * \return number of voxel blocks allocated
+   */
+  int leavesCount() const { return block_buffer_.size(); }
+
+  /*! \brief Counts the number of internal nodes
+   * \return number of internal nodes, always zero for a hashed map
+   */
+  int nodeCount() const { return 0; }
+
+private:
+
+  int size_;
+  float dim_;
+  int max_level_;
+  int block_level_;
+  MemoryPool<VoxelBlock<T> > block_buffer_;
+  MemoryPool<Node<T> > nodes_buffer_;
+
+  // Hash table storage. capacity_ is always a power of two.
+  static constexpr key_t empty_key = std::numeric_limits<key_t>::max();
+  static constexpr float max_load_factor = 0.5f;
+  size_t capacity_;
+  int hash_shift_;
+  std::atomic<key_t> * keys_;
+  std::atomic<VoxelBlock<T> *> * slots_;
+  // Held while the table may grow, by insert(x, y, z) and allocate
+  std::mutex grow_mutex_;
+
+  inline size_t slot(const key_t key) const;
+  VoxelBlock<T> * find(const key_t key) const;
+  VoxelBlock<T> * insert(const key_t key);
+
+  // Grows the table so that n more blocks can be inserted concurrently
+  // without exceeding max_load_factor. Not thread safe.
+  void reserve(const size_t n);
+  void rehash(const size_t capacity);
+
+  // Private implementation of cached methods
+  value_type get(const int x, const int y, const int z, VoxelBlock<T>* cached) const;
+};
+
+template <typename T>
+constexpr key_t HashedMap<T>::empty_key;
+
+template <typename T>
+constexpr float HashedMap<T>::max_load_factor;
+
+template <typename T>
+void HashedMap<T>::init(int size, float dim) {
+  size_ = size;
+  dim_ = dim;
+  max_level_ = log2(size);
+  block_level_ = max_level_ - math::log2_const(blockSide);
+  rehash(1024);
+}
+
+template <typename T>
+void HashedMap<T>::clear() {
+  block_buffer_.clear();
+  for(size_t i = 0; i < capacity_; ++i) {
+    keys_[i].store(empty_key, std::memory_order_relaxed);
+    slots_[i].store(NULL, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+inline size_t HashedMap<T>::slot(const key_t key) const {
+  // Fibonacci hashing, morton codes of neighbouring blocks only differ in
+  // their low order bits.
+  return (keyops::code(key) * 0x9E3779B97F4A7C15ull) >> hash_shift_;
+}
+
+template <typename T>
+inline VoxelBlock<T> * HashedMap<T>::find(const key_t key) const {
+  if(!keys_) return NULL;
+  for(size_t i = slot(key); ; i = (i + 1) & (capacity_ - 1)) {
+    const key_t k = keys_[i].load(std::memory_order_acquire);
+    if(k == key) return slots_[i].load(std::memory_order_acquire);
+    if(k == empty_key) return NULL;
+  }
+}
+
+template <typename T>
+VoxelBlock<T> * HashedMap<T>::insert(const key_t key) {
+  for(size_t i = slot(key); ; i = (i + 1) & (capacity_ - 1)) {
+    key_t k = keys_[i].load(std::memory_order_acquire);
+    if(k == empty_key) {
+      if(keys_[i].compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+        VoxelBlock<T> * block = block_buffer_.acquire_block();
+        block->coordinates(keyops::decode(key));
+        block->code_ = key;
+        block->side_ = blockSide;
+        block->active(true);
+        slots_[i].store(block, std::memory_order_release);
+        return block;
+      }
+      // k now holds the key which won the slot
+    }
+    if(k == key) {
+      // Another thread claimed the slot, wait until the block is published
+      VoxelBlock<T> * block;
+      while(!(block = slots_[i].load(std::memory_order_acquire)));
+      return block;
+    }
+  }
+}
+
+template <typename T>
+void HashedMap<T>::reserve(const size_t n) {
+  const size_t required = block_buffer_.size() + n;
+  size_t capacity = capacity_;
+  while(required > max_load_factor * capacity) capacity *= 2;
+  if(capacity != capacity_) rehash(capacity);
+  block_buffer_.reserve(n);
+}
+
+template <typename T>
+void HashedMap<T>::rehash(const size_t capacity) {
+  delete[] keys_;
+  delete[] slots_;
+  capacity_ = capacity;
+  hash_shift_ = 64 - __builtin_ctzll(capacity_);
+  keys_ = new std::atomic<key_t>[capacity_];
+  slots_ = new std::atomic<VoxelBlock<T> *>[capacity_];
+  for(size_t i = 0; i < capacity_; ++i) {
+    keys_[i].store(empty_key, std::memory_order_relaxed);
+    slots_[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  // Every allocated block lives in the pool, re-index them from there.
+  for(size_t b = 0; b < block_buffer_.size(); ++b) {
+    VoxelBlock<T> * block = block_buffer_[b];
+    size_t i = slot(block->code_);
+    while(keys_[i].load(std::memory_order_relaxed) != empty_key)
+      i = (i + 1) & (capacity_ - 1);
+    keys_[i].store(block->code_, std::memory_order_relaxed);
+    slots_[i].store(block, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+inline VoxelBlock<T> * HashedMap<T>::fetch(const int x, const int y,
+   const int z) const {
+  return find(keyops::encode(x, y, z, block_level_, max_level_));
+}
+
+template <typename T>
+inline Node<T> * HashedMap<T>::fetch_octant(const int x, const int y,
+   const int z, const int) const {
+  return fetch(x, y, z);
+}
+
+template <typename T>
+VoxelBlock<T> * HashedMap<T>::insert(const int x, const int y, const int z) {
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+  reserve(1);
+  return insert(keyops::encode(x, y, z, block_level_, max_level_));
+}
+
+template <typename T>
+inline void HashedMap<T>::set(const int x, const int y, const int z,
+    const value_type val) {
+  VoxelBlock<T> * block = fetch(x, y, z);
+  if(!block) return;
+  block->data(Eigen::Vector3i(x, y, z), val);
+}
+
+template <typename T>
+inline typename HashedMap<T>::value_type HashedMap<T>::get(const int x,
+    const int y, const int z) const {
+  VoxelBlock<T> * block = fetch(x, y, z);
+  if(!block) return init_val();
+  return block->data(Eigen::Vector3i(x, y, z));
+}
+
+template <typename T>
+inline typename HashedMap<T>::value_type HashedMap<T>::get_fine(const int x,
+    const int y, const int z) const {
+  return get(x, y, z);
+}
+
+template <typename T>
+inline typename HashedMap<T>::value_type HashedMap<T>::get(const int x,
+   const int y, const int z, VoxelBlock<T>* cached) const {
+
+  if(cached != NULL){
+    const Eigen::Vector3i pos = Eigen::Vector3i(x, y, z);
+    const Eigen::Vector3i lower = cached->coordinates();
+    const Eigen::Vector3i upper = lower + Eigen::Vector3i::Constant(blockSide-1);
+    const int contained =
+      ((pos.array() >= lower.array()) && (pos.array() <= upper.array())).all();
+    if(contained){
+      return cached->data(pos);
+    }
+  }
+  return get(x, y, z);
+}
+
+template <typename T>
+bool HashedMap<T>::allocate(key_t *keys, int num_elem){
+
+  // The table only grows here, before the lock-free inserts start
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+  reserve(num_elem);
+
+#pragma omp parallel for
+  for (int i = 0; i < num_elem; i++){
+    if(keyops::level(keys[i]) < block_level_) continue;
+    const Eigen::Vector3i coords = keyops::decode(keys[i]);
+    insert(keyops::encode(coords(0), coords(1), coords(2), block_level_,
+          max_level_));
+  }
+  return true;
+}
+
+template <typename T>
+template <typename FieldSelector>
+float HashedMap<T>::interp(const Eigen::Vector3f& pos, FieldSelector select) const {
+
+  const Eigen::Vector3i base = math::floorf(pos).cast<int>();
+  const Eigen::Vector3f factor = math::fracf(pos);
+  const Eigen::Vector3i lower = base.cwiseMax(Eigen::Vector3i::Constant(0));
+
+  float points[8];
+  gather_points(*this, lower, select, points);
+
+  return (((points[0] * (1 - factor(0))
+          + points[1] * factor(0)) * (1 - factor(1))
+          + (points[2] * (1 - factor(0))
+          + points[3] * factor(0)) * factor(1))
+          * (1 - factor(2))
+          + ((points[4] * (1 - factor(0))
+          + points[5] * factor(0))
+          * (1 - factor(1))
+          + (points[6] * (1 - factor(0))
+          + points[7] * factor(0))
+          * factor(1)) * factor(2));
+}
+
+template <typename T>
+Eigen::Vector3f HashedMap<T>::grad(const Eigen::Vector3f& pos) const {
+  return grad(pos, [](const value_type& val) { return val(0); });
+}
+
+template <typename T>
+template <typename FieldSelector>
+Eigen::Vector3f HashedMap<T>::grad(const Eigen::Vector3f& pos,
+    FieldSelector select) const {
+
+  const Eigen::Vector3i base = Eigen::Vector3i(math::floorf(pos).cast<int>());
+  const Eigen::Vector3f factor = math::fracf(pos);
+  const Eigen::Vector3i lower_lower = (base - Eigen::Vector3i::Constant(1)).cwiseMax(Eigen::Vector3i::Constant(0));
+  const Eigen::Vector3i lower_upper = base.cwiseMax(Eigen::Vector3i::Constant(0));
+  const Eigen::Vector3i upper_lower = (base + Eigen::Vector3i::Constant(1)).cwiseMin(
+      Eigen::Vector3i::Constant(size_) - Eigen::Vector3i::Constant(1));
+  const Eigen::Vector3i upper_upper = (base + Eigen::Vector3i::Constant(2)).cwiseMin(
+      Eigen::Vector3i::Constant(size_) - Eigen::Vector3i::Constant(1));
+  const Eigen::Vector3i & lower = lower_upper;
+  const Eigen::Vector3i & upper = upper_lower;
+
+  VoxelBlock<T> * n = fetch(base(0), base(1), base(2));
+
+  // Central differences along axis a at the two lattice points enclosing pos,
+  // trilinearly blended over the remaining axes b and c.
+  Eigen::Vector3f gradient;
+  for(int a = 0; a < 3; ++a) {
+    const int b = (a + 1) % 3;
+    const int c = (a + 2) % 3;
+    float g = 0.f;
+    for(int i = 0; i < 8; ++i) {
+      const int ia = i & 1, ib = (i & 2) >> 1, ic = (i & 4) >> 2;
+      Eigen::Vector3i hi, lo;
+      hi(b) = lo(b) = ib ? upper(b) : lower(b);
+      hi(c) = lo(c) = ic ? upper(c) : lower(c);
+      hi(a) = ia ? upper_upper(a) : upper_lower(a);
+      lo(a) = ia ? lower_upper(a) : lower_lower(a);
+      const float w = (ia ? factor(a) : 1 - factor(a)) *
+        (ib ? factor(b) : 1 - factor(b)) * (ic ? factor(c) : 1 - factor(c));
+      g += w * (select(get(hi(0), hi(1), hi(2), n)) -
+          select(get(lo(0), lo(1), lo(2), n)));
+    }
+    gradient(a) = g;
+  }
+
+  return (0.5f * dim_ / size_) * gradient;
+}
+
+template <typename T>
+void HashedMap<T>::getBlockList(std::vector<VoxelBlock<T>*>& blocklist,
+    bool active){
+  for(unsigned int i = 0; i < block_buffer_.size(); ++i) {
+    VoxelBlock<T> * block = block_buffer_[i];
+    if(!active || block->active()) blocklist.push_back(block);
+  }
+}
+
+template <typename T>
+void HashedMap<T>::save(const std::string& filename) {
+  std::ofstream os (filename, std::ios::binary);
+  save(os);
+}
+
+template <typename T>
+void HashedMap<T>::save(std::ostream& os) {
+  {
+    // Same layout as Octree::save, with an empty node section.
+    internal::write_map<T>(os, size_, dim_, std::vector<unsigned char>(),
+        block_buffer_);
+  }
+}
+
+template <typename T>
+void HashedMap<T>::load(const std::string& filename) {
+  std::ifstream is (filename, std::ios::binary);
+  if(!load(is))
+    std::cerr << "Error: could not read a map from " << filename << std::endl;
+}
+
+template <typename T>
+bool HashedMap<T>::load(std::istream& is) {
+  {
+    const uint32_t version = internal::read_file_version(is);
+    if(version != 0 && version != internal::octree_file_version) 
+      return false;
+    int size;
+    float dim;
+    is.read(reinterpret_cast<char *>(&size), sizeof(size));
+    is.read(reinterpret_cast<char *>(&dim), sizeof(dim));
+
+    init(size, dim);
+
+    // Intermediate octree nodes, if any, carry no voxel data. Skip them.
+    size_t n = 0;
+    is.read(reinterpret_cast<char *>(&n), sizeof(size_t));
+    if(version == 0) {
+      for(size_t i = 0; i < n; ++i) {
+        Node<T> tmp;
+        internal::deserialise(tmp, is);
+      }
+    } else {
+      const size_t node_record = internal::node_record_size<T>();
+      if(!is || n > internal::stream_remaining(is) / node_record) 
+        return false;
+      is.seekg(n * node_record, std::ios::cur);
+    }
+
+    // Decoded blocks are staged in a pool, then rehashed by their codes
+    MemoryPool<VoxelBlock<T> > blocks;
+    if(version == 0) {
+      is.read(reinterpret_cast<char *>(&n), sizeof(size_t));
+      blocks.reserve(n);
+      for(size_t i = 0; i < n; ++i) 
+        internal::deserialise(*blocks.acquire_block(), is);
+      if(!is) return false;
+    } else if(!internal::read_block_chunks(is, blocks)) {
+      return false;
+    }
+    reserve(blocks.size());
+    for(size_t i = 0; i < blocks.size(); ++i) {
+      VoxelBlock<T> * tmp = blocks[i];
+      VoxelBlock<T> * block = insert(keyops::code(tmp->code_) | block_level_);
+      std::memcpy(block->getBlockRawPtr(), tmp->getBlockRawPtr(),
+          sizeof(*(tmp->getBlockRawPtr())) * blockSide * blockSide * blockSide);
+      block->scale(0);
+    }
+  }
+  return true;
+}
+
+/*! \brief Collects the allocated voxel blocks intersecting a region. A hashed
+ * map has no hierarchy to prune, hence every allocated block is tested.
+ * \param map hashed map to be queried
+ * \param region query region
+ * \param out intersecting voxel blocks, in allocation order
+ */
+template <typename T, typename RegionT>
+void region_blocks(const HashedMap<T>& map, const RegionT& region, 
+    std::vector<VoxelBlock<T> *>& out) {
+  out.clear();
+  const MemoryPool<VoxelBlock<T> >& blocks = map.getBlockBuffer();
+  for(size_t i = 0; i < blocks.size(); ++i) {
+    if(region.intersects(blocks[i]->coordinates(), BLOCK_SIDE))
+      out.push_back(blocks[i]);
+  }
+}
+
+/*! \brief Axis aligned boxes covering fewer blocks than those allocated are
+ * resolved by direct lookup of the covered blocks instead.
+ */
+template <typename T>
+void region_blocks(const HashedMap<T>& map, 
+    const geometry::aabb_region& region, std::vector<VoxelBlock<T> *>& out) {
+  out.clear();
+  const int side = BLOCK_SIDE;
+  const Eigen::Vector3i lower = region.min_.cwiseMax(0) / side * side;
+  const Eigen::Vector3i upper = region.max_.cwiseMin(map.size());
+  if((upper.array() <= lower.array()).any()) return;
+  const Eigen::Vector3i extent = 
+    (upper - lower + Eigen::Vector3i::Constant(side - 1)) / side;
+  if(size_t(extent.prod()) > map.getBlockBuffer().size()) {
+    region_blocks<T, geometry::aabb_region>(map, region, out);
+    return;
+  }
+
+  for(int z = lower(2); z < upper(2); z += side) {
+    for(int y = lower(1); y < upper(1); y += side) {
+      for(int x = lower(0); x < upper(0); x += side) {
+        VoxelBlock<T> * block = map.fetch(x, y, z);
+        if(block) out.push_back(block);
+      }
+    }
+  }
+}
+
+/*! \brief Hashed maps store no internal nodes, the output is always empty.
+ */
+template <typename T, typename RegionT>
+void region_nodes(const HashedMap<T>&, const RegionT&, 
+    std::vector<Node<T> *>& out) {
+  out.clear();
+}
+
+/*! \brief Same as region_blocks, hashed maps store no internal nodes.
+ */
+template <typename T, typename RegionT>
+void region_octants(const HashedMap<T>& map, const RegionT& region, 
+    std::vector<Node<T> *>& nodes, std::vector<VoxelBlock<T> *>& blocks) {
+  nodes.clear();
+  region_blocks(map, region, blocks);
+}
+}
+#endif // HASHED_MAP_HPP
@@ -0,0 +1,97 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef CAMERA_MODEL_HPP
+#define CAMERA_MODEL_HPP
+
+#include <vector>
+#include <Eigen/Dense>
+#include "image.hpp"
+
+namespace se {
+
+  /*!
+   * \brief Pinhole camera with per-pixel ray tables for a pyramid of image
+   * levels. Level l has intrinsics k / 2^l and size size / 2^l. For every
+   * pixel (x, y) it caches the unit ray through it and the length of the
+   * back-projected ray K^-1 (x, y, 1), i.e. the factor converting a depth
+   * along the optical axis into a distance along the ray.
+   */
+  class CameraModel {
+    public:
+      /*!
+       * \brief Recompute the ray tables, unless the intrinsics, size and
+       * number of levels are the same as the cached ones.
+       * \param k intrinsics of level 0 as (fx, fy, cx, cy)
+       * \param size image width and height of level 0
+       * \param levels number of pyramid levels
+       */
+      void update(const Eigen::Vector4f& k, const Eigen::Vector2i& size, 
+          const int levels) {
+        if(levels == this->levels() && k == k_ && size == size_) return;
+        k_ = k;
+        size_ = size;
+        rays_.clear();
+        lengths_.clear();
+        for(int l = 0; l < levels; ++l) {
+          const Eigen::Vector4f kl = k / float(1 << l);
+          const int width = size.x() >> l;
+          const int height = size.y() >> l;
+          rays_.emplace_back(width, height);
+          lengths_.emplace_back(width, height);
+          Image<Eigen::Vector3f>& rays = rays_.back();
+          Image<float>& lengths = lengths_.back();
+#pragma omp parallel for
+          for(int y = 0; y < height; ++y) {
+            for(int x = 0; x < width; ++x) {
+              const Eigen::Vector3f ray((x - kl.z()) / kl.x(), 
+                  (y - kl.w()) / kl.y(), 1.f);
+              lengths(x, y) = ray.norm();
+              rays(x, y) = ray / lengths(x, y);
+            }
+          }
+        }
+      }
+
+      const Image<Eigen::Vector3f>& rays(const int l) const { return rays_[l]; }
+      const Image<float>& lengths(const int l) const { return lengths_[l]; }
+      const Eigen::Vector4f& intrinsics() const { return k_; }
+      const Eigen::Vector2i& size() const { return size_; }
+      int levels() const { return rays_.size(); }
+
+    private:
+      Eigen::Vector4f k_ = Eigen::Vector4f::Zero();
+      Eigen::Vector2i size_ = Eigen::Vector2i::Zero();
+      std::vector<Image<Eigen::Vector3f> > rays_;
+      std::vector<Image<float> > lengths_;
+  };
+}
+#endif
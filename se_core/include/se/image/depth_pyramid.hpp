@@ -0,0 +1,138 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DEPTH_PYRAMID_HPP
+#define DEPTH_PYRAMID_HPP
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <Eigen/Dense>
+#include "image.hpp"
+
+namespace se {
+
+  /*!
+   * \brief Min/max mip pyramid of a depth image. Level l stores the range of
+   * the valid depths within each 2^l x 2^l pixel tile, non-positive depths
+   * being invalid. Tiles without valid depths store an empty range.
+   */
+  class DepthPyramid {
+    public:
+      /*!
+       * \brief Rebuild the pyramid from depth, reusing the buffers if the
+       * image size did not change.
+       * \param depth depth image, row major
+       * \param size image width and height
+       */
+      void build(const float * depth, const Eigen::Vector2i& size) {
+        if(levels_.empty() || levels_[0].width() != size.x() || 
+            levels_[0].height() != size.y()) {
+          levels_.clear();
+          Eigen::Vector2i level_size = size;
+          levels_.emplace_back(level_size.x(), level_size.y());
+          while(level_size.x() > 1 || level_size.y() > 1) {
+            level_size = (level_size + Eigen::Vector2i::Ones()) / 2;
+            levels_.emplace_back(level_size.x(), level_size.y());
+          }
+        }
+
+        const Eigen::Vector2f empty(std::numeric_limits<float>::max(), 
+            -std::numeric_limits<float>::max());
+        Image<Eigen::Vector2f>& base = levels_[0];
+#pragma omp parallel for
+        for(int y = 0; y < base.height(); ++y) {
+          for(int x = 0; x < base.width(); ++x) {
+            const float d = depth[x + y * base.width()];
+            base(x, y) = d > 0.f ? Eigen::Vector2f(d, d) : empty;
+          }
+        }
+
+        for(unsigned int l = 1; l < levels_.size(); ++l) {
+          const Image<Eigen::Vector2f>& fine = levels_[l - 1];
+          Image<Eigen::Vector2f>& coarse = levels_[l];
+#pragma omp parallel for
+          for(int y = 0; y < coarse.height(); ++y) {
+            for(int x = 0; x < coarse.width(); ++x) {
+              Eigen::Vector2f range = empty;
+              for(int j = 2 * y; j < std::min(2 * y + 2, fine.height()); ++j) {
+                for(int i = 2 * x; i < std::min(2 * x + 2, fine.width()); ++i) {
+                  range.x() = std::min(range.x(), fine(i, j).x());
+                  range.y() = std::max(range.y(), fine(i, j).y());
+                }
+              }
+              coarse(x, y) = range;
+            }
+          }
+        }
+      }
+
+      /*!
+       * \brief Conservative range of the valid depths within the inclusive
+       * pixel rectangle [lower, upper], clipped to the image.
+       * \return false if the rectangle holds no valid depth.
+       */
+      bool range(Eigen::Vector2i lower, Eigen::Vector2i upper, 
+          float& min, float& max) const {
+        if(levels_.empty()) return false;
+        const Eigen::Vector2i last(levels_[0].width() - 1, 
+            levels_[0].height() - 1);
+        lower = lower.cwiseMax(Eigen::Vector2i::Zero());
+        upper = upper.cwiseMin(last);
+        if((lower.array() > upper.array()).any()) return false;
+
+        // Coarsest level at which the rectangle spans at most 2x2 tiles
+        unsigned int l = 0;
+        while((upper.x() >> l) - (lower.x() >> l) > 1 || 
+              (upper.y() >> l) - (lower.y() >> l) > 1) ++l;
+
+        min = std::numeric_limits<float>::max();
+        max = -std::numeric_limits<float>::max();
+        const Image<Eigen::Vector2f>& level = levels_[l];
+        for(int y = lower.y() >> l; y <= upper.y() >> l; ++y) {
+          for(int x = lower.x() >> l; x <= upper.x() >> l; ++x) {
+            min = std::min(min, level(x, y).x());
+            max = std::max(max, level(x, y).y());
+          }
+        }
+        return min <= max;
+      }
+
+      const Image<Eigen::Vector2f>& level(const int l) const { 
+        return levels_[l]; 
+      }
+      int levels() const { return levels_.size(); }
+
+    private:
+      std::vector<Image<Eigen::Vector2f> > levels_;
+  };
+}
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright 2016 Emanuele Vespa, Imperial College London 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * */
+
+#ifndef BLOCK_CODEC_HPP
+#define BLOCK_CODEC_HPP
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include "../octree_defines.h"
+#include "../utils/morton_utils.hpp"
+#include "../utils/memory_pool.hpp"
+#include "Eigen/Dense"
+
+namespace se {
+
+  template <typename T>
+  class Node;
+
+  template <typename T>
+  class VoxelBlock;
+
+  namespace internal {
+
+    /*
+     * Map files start with this tag, which cannot be mistaken for the power
+     * of two size heading files written before chunked encoding.
+     */
+    static constexpr uint32_t octree_file_magic = 0x434f4553; // "SEOC"
+    static constexpr uint32_t octree_file_version = 1;
+
+    // Number of voxel blocks per independently encoded chunk
+    static constexpr size_t block_chunk_size = 256;
+
+    /*
+     * \brief Run-length encodes n bytes from in and appends them to out. A
+     * control byte c < 128 is followed by c + 1 literal bytes, a control byte
+     * c >= 128 by a single byte repeated c - 125 times.
+     */
+    inline void rle_encode(const unsigned char * in, const size_t n, 
+        std::vector<unsigned char>& out) {
+      size_t i = 0;
+      while(i < n) {
+        // Compare eight bytes at a time, delta coded planes are mostly zero
+        const size_t max_run = std::min(n - i, size_t(130));
+        const uint64_t pattern = in[i] * 0x0101010101010101ull;
+        size_t run = 1;
+        for(uint64_t word; run + 8 <= max_run; run += 8) {
+          std::memcpy(&word, in + i + run, sizeof(word));
+          if(word != pattern) break;
+        }
+        while(run < max_run && in[i + run] == in[i]) ++run;
+        if(run >= 3) {
+          out.push_back(static_cast<unsigned char>(run + 125));
+          out.push_back(in[i]);
+          i += run;
+          continue;
+        }
+        // Literals extend up to the next run of at least three bytes
+        size_t len = 0;
+        while(i + len < n && len < 128) {
+          if(i + len + 2 < n && in[i + len] == in[i + len + 1] && 
+              in[i + len] == in[i + len + 2]) break;
+          ++len;
+        }
+        out.push_back(static_cast<unsigned char>(len - 1));
+        out.insert(out.end(), in + i, in + i + len);
+        i += len;
+      }
+    }
+
+    /*
+     * \brief Decodes exactly n bytes into out from the run-length encoded
+     * range [in, end), advancing in past the consumed input.
+     * \return false if the input is truncated or decodes to more than n bytes
+     */
+    inline bool rle_decode(const unsigned char *& in, 
+        const unsigned char * end, unsigned char * out, const size_t n) {
+      size_t i = 0;
+      while(i < n) {
+        if(in >= end) return false;
+        const unsigned char c = *in++;
+        if(c < 128) {
+          const size_t len = c + 1;
+          if(in + len > end || i + len > n) return false;
+          std::memcpy(out + i, in, len);
+          in += len;
+          i += len;
+        } else {
+          const size_t len = c - 125;
+          if(in >= end || i + len > n) return false;
+          std::memset(out + i, *in++, len);
+          i += len;
+        }
+      }
+      return true;
+    }
+
+    /*
+     * \brief Linear voxel offsets of a block of side voxels in Morton order,
+     * so that consecutive entries are spatial neighbours along every axis.
+     */
+    template <unsigned int side>
+    const std::vector<int>& morton_order() {
+      static const std::vector<int> order = [] {
+        std::vector<int> o(side * side * side);
+        for(unsigned int m = 0; m < o.size(); ++m) {
+          const Eigen::Vector3i v = unpack_morton(m);
+          o[m] = v(0) + v(1) * side + v(2) * side * side;
+        }
+        return o;
+      }();
+      return order;
+    }
+
+    /*
+     * \brief Copy of the code, coordinates and voxels of a block.
+     */
+    template <typename T>
+    struct block_copy {
+      typedef typename VoxelBlock<T>::value_type value_type;
+      key_t code_;
+      Eigen::Vector3i coordinates_;
+      value_type data_[VoxelBlock<T>::side * VoxelBlock<T>::sideSq];
+
+      Eigen::Vector3i coordinates() const { return coordinates_; }
+      const value_type * getBlockRawPtr() const { return data_; }
+    };
+
+    /*
+     * \brief Copy of the blocks of a pool, indexed like the pool, which can
+     * be encoded by write_block_chunks while the pool keeps changing. The
+     * buffer is reused by the following copies.
+     */
+    template <typename T>
+    class block_snapshot {
+      public:
+        void copy(const MemoryPool<VoxelBlock<T> >& pool) {
+          size_ = pool.size();
+          if(blocks_.size() < size_) blocks_.resize(size_);
+#pragma omp parallel for
+          for(size_t i = 0; i < size_; ++i) {
+            VoxelBlock<T> * block = pool[i];
+            blocks_[i].code_ = block->code_;
+            blocks_[i].coordinates_ = block->coordinates();
+            std::memcpy(blocks_[i].data_, block->getBlockRawPtr(), 
+                sizeof(blocks_[i].data_));
+          }
+        }
+
+        size_t size() const { return size_; }
+        const block_copy<T> * operator[](const size_t i) const { 
+          return &blocks_[i]; 
+        }
+
+      private:
+        std::vector<block_copy<T> > blocks_;
+        size_t size_ = 0;
+    };
+
+    /*
+     * \brief Encodes blocks [begin, end) of pool into out. Codes and
+     * coordinates are stored raw. Each voxel is XORed with its predecessor
+     * in Morton order, which zeroes the sign, exponent and high mantissa
+     * bytes of smooth fields, and the bytes of each block are split into
+     * planes, byte k of every voxel together, before run-length encoding.
+     * Lossless for any trivially copyable voxel type. pool is a MemoryPool
+     * or a block_snapshot of VoxelBlock<T>.
+     */
+    template <typename T, typename PoolT>
+    void encode_blocks(const PoolT& pool, 
+        const size_t begin, const size_t end, 
+        std::vector<unsigned char>& out) {
+      typedef typename VoxelBlock<T>::value_type value_type;
+      const size_t num_voxels = VoxelBlock<T>::side * VoxelBlock<T>::sideSq;
+      const size_t bytes = sizeof(value_type);
+      const std::vector<int>& order = morton_order<VoxelBlock<T>::side>();
+      const size_t n = end - begin;
+
+      out.clear();
+      out.resize(n * (sizeof(key_t) + sizeof(Eigen::Vector3i)));
+      unsigned char * header = out.data();
+      for(size_t i = 0; i < n; ++i, header += sizeof(key_t)) 
+        std::memcpy(header, &pool[begin + i]->code_, sizeof(key_t));
+      for(size_t i = 0; i < n; ++i, header += sizeof(Eigen::Vector3i)) {
+        const Eigen::Vector3i c = pool[begin + i]->coordinates();
+        std::memcpy(header, c.data(), sizeof(Eigen::Vector3i));
+      }
+
+      std::vector<unsigned char> planes(n * bytes * num_voxels);
+      std::vector<unsigned char> sorted(bytes * num_voxels);
+      for(size_t i = 0; i < n; ++i) {
+        const unsigned char * data = reinterpret_cast<const unsigned char *>(
+            pool[begin + i]->getBlockRawPtr());
+        for(size_t m = 0; m < num_voxels; ++m)
+          std::memcpy(&sorted[m * bytes], data + order[m] * bytes, bytes);
+        // Planes are kept per block, interleaving them across the whole
+        // chunk maps every plane to the same cache sets
+        unsigned char * dst = planes.data() + i * bytes * num_voxels;
+        for(size_t b = 0; b < bytes; ++b)
+          dst[b * num_voxels] = sorted[b];
+        for(size_t m = 1; m < num_voxels; ++m)
+          for(size_t b = 0; b < bytes; ++b)
+            dst[b * num_voxels + m] = sorted[m * bytes + b] ^ 
+              sorted[(m - 1) * bytes + b];
+      }
+      rle_encode(planes.data(), planes.size(), out);
+    }
+
+    /*
+     * \brief Decodes the output of encode_blocks from [in, in + len) into
+     * blocks [begin, end) of pool, which must already be acquired.
+     * \return false if the data is malformed
+     */
+    template <typename T>
+    bool decode_blocks(const unsigned char * in, const size_t len, 
+        MemoryPool<VoxelBlock<T> >& pool, const size_t begin, 
+        const size_t end) {
+      typedef typename VoxelBlock<T>::value_type value_type;
+      const size_t num_voxels = VoxelBlock<T>::side * VoxelBlock<T>::sideSq;
+      const size_t bytes = sizeof(value_type);
+      const std::vector<int>& order = morton_order<VoxelBlock<T>::side>();
+      const size_t n = end - begin;
+      const unsigned char * stop = in + len;
+
+      if(len < n * (sizeof(key_t) + sizeof(Eigen::Vector3i))) return false;
+      for(size_t i = 0; i < n; ++i, in += sizeof(key_t)) 
+        std::memcpy(&pool[begin + i]->code_, in, sizeof(key_t));
+      for(size_t i = 0; i < n; ++i, in += sizeof(Eigen::Vector3i)) {
+        Eigen::Vector3i c;
+        std::memcpy(c.data(), in, sizeof(Eigen::Vector3i));
+        pool[begin + i]->coordinates(c);
+      }
+
+      std::vector<unsigned char> planes(n * bytes * num_voxels);
+      if(!rle_decode(in, stop, planes.data(), planes.size()) || in != stop) 
+        return false;
+      for(size_t i = 0; i < n; ++i) {
+        unsigned char * data = reinterpret_cast<unsigned char *>(
+            pool[begin + i]->getBlockRawPtr());
+        const unsigned char * src = planes.data() + i * bytes * num_voxels;
+        for(size_t m = 0; m < num_voxels; ++m) {
+          unsigned char * curr = data + order[m] * bytes;
+          const unsigned char * prev = m > 0 ? data + order[m-1] * bytes : 0;
+          for(size_t b = 0; b < bytes; ++b) {
+            const unsigned char delta = src[b * num_voxels + m];
+            curr[b] = prev ? delta ^ prev[b] : delta;
+          }
+        }
+      }
+      return true;
+    }
+
+    /*
+     * \brief Size of a node record in a chunked file: code, side and the
+     * eight child values.
+     */
+    template <typename T>
+    constexpr size_t node_record_size() {
+      return sizeof(key_t) + sizeof(int) + 
+        8 * sizeof(typename VoxelBlock<T>::value_type);
+    }
+
+    /*
+     * \brief Packs the records of the nodes of pool into records.
+     */
+    template <typename T>
+    void node_records(const MemoryPool<Node<T> >& pool, 
+        std::vector<unsigned char>& records) {
+      const size_t node_record = node_record_size<T>();
+      const size_t n = pool.size();
+      records.resize(n * node_record);
+#pragma omp parallel for
+      for(size_t i = 0; i < n; ++i) {
+        const Node<T> * node = pool[i];
+        unsigned char * record = records.data() + i * node_record;
+        std::memcpy(record, &node->code_, sizeof(key_t));
+        std::memcpy(record + sizeof(key_t), &node->side_, sizeof(int));
+        std::memcpy(record + sizeof(key_t) + sizeof(int), node->value_, 
+            sizeof(node->value_));
+      }
+    }
+
+    /*
+     * \brief Number of bytes left to read in, or the largest size_t if the
+     * stream cannot tell.
+     */
+    inline size_t stream_remaining(std::istream& in) {
+      const std::istream::pos_type current = in.tellg();
+      if(current == std::istream::pos_type(-1)) 
+        return std::numeric_limits<size_t>::max();
+      in.seekg(0, std::ios::end);
+      const std::istream::pos_type end = in.tellg();
+      in.seekg(current);
+      if(!in || end < current) return std::numeric_limits<size_t>::max();
+      return end - current;
+    }
+
+    inline void write_file_version(std::ostream& out) {
+      uint32_t tag = octree_file_magic;
+      uint32_t version = octree_file_version;
+      out.write(reinterpret_cast<char *>(&tag), sizeof(tag));
+      out.write(reinterpret_cast<char *>(&version), sizeof(version));
+    }
+
+    /*
+     * \brief Reads the tag and version heading a chunked file.
+     * \return the file version, or 0 for files written before chunked
+     * encoding, in which case in is rewound to where the map starts
+     */
+    inline uint32_t read_file_version(std::istream& in) {
+      const std::streampos start = in.tellg();
+      uint32_t tag = 0;
+      uint32_t version = 0;
+      in.read(reinterpret_cast<char *>(&tag), sizeof(tag));
+      if(tag != octree_file_magic) {
+        in.clear();
+        in.seekg(start);
+        return 0;
+      }
+      in.read(reinterpret_cast<char *>(&version), sizeof(version));
+      return version;
+    }
+
+    /*
+     * \brief Writes the blocks of pool in chunks of chunk_size blocks,
+     * encoded in parallel: the block count, the chunk size, the encoded
+     * length of every chunk, then the chunks back to back, one write each.
+     */
+    template <typename T, typename PoolT>
+    void write_chunks(std::ostream& out, const PoolT& pool, 
+        size_t chunk_size) {
+      size_t num_blocks = pool.size();
+      const size_t num_chunks = (num_blocks + chunk_size - 1) / chunk_size;
+      std::vector<std::vector<unsigned char> > chunks(num_chunks);
+      std::vector<uint64_t> lengths(num_chunks);
+#pragma omp parallel for schedule(dynamic)
+      for(size_t c = 0; c < num_chunks; ++c) {
+        encode_blocks<T>(pool, c * chunk_size, 
+            std::min((c + 1) * chunk_size, num_blocks), chunks[c]);
+        lengths[c] = chunks[c].size();
+      }
+
+      out.write(reinterpret_cast<char *>(&num_blocks), sizeof(size_t));
+      out.write(reinterpret_cast<char *>(&chunk_size), sizeof(size_t));
+      out.write(reinterpret_cast<char *>(lengths.data()), 
+          lengths.size() * sizeof(uint64_t));
+      for(size_t c = 0; c < num_chunks; ++c)
+        out.write(reinterpret_cast<char *>(chunks[c].data()), 
+            chunks[c].size());
+    }
+
+    template <typename T>
+    void write_block_chunks(std::ostream& out, 
+        const MemoryPool<VoxelBlock<T> >& pool, size_t chunk_size) {
+      write_chunks<T>(out, pool, chunk_size);
+    }
+
+    template <typename T>
+    void write_block_chunks(std::ostream& out, 
+        const block_snapshot<T>& pool, size_t chunk_size) {
+      write_chunks<T>(out, pool, chunk_size);
+    }
+
+    /*
+     * \brief Writes a map in the chunked layout: the file tag and version,
+     * the map size and dimension, the node records and the blocks.
+     */
+    template <typename T, typename PoolT>
+    void write_map(std::ostream& out, int size, float dim, 
+        const std::vector<unsigned char>& records, const PoolT& blocks) {
+      size_t n = records.size() / node_record_size<T>();
+      write_file_version(out);
+      out.write(reinterpret_cast<char *>(&size), sizeof(size));
+      out.write(reinterpret_cast<char *>(&dim), sizeof(dim));
+      out.write(reinterpret_cast<char *>(&n), sizeof(size_t));
+      out.write(reinterpret_cast<const char *>(records.data()), 
+          records.size());
+      write_block_chunks(out, blocks, block_chunk_size);
+    }
+  }
+
+  /*!
+   * \brief Copy of the contents of a map, taken by Octree::snapshot or
+   * HashedMap::snapshot, that can be saved from another thread while the
+   * map keeps being updated. save writes the layout of Octree::save. The
+   * buffers are reused by the following snapshots.
+   */
+  template <typename T>
+  class MapSnapshot {
+    public:
+      void copy(int size, float dim, const MemoryPool<Node<T> > * nodes, 
+          const MemoryPool<VoxelBlock<T> >& blocks) {
+        size_ = size;
+        dim_ = dim;
+        if(nodes) 
+          internal::node_records(*nodes, records_);
+        else 
+          records_.clear();
+        blocks_.copy(blocks);
+      }
+
+      void save(std::ostream& os) const {
+        internal::write_map<T>(os, size_, dim_, records_, blocks_);
+      }
+
+    private:
+      int size_ = 0;
+      float dim_ = 0.f;
+      std::vector<unsigned char> records_;
+      internal::block_snapshot<T> blocks_;
+  };
+
+  namespace internal {
+
+    /*
+     * \brief Reads the blocks written by write_block_chunks with one read,
+     * appends them to pool and decodes the chunks in parallel.
+     * \return false if the data is truncated or malformed
+     */
+    template <typename T>
+    bool read_block_chunks(std::istream& in, 
+        MemoryPool<VoxelBlock<T> >& pool) {
+      size_t num_blocks = 0;
+      size_t chunk_size = 0;
+      in.read(reinterpret_cast<char *>(&num_blocks), sizeof(size_t));
+      in.read(reinterpret_cast<char *>(&chunk_size), sizeof(size_t));
+      if(!in || (num_blocks > 0 && chunk_size == 0)) return false;
+
+      // Counts and lengths are checked against the rest of the stream
+      // before anything is allocated, every block taking at least its
+      // code and coordinates
+      size_t remaining = stream_remaining(in);
+      if(num_blocks > remaining / (sizeof(key_t) + sizeof(Eigen::Vector3i)))
+        return false;
+      const size_t num_chunks = num_blocks / chunk_size + 
+        (num_blocks % chunk_size != 0);
+      if(num_chunks > remaining / sizeof(uint64_t)) return false;
+      std::vector<uint64_t> lengths(num_chunks);
+      in.read(reinterpret_cast<char *>(lengths.data()), 
+          lengths.size() * sizeof(uint64_t));
+      if(!in) return false;
+      remaining -= lengths.size() * sizeof(uint64_t);
+      std::vector<uint64_t> offsets(num_chunks + 1, 0);
+      for(size_t c = 0; c < num_chunks; ++c) {
+        if(lengths[c] > remaining - offsets[c]) return false;
+        offsets[c + 1] = offsets[c] + lengths[c];
+      }
+      std::vector<unsigned char> data(offsets[num_chunks]);
+      in.read(reinterpret_cast<char *>(data.data()), data.size());
+      if(!in) return false;
+
+      const size_t first = pool.size();
+      pool.reserve(num_blocks);
+      for(size_t i = 0; i < num_blocks; ++i) pool.acquire_block();
+      bool valid = true;
+#pragma omp parallel for schedule(dynamic) reduction(&&:valid)
+      for(size_t c = 0; c < num_chunks; ++c) 
+        valid = decode_blocks(data.data() + offsets[c], lengths[c], pool,
+            first + c * chunk_size, 
+            first + std::min((c + 1) * chunk_size, num_blocks)) && valid;
+      return valid;
+    }
+  }
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2016 Emanuele Vespa, Imperial College London 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * */
+
+#ifndef POINT_CLOUD_IO_HPP
+#define POINT_CLOUD_IO_HPP
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Eigen/Dense"
+
+namespace se {
+
+  namespace internal {
+    /*
+     * Interleaves points and normals as x y z nx ny nz floats, the layout of
+     * both output formats.
+     */
+    inline std::vector<float> interleave(
+        const std::vector<Eigen::Vector3f>& points,
+        const std::vector<Eigen::Vector3f>& normals) {
+      std::vector<float> data(6 * points.size());
+      for(size_t i = 0; i < points.size(); ++i) {
+        std::copy(points[i].data(), points[i].data() + 3, &data[6*i]);
+        std::copy(normals[i].data(), normals[i].data() + 3, &data[6*i + 3]);
+      }
+      return data;
+    }
+  }
+
+  /*! \brief Writes points and their normals to filename as a binary little
+   * endian PLY with float properties x, y, z, nx, ny and nz.
+   * \return false if the file could not be written
+   */
+  inline bool save_point_cloud_ply(const std::string& filename, 
+      const std::vector<Eigen::Vector3f>& points,
+      const std::vector<Eigen::Vector3f>& normals) {
+    std::ofstream out(filename, std::ios::binary);
+    if(!out) return false;
+    out << "ply\n"
+        << "format binary_little_endian 1.0\n"
+        << "element vertex " << points.size() << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "end_header\n";
+    const std::vector<float> data = internal::interleave(points, normals);
+    out.write(reinterpret_cast<const char *>(data.data()), 
+        data.size() * sizeof(float));
+    return bool(out);
+  }
+
+  /*! \brief Writes points and their normals to filename as a headerless
+   * stream of native floats, x y z nx ny nz per point.
+   * \return false if the file could not be written
+   */
+  inline bool save_point_cloud_raw(const std::string& filename, 
+      const std::vector<Eigen::Vector3f>& points,
+      const std::vector<Eigen::Vector3f>& normals) {
+    std::ofstream out(filename, std::ios::binary);
+    if(!out) return false;
+    const std::vector<float> data = internal::interleave(points, normals);
+    out.write(reinterpret_cast<const char *>(data.data()), 
+        data.size() * sizeof(float));
+    return bool(out);
+  }
+}
+#endif
@@ -51,7 +51,7 @@ namespace se {
      * \param node Node to be serialised
      */
     template <typename T>
-    std::ofstream& serialise(std::ofstream& out, Node<T>& node) {
+    std::ostream& serialise(std::ostream& out, Node<T>& node) {
       out.write(reinterpret_cast<char *>(&node.code_), sizeof(key_t));
       out.write(reinterpret_cast<char *>(&node.side_), sizeof(int));
       out.write(reinterpret_cast<char *>(&node.value_), sizeof(node.value_));
@@ -65,7 +65,7 @@ namespace se {
      * \param node Node to be serialised
      */
     template <typename T>
-    void deserialise(Node<T>& node, std::ifstream& in) {
+    void deserialise(Node<T>& node, std::istream& in) {
       in.read(reinterpret_cast<char *>(&node.code_), sizeof(key_t));
       in.read(reinterpret_cast<char *>(&node.side_), sizeof(int));
       in.read(reinterpret_cast<char *>(&node.value_), sizeof(node.value_));
@@ -77,7 +77,7 @@ namespace se {
      * \param node Node to be serialised
      */
     template <typename T>
-    std::ofstream& serialise(std::ofstream& out, VoxelBlock<T>& block) {
+    std::ostream& serialise(std::ostream& out, VoxelBlock<T>& block) {
       out.write(reinterpret_cast<char *>(&block.code_), sizeof(key_t));
       out.write(reinterpret_cast<char *>(&block.coordinates_), sizeof(Eigen::Vector3i));
       out.write(reinterpret_cast<char *>(&block.voxel_block_), 
@@ -92,10 +92,13 @@ namespace se {
      * \param node Node to be serialised
      */
     template <typename T>
-    void deserialise(VoxelBlock<T>& block, std::ifstream& in) {
+    void deserialise(VoxelBlock<T>& block, std::istream& in) {
       in.read(reinterpret_cast<char *>(&block.code_), sizeof(key_t));
       in.read(reinterpret_cast<char *>(&block.coordinates_), sizeof(Eigen::Vector3i));
       in.read(reinterpret_cast<char *>(&block.voxel_block_), sizeof(block.voxel_block_));
+      // The scale is not stored, so coarse updates must not overwrite the
+      // loaded voxels
+      block.scale_ = 0;
     }
   }
 }
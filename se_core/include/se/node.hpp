@@ -82,8 +82,8 @@ public:
 protected:
     Node *child_ptr_[8];
 private:
-    friend std::ofstream& internal::serialise <> (std::ofstream& out, Node& node);
-    friend void internal::deserialise <> (Node& node, std::ifstream& in);
+    friend std::ostream& internal::serialise <> (std::ostream& out, Node& node);
+    friend void internal::deserialise <> (Node& node, std::istream& in);
 };
 
 template <typename T>
@@ -94,6 +94,7 @@ class VoxelBlock: public Node<T> {
     typedef typename traits_type::value_type value_type;
     static constexpr unsigned int side = BLOCK_SIDE;
     static constexpr unsigned int sideSq = side*side;
+    static constexpr unsigned int max_scale = math::log2_const(side);
 
     static constexpr value_type empty() { 
       return traits_type::empty(); 
@@ -104,6 +105,8 @@ class VoxelBlock: public Node<T> {
 
     VoxelBlock(){
       coordinates_ = Eigen::Vector3i::Constant(0);
+      stable_ = 0;
+      scale_ = max_scale;
       for (unsigned int i = 0; i < side*sideSq; i++)
         voxel_block_[i] = initValue();
     }
@@ -122,6 +125,16 @@ class VoxelBlock: public Node<T> {
     void active(const bool a){ active_ = a; }
     bool active() const { return active_; }
 
+    /*! \brief Number of consecutive updates that left the block unchanged. */
+    void stable(const unsigned int s){ stable_ = s; }
+    unsigned int stable() const { return stable_; }
+
+    /*! \brief Finest scale the block has been updated at. At scale s only
+     * every 2^s-th voxel along each axis holds a measurement, the others are
+     * interpolated from them. Blocks never updated are at max_scale. */
+    void scale(const unsigned int s){ scale_ = s; }
+    unsigned int scale() const { return scale_; }
+
     value_type * getBlockRawPtr(){ return voxel_block_; }
     static constexpr int size(){ return sizeof(VoxelBlock<T>); }
     
@@ -130,10 +143,12 @@ class VoxelBlock: public Node<T> {
     Eigen::Vector3i coordinates_;
     value_type voxel_block_[side*sideSq]; // Brick of data.
     bool active_;
+    unsigned int stable_;
+    unsigned int scale_;
 
-    friend std::ofstream& internal::serialise <> (std::ofstream& out, 
+    friend std::ostream& internal::serialise <> (std::ostream& out, 
         VoxelBlock& node);
-    friend void internal::deserialise <> (VoxelBlock& node, std::ifstream& in);
+    friend void internal::deserialise <> (VoxelBlock& node, std::istream& in);
 };
 
 template <typename T>
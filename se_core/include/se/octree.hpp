@@ -49,6 +49,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "node.hpp"
 #include "utils/memory_pool.hpp"
 #include "algorithms/unique.hpp"
+#include "io/block_codec.hpp"
 #include "geometry/aabb_collision.hpp"
 #include "interpolation/interp_gather.hpp"
 
@@ -117,6 +118,12 @@ public:
    */
   void init(int size, float dim);
 
+  /*! \brief Removes every octant but the root. The node and block pools
+   * keep their memory, octants allocated afterwards are reinitialised as
+   * they are reused.
+   */
+  void clear();
+
   inline int size() const { return size_; }
   inline float dim() const { return dim_; }
   inline Node<T>* root() const { return root_; }
@@ -218,8 +225,55 @@ public:
    */
   bool allocate(key_t *keys, int num_elem);
 
+  /*! \brief Bulk-allocates the octants identified by a sorted set of unique
+   * keys, together with all their ancestors. Tree levels are derived
+   * bottom-up, each one from the level below by prefix and unique, and linked
+   * to their parents through the parents' position in the sorted level above
+   * instead of descending from the root. Octants already present are reused.
+   * \param keys sorted collection of unique octant keys
+   * \param num_keys number of keys in the keys array
+   * \param payload function object invoked as payload(i, node) on the octant
+   * identified by keys[i], possibly concurrently. Voxel blocks are passed as
+   * Node<T> pointers.
+   */
+  template <typename PayloadF>
+  bool build(const key_t *keys, int num_keys, PayloadF payload);
+  bool build(const key_t *keys, int num_keys);
+
+  /*! \brief Merges the octants of another octree of the same size into this
+   * one. Missing octants are bulk-allocated, then update(dst, src) is applied
+   * to every voxel of the other octree's blocks and to every value stored in
+   * its nodes. 
+   * \param other octree to be merged into this one
+   * \param update function object with signature 
+   * void(value_type& dst, const value_type& src)
+   * \return false if the two octrees differ in size
+   */
+  template <typename UpdateF>
+  bool merge(const Octree<T>& other, UpdateF update);
+  bool merge(const Octree<T>& other);
+
+  /*! \brief Writes the octree to filename. Voxel blocks are compressed
+   * losslessly in chunks, encoded in parallel.
+   */
   void save(const std::string& filename);
+  void save(std::ostream& os);
+
+  /*! \brief Copies the octree into snapshot, which can then be saved from
+   * another thread while the octree keeps changing. Not thread safe with
+   * respect to concurrent updates.
+   */
+  void snapshot(MapSnapshot<T>& snapshot) const {
+    snapshot.copy(size_, dim_, &nodes_buffer_, block_buffer_);
+  }
+
+  /*! \brief Reads an octree written by save, or in the uncompressed format
+   * of earlier versions, replacing the current contents.
+   * \return false if the data is truncated or malformed, in which case the
+   * octree is left partially loaded
+   */
   void load(const std::string& filename);
+  bool load(std::istream& is);
 
   /*! \brief Counts the number of blocks allocated
    * \return number of voxel blocks allocated
@@ -247,19 +301,20 @@ private:
   friend class ray_iterator<T>;
   friend class node_iterator<T>;
 
-  // Allocation specific variables
-  key_t* keys_at_level_;
-  int reserved_;
+  // Bulk build specific variables, kept across calls to reuse their storage
+  std::vector<std::vector<key_t> > keys_at_level_;
+  std::vector<std::vector<Node<T> *> > nodes_at_level_;
+  std::vector<key_t> parent_keys_;
+  std::vector<key_t> merged_keys_;
 
   // Private implementation of cached methods
   value_type get(const int x, const int y, const int z, VoxelBlock<T>* cached) const;
   value_type get(const Eigen::Vector3f& pos, VoxelBlock<T>* cached) const;
 
-  // Parallel allocation of a given tree level for a set of input keys.
-  // Pre: levels above target_level must have been already allocated
-  bool allocate_level(key_t * keys, int num_tasks, int target_level);
-
-  void reserveBuffers(const int n);
+  // Links the octants of a given tree level to their parents, allocating the
+  // missing ones unless they are already provided in nodes_at_level_.
+  // Pre: the level above must have been already linked.
+  void link_level(const int level, const bool preallocated = false);
 
   // General helpers
 
@@ -432,9 +487,16 @@ void Octree<T>::init(int size, float dim) {
   nodes_buffer_.reserve(1);
   root_ = nodes_buffer_.acquire_block();
   root_->side_ = size;
-  reserved_ = 1024;
-  keys_at_level_ = new key_t[reserved_];
-  std::memset(keys_at_level_, 0, reserved_);
+}
+
+template <typename T>
+void Octree<T>::clear() {
+  nodes_buffer_.clear();
+  block_buffer_.clear();
+  for(auto& keys : keys_at_level_) keys.clear();
+  for(auto& nodes : nodes_at_level_) nodes.clear();
+  root_ = nodes_buffer_.acquire_block();
+  root_->side_ = size_;
 }
 
 template <typename T>
@@ -777,18 +839,6 @@ int Octree<T>::nodeCountRecursive(Node<T> * node){
   return n;
 }
 
-template <typename T>
-void Octree<T>::reserveBuffers(const int n){
-
-  if(n > reserved_){
-    // std::cout << "Reserving " << n << " entries in allocation buffers" << std::endl;
-    delete[] keys_at_level_;
-    keys_at_level_ = new key_t[n];
-    reserved_ = n;
-  }
-  block_buffer_.reserve(n);
-}
-
 template <typename T>
 bool Octree<T>::allocate(key_t *keys, int num_elem){
 
@@ -799,60 +849,174 @@ std::sort(keys, keys+num_elem);
 #endif
 
   num_elem = algorithms::filter_ancestors(keys, num_elem, max_level_);
-  reserveBuffers(num_elem);
+  return build(keys, num_elem);
+}
+
+template <typename T>
+bool Octree<T>::build(const key_t *keys, int num_keys){
+  return build(keys, num_keys, [](int, Node<T> *){});
+}
 
-  int last_elem = 0;
-  bool success = false;
+template <typename T>
+template <typename PayloadF>
+bool Octree<T>::build(const key_t *keys, int num_keys, PayloadF payload){
 
-  const int leaves_level = max_level_ - log2(blockSide);
+  const int leaves_level = max_level_ - math::log2_const(blockSide);
   const unsigned int shift = MAX_BITS - max_level_ - 1;
-  for (int level = 1; level <= leaves_level; level++){
-    const key_t mask = MASK[level + shift] | SCALE_MASK;
-    compute_prefix(keys, keys_at_level_, num_elem, mask);
-    last_elem = algorithms::unique_multiscale(keys_at_level_, num_elem, 
-        SCALE_MASK, level);
-    success = allocate_level(keys_at_level_, last_elem, level);
+  keys_at_level_.resize(leaves_level + 1);
+  nodes_at_level_.resize(leaves_level + 1);
+
+  // Bucket the input by level. Keys finer than a voxel block map to their
+  // block, prefixes of sorted keys are sorted too.
+  for(int level = 0; level <= leaves_level; ++level) 
+    keys_at_level_[level].clear();
+  for(int i = 0; i < num_keys; ++i) {
+    const int level = keyops::level(keys[i]);
+    if(level == 0) continue;
+    if(level >= leaves_level) {
+      const key_t key = (keys[i] & MASK[leaves_level + shift]) | leaves_level;
+      std::vector<key_t>& leaves = keys_at_level_[leaves_level];
+      if(leaves.empty() || leaves.back() != key) leaves.push_back(key);
+    } else { 
+      keys_at_level_[level].push_back(keys[i]);
+    }
   }
-  return success;
+
+  // Derive each level bottom-up from the prefixes of the level below. 
+  for(int level = leaves_level - 1; level >= 1; --level) {
+    const std::vector<key_t>& children = keys_at_level_[level + 1];
+    const key_t mask = MASK[level + shift];
+    parent_keys_.resize(children.size());
+#pragma omp parallel for
+    for(unsigned int i = 0; i < children.size(); ++i) {
+      parent_keys_[i] = (children[i] & mask) | level;
+    }
+    parent_keys_.resize(algorithms::unique(parent_keys_.data(), 
+          parent_keys_.size()));
+
+    std::vector<key_t>& current = keys_at_level_[level];
+    merged_keys_.resize(current.size() + parent_keys_.size());
+    auto last = std::merge(current.begin(), current.end(), 
+        parent_keys_.begin(), parent_keys_.end(), merged_keys_.begin());
+    merged_keys_.resize(algorithms::unique(merged_keys_.data(), 
+          last - merged_keys_.begin()));
+    current.swap(merged_keys_);
+  }
+
+  // Link top-down, each level through the sorted level above.
+  keys_at_level_[0].assign(1, 0);
+  nodes_at_level_[0].assign(1, root_);
+  for(int level = 1; level <= leaves_level; ++level) {
+    link_level(level);
+  }
+
+#pragma omp parallel for
+  for(int i = 0; i < num_keys; ++i) {
+    const int level = std::min(keyops::level(keys[i]), leaves_level);
+    const key_t key = (keys[i] & MASK[level + shift]) | level;
+    const std::vector<key_t>& level_keys = keys_at_level_[level];
+    const size_t idx = std::lower_bound(level_keys.begin(), level_keys.end(), 
+        key) - level_keys.begin();
+    payload(i, nodes_at_level_[level][idx]);
+  }
+  return true;
 }
 
 template <typename T>
-bool Octree<T>::allocate_level(key_t* keys, int num_tasks, int target_level){
+void Octree<T>::link_level(const int level, const bool preallocated){
+
+  const int leaves_level = max_level_ - math::log2_const(blockSide);
+  const std::vector<key_t>& parent_keys = keys_at_level_[level - 1];
+  const std::vector<Node<T> *>& parents = nodes_at_level_[level - 1];
+  const std::vector<key_t>& keys = keys_at_level_[level];
+  std::vector<Node<T> *>& nodes = nodes_at_level_[level];
+  nodes.resize(keys.size());
+  if(!preallocated) {
+    if(level == leaves_level) block_buffer_.reserve(keys.size());
+    else nodes_buffer_.reserve(keys.size());
+  }
 
-  int leaves_level = max_level_ - log2(blockSide);
-  nodes_buffer_.reserve(num_tasks);
+  // Morton interval spanned by an octant of the parent level
+  const key_t span = key_t(1) << (3 * (max_level_ - level + 1));
+  const int edge = size_ >> level;
 
+  // Each parent owns the contiguous range of its children, hence parents can
+  // be processed concurrently without synchronisation.
 #pragma omp parallel for
-  for (int i = 0; i < num_tasks; i++){
-    Node<T> ** n = &root_;
-    key_t myKey = keyops::code(keys[i]);
-    int edge = size_/2;
-
-    for (int level = 1; level <= target_level; ++level){
-      int index = child_id(myKey, level, max_level_); 
-      Node<T> * parent = *n;
-      n = &(*n)->child(index);
-
-      if(!(*n)){
-        if(level == leaves_level){
-          *n = block_buffer_.acquire_block();
-          (*n)->side_ = edge;
-          static_cast<VoxelBlock<T> *>(*n)->coordinates(Eigen::Vector3i(unpack_morton(myKey)));
-          static_cast<VoxelBlock<T> *>(*n)->active(true);
-          static_cast<VoxelBlock<T> *>(*n)->code_ = myKey | level;
-          parent->children_mask_ = parent->children_mask_ | (1 << index);
-        }
-        else  {
-          *n = nodes_buffer_.acquire_block();
-          (*n)->code_ = myKey | level;
-          (*n)->side_ = edge;
-          parent->children_mask_ = parent->children_mask_ | (1 << index);
+  for(unsigned int p = 0; p < parent_keys.size(); ++p) {
+    Node<T> * parent = parents[p];
+    const key_t parent_code = keyops::code(parent_keys[p]);
+    auto first = std::lower_bound(keys.begin(), keys.end(), parent_code);
+    auto last = std::lower_bound(first, keys.end(), parent_code + span);
+    for(auto it = first; it != last; ++it) {
+      const key_t code = keyops::code(*it);
+      const int index = child_id(code, level, max_level_);
+      Node<T> *& n = parent->child(index);
+      if(preallocated) {
+        n = nodes[it - keys.begin()];
+        parent->children_mask_ = parent->children_mask_ | (1 << index);
+      } else if(!n) {
+        if(level == leaves_level) {
+          n = block_buffer_.acquire_block();
+          static_cast<VoxelBlock<T> *>(n)->coordinates(
+              Eigen::Vector3i(unpack_morton(code)));
+          static_cast<VoxelBlock<T> *>(n)->active(true);
+        } else {
+          n = nodes_buffer_.acquire_block();
         }
+        n->code_ = code | level;
+        n->side_ = edge;
+        parent->children_mask_ = parent->children_mask_ | (1 << index);
       }
-      edge /= 2;
+      nodes[it - keys.begin()] = n;
     }
   }
-  return true;
+}
+
+template <typename T>
+bool Octree<T>::merge(const Octree<T>& other){
+  return merge(other, [](value_type& dst, const value_type& src){ 
+      dst = src; });
+}
+
+template <typename T>
+template <typename UpdateF>
+bool Octree<T>::merge(const Octree<T>& other, UpdateF update){
+
+  if(other.size_ != size_) return false;
+
+  std::vector<std::pair<key_t, Node<T> *> > octants;
+  octants.reserve(other.nodes_buffer_.size() + other.block_buffer_.size());
+  for(size_t i = 0; i < other.nodes_buffer_.size(); ++i) {
+    octants.emplace_back(other.nodes_buffer_[i]->code_, other.nodes_buffer_[i]);
+  }
+  for(size_t i = 0; i < other.block_buffer_.size(); ++i) {
+    octants.emplace_back(other.block_buffer_[i]->code_, other.block_buffer_[i]);
+  }
+#if defined(_OPENMP) && !defined(__clang__)
+  __gnu_parallel::sort(octants.begin(), octants.end());
+#else
+  std::sort(octants.begin(), octants.end());
+#endif
+
+  std::vector<key_t> keys(octants.size());
+  for(size_t i = 0; i < octants.size(); ++i) keys[i] = octants[i].first;
+
+  return build(keys.data(), keys.size(), 
+      [&octants, &update](int i, Node<T> * dst) {
+        Node<T> * src = octants[i].second;
+        if(src->isLeaf()) {
+          VoxelBlock<T> * dst_block = static_cast<VoxelBlock<T> *>(dst);
+          VoxelBlock<T> * src_block = static_cast<VoxelBlock<T> *>(src);
+          for(unsigned int v = 0; v < blockSide * blockSide * blockSide; ++v) {
+            value_type val = dst_block->data(v);
+            update(val, src_block->data(v));
+            dst_block->data(v, val);
+          }
+        } else {
+          for(int v = 0; v < 8; ++v) update(dst->value_[v], src->value_[v]);
+        }
+      });
 }
 
 template <typename T>
@@ -896,57 +1060,114 @@ void Octree<T>::getAllocatedBlockList(Node<T> *,
 
 template <typename T>
 void Octree<T>::save(const std::string& filename) {
-  {
-    std::ofstream os (filename, std::ios::binary); 
-    os.write(reinterpret_cast<char *>(&size_), sizeof(size_));
-    os.write(reinterpret_cast<char *>(&dim_), sizeof(dim_));
-
-    size_t n = nodes_buffer_.size();
-    os.write(reinterpret_cast<char *>(&n), sizeof(size_t));
-    for(size_t i = 0; i < n; ++i)
-      internal::serialise(os, *nodes_buffer_[i]);
+  std::ofstream os (filename, std::ios::binary); 
+  save(os);
+}
 
-    n = block_buffer_.size();
-    os.write(reinterpret_cast<char *>(&n), sizeof(size_t));
-    for(size_t i = 0; i < n; ++i)
-      internal::serialise(os, *block_buffer_[i]);
-  }
+template <typename T>
+void Octree<T>::save(std::ostream& os) {
+  // Nodes are few and written raw in one go, blocks are encoded in chunks
+  std::vector<unsigned char> records;
+  internal::node_records(nodes_buffer_, records);
+  internal::write_map<T>(os, size_, dim_, records, block_buffer_);
 }
 
 template <typename T>
 void Octree<T>::load(const std::string& filename) {
+  std::cout << "Loading octree from disk... " << filename << std::endl;
+  std::ifstream is (filename, std::ios::binary); 
+  if(!load(is))
+    std::cerr << "Error: could not read an octree from " << filename 
+      << std::endl;
+}
+
+template <typename T>
+bool Octree<T>::load(std::istream& is) {
   {
-    std::cout << "Loading octree from disk... " << filename << std::endl;
-    std::ifstream is (filename, std::ios::binary); 
-    int size, dim;
+    const uint32_t version = internal::read_file_version(is);
+    if(version != 0 && version != internal::octree_file_version) 
+      return false;
+    int size;
+    float dim;
     is.read(reinterpret_cast<char *>(&size), sizeof(size));
     is.read(reinterpret_cast<char *>(&dim), sizeof(dim));
 
     init(size, dim);
-    
+
+    // Deserialise straight into the memory pools, preserving the file order
     size_t n = 0;
     is.read(reinterpret_cast<char *>(&n), sizeof(size_t));
-    nodes_buffer_.reserve(n);
+    if(!is) return false;
+    const size_t node_record = internal::node_record_size<T>();
+    if(version != 0 && n > internal::stream_remaining(is) / node_record) 
+      return false;
     std::cout << "Reading " << n << " nodes " << std::endl;
+    std::vector<unsigned char> records(version == 0 ? 0 : n * node_record);
+    is.read(reinterpret_cast<char *>(records.data()), records.size());
+    if(!is) return false;
+    nodes_buffer_.reserve(n);
     for(size_t i = 0; i < n; ++i) {
-      Node<T> tmp;
-      internal::deserialise(tmp, is);
-      Eigen::Vector3i coords = keyops::decode(tmp.code_);
-      Node<T> * n = insert(coords(0), coords(1), coords(2), keyops::level(tmp.code_));
-      std::memcpy(n->value_, tmp.value_, sizeof(tmp.value_));
+      // The root is always the first pool entry and thus the first record
+      Node<T> * node = i == 0 ? root_ : nodes_buffer_.acquire_block();
+      if(version == 0) {
+        internal::deserialise(*node, is);
+        continue;
+      }
+      const unsigned char * record = records.data() + i * node_record;
+      std::memcpy(&node->code_, record, sizeof(key_t));
+      std::memcpy(&node->side_, record + sizeof(key_t), sizeof(int));
+      std::memcpy(node->value_, record + sizeof(key_t) + sizeof(int), 
+          sizeof(node->value_));
     }
 
-    is.read(reinterpret_cast<char *>(&n), sizeof(size_t));
-    std::cout << "Reading " << n << " blocks " << std::endl;
-    for(size_t i = 0; i < n; ++i) {
-      VoxelBlock<T> tmp;
-      internal::deserialise(tmp, is);
-      Eigen::Vector3i coords = tmp.coordinates();
-      VoxelBlock<T> * n = 
-        static_cast<VoxelBlock<T> *>(insert(coords(0), coords(1), coords(2), keyops::level(tmp.code_)));
-      std::memcpy(n->getBlockRawPtr(), tmp.getBlockRawPtr(), sizeof(*(tmp.getBlockRawPtr())));
+    if(version == 0) {
+      // Files written before chunked encoding, one record per block
+      is.read(reinterpret_cast<char *>(&n), sizeof(size_t));
+      block_buffer_.reserve(n);
+      for(size_t i = 0; i < n; ++i) 
+        internal::deserialise(*block_buffer_.acquire_block(), is);
+      if(!is) return false;
+    } else if(!internal::read_block_chunks(is, block_buffer_)) {
+      return false;
+    }
+    std::cout << "Read " << block_buffer_.size() << " blocks " << std::endl;
+    for(size_t i = 0; i < block_buffer_.size(); ++i) {
+      block_buffer_[i]->active(true);
+      // The scale is not stored, so coarse updates must not overwrite the
+      // loaded voxels
+      block_buffer_[i]->scale(0);
+    }
+
+    // Bucket the octants by level, preserving the pool order
+    const int leaves_level = max_level_ - math::log2_const(blockSide);
+    std::vector<std::vector<std::pair<key_t, Node<T> *> > > 
+      octants(leaves_level + 1);
+    for(size_t i = 0; i < nodes_buffer_.size(); ++i) {
+      Node<T> * node = nodes_buffer_[i];
+      octants[keyops::level(node->code_)].emplace_back(node->code_, node);
+    }
+    for(size_t i = 0; i < block_buffer_.size(); ++i) 
+      octants[leaves_level].emplace_back(block_buffer_[i]->code_, 
+          block_buffer_[i]);
+
+    // The file holds every ancestor, hence sorted levels can be linked
+    // directly without allocating.
+    keys_at_level_.resize(leaves_level + 1);
+    nodes_at_level_.resize(leaves_level + 1);
+    keys_at_level_[0].assign(1, 0);
+    nodes_at_level_[0].assign(1, root_);
+    for(int level = 1; level <= leaves_level; ++level) {
+      std::sort(octants[level].begin(), octants[level].end());
+      keys_at_level_[level].resize(octants[level].size());
+      nodes_at_level_[level].resize(octants[level].size());
+      for(size_t i = 0; i < octants[level].size(); ++i) {
+        keys_at_level_[level][i] = octants[level][i].first;
+        nodes_at_level_[level][i] = octants[level][i].second;
+      }
+      link_level(level, true);
     }
   }
+  return true;
 }
 ;
 }
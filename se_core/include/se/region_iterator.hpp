@@ -0,0 +1,218 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef REGION_ITERATOR_HPP
+#define REGION_ITERATOR_HPP
+#include <algorithm>
+#include <vector>
+#include "octree.hpp"
+#include "octant_ops.hpp"
+#include "geometry/regions.hpp"
+#include "Eigen/Dense"
+
+namespace se {
+
+/*! \brief Iterates over the allocated octants intersecting a region, e.g. a
+ * geometry::aabb_region, sphere_region or frustum_region, by depth-first
+ * descent of the octree pruned at non-intersecting octants. Octants are
+ * visited parents first, siblings in Morton order. Subtrees fully contained
+ * in the region are traversed without further tests.
+ */
+template <typename T, typename RegionT>
+class region_iterator {
+
+  public:
+  /*! \brief Iterates over the whole map.
+   */
+  region_iterator(const Octree<T>& map, const RegionT& region) : 
+    region_iterator(map, region, map.root()) { }
+
+  /*! \brief Iterates over the subtree rooted at start only. Iterators over
+   * disjoint subtrees, e.g. as returned by region_octants, can be run 
+   * concurrently.
+   */
+  region_iterator(const Octree<T>& map, const RegionT& region, 
+      Node<T> * start) : map_(map), region_(region), stack_idx_(0) {
+    if(!start) return;
+    const int side = map_.size() >> keyops::level(start->code_);
+    const Eigen::Vector3i corner = keyops::decode(start->code_);
+    if(!region_.intersects(corner, side)) return;
+    stack_[stack_idx_++] = {start, region_.contains(corner, side)};
+  }
+
+  /*! \brief Returns the next intersecting octant, either an internal node or
+   * a voxel block, or nullptr once the region has been exhausted.
+   */
+  Node<T> * next() {
+    if(stack_idx_ == 0) return nullptr;
+    const stack_entry current = stack_[--stack_idx_];
+    Node<T> * node = current.node;
+    if(node->isLeaf() || node->children_mask_ == 0) return node;
+
+    const int side = (map_.size() >> keyops::level(node->code_)) / 2;
+    const Eigen::Vector3i corner = keyops::decode(node->code_);
+    for(int i = 7; i >= 0; --i) {
+      Node<T> * child = node->child(i);
+      if(!child) continue;
+      if(current.inside) {
+        stack_[stack_idx_++] = {child, true};
+        continue;
+      }
+      const Eigen::Vector3i child_corner = corner + side * 
+        Eigen::Vector3i((i & 1) > 0, (i & 2) > 0, (i & 4) > 0);
+      if(!region_.intersects(child_corner, side)) continue;
+      stack_[stack_idx_++] = {child, region_.contains(child_corner, side)};
+    }
+    return node;
+  }
+
+  /*! \brief Returns the next intersecting voxel block, or nullptr once the
+   * region has been exhausted.
+   */
+  VoxelBlock<T> * next_block() {
+    Node<T> * node;
+    while((node = next())) {
+      if(node->isLeaf()) return static_cast<VoxelBlock<T> *>(node);
+    }
+    return nullptr;
+  }
+
+  private:
+  typedef struct stack_entry {
+    Node<T> * node;
+    bool inside;
+  } stack_entry;
+
+  const Octree<T>& map_;
+  const RegionT region_;
+  stack_entry stack_[Octree<T>::max_depth*8 + 1];
+  int stack_idx_;
+};
+
+/*! \brief Collects the allocated octants at the given depth intersecting a
+ * region. Each of them seeds an independent region_iterator, which allows to
+ * split a region query into chunks to be processed in parallel.
+ * \param map octree to be queried
+ * \param region query region
+ * \param level depth of the returned octants, clamped to the voxel blocks
+ * depth
+ * \param out intersecting octants, in Morton order
+ */
+template <typename T, typename RegionT>
+void region_octants(const Octree<T>& map, const RegionT& region, int level,
+    std::vector<Node<T> *>& out) {
+  out.clear();
+  const int leaves_level = math::log2_const(map.size()) - 
+    math::log2_const(BLOCK_SIDE);
+  level = std::min(level, leaves_level);
+
+  // Same pruned descent as region_iterator, stopping at the target depth
+  std::vector<Node<T> *> stack;
+  Node<T> * root = map.root();
+  if(!root || !region.intersects(Eigen::Vector3i::Constant(0), map.size())) 
+    return;
+  stack.push_back(root);
+  while(!stack.empty()) {
+    Node<T> * node = stack.back();
+    stack.pop_back();
+    const int node_level = keyops::level(node->code_);
+    if(node_level == level) {
+      out.push_back(node);
+      continue;
+    }
+    if(node->isLeaf()) continue;
+    const int side = map.size() >> (node_level + 1);
+    const Eigen::Vector3i corner = keyops::decode(node->code_);
+    for(int i = 7; i >= 0; --i) {
+      Node<T> * child = node->child(i);
+      if(!child) continue;
+      const Eigen::Vector3i child_corner = corner + side * 
+        Eigen::Vector3i((i & 1) > 0, (i & 2) > 0, (i & 4) > 0);
+      if(region.intersects(child_corner, side)) stack.push_back(child);
+    }
+  }
+}
+
+/*! \brief Collects the allocated voxel blocks intersecting a region. 
+ * \param map octree to be queried
+ * \param region query region
+ * \param out intersecting voxel blocks, in Morton order
+ */
+template <typename T, typename RegionT>
+void region_blocks(const Octree<T>& map, const RegionT& region, 
+    std::vector<VoxelBlock<T> *>& out) {
+  out.clear();
+  region_iterator<T, RegionT> it(map, region);
+  VoxelBlock<T> * block;
+  while((block = it.next_block())) {
+    out.push_back(block);
+  }
+}
+
+/*! \brief Collects the allocated internal nodes intersecting a region. 
+ * \param map octree to be queried
+ * \param region query region
+ * \param out intersecting nodes, parents first
+ */
+template <typename T, typename RegionT>
+void region_nodes(const Octree<T>& map, const RegionT& region, 
+    std::vector<Node<T> *>& out) {
+  out.clear();
+  region_iterator<T, RegionT> it(map, region);
+  Node<T> * node;
+  while((node = it.next())) {
+    if(!node->isLeaf()) out.push_back(node);
+  }
+}
+
+/*! \brief Collects the allocated internal nodes and voxel blocks
+ * intersecting a region in a single descent, as region_nodes and
+ * region_blocks would.
+ * \param map octree to be queried
+ * \param region query region
+ * \param nodes intersecting nodes, parents first
+ * \param blocks intersecting voxel blocks, in Morton order
+ */
+template <typename T, typename RegionT>
+void region_octants(const Octree<T>& map, const RegionT& region, 
+    std::vector<Node<T> *>& nodes, std::vector<VoxelBlock<T> *>& blocks) {
+  nodes.clear();
+  blocks.clear();
+  region_iterator<T, RegionT> it(map, region);
+  Node<T> * node;
+  while((node = it.next())) {
+    if(node->isLeaf()) 
+      blocks.push_back(static_cast<VoxelBlock<T> *>(node));
+    else 
+      nodes.push_back(node);
+  }
+}
+}
+#endif
@@ -32,7 +32,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef MEM_POOL_H
 #define MEM_POOL_H
 
+#include <algorithm>
 #include <iostream>
+#include <new>
 #include <vector>
 #include <atomic>
 #include <mutex>
@@ -45,6 +47,7 @@ template <typename BlockType>
         current_block_ = 0;
         num_pages_ = 0;
         reserved_ = 0;
+        used_ = 0;
       }
 
       ~MemoryPool(){
@@ -72,12 +75,26 @@ template <typename BlockType>
         const int page_idx = current / pagesize_;
         const int ptr_idx = current % pagesize_;
         BlockType * ptr = pages_[page_idx] + (ptr_idx);
+        // Blocks handed out before the last clear() hold stale contents
+        if(static_cast<size_t>(current) < used_) {
+          ptr->~BlockType();
+          new (ptr) BlockType();
+        }
         return ptr;
       }
 
+      /*! \brief Empties the pool, keeping its pages for reuse. Blocks are
+       * reconstructed only when acquired again. Not thread safe.
+       */
+      void clear(){
+        used_ = std::max<size_t>(used_, current_block_);
+        current_block_ = 0;
+      }
+
     private:
       size_t reserved_;
       std::atomic<unsigned int> current_block_;
+      size_t used_; // High-water mark of the blocks handed out
       const int pagesize_ = 1024; // # of blocks per page
       int num_pages_;
       std::vector<BlockType *> pages_;
@@ -0,0 +1,142 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef SCRATCH_ARENA_HPP
+#define SCRATCH_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace se {
+
+  /*! \brief Bump allocator for per-frame temporaries. Memory is handed out 
+   * linearly from a single buffer and released all at once by reset(). 
+   * Requests not fitting in the buffer are served from overflow chunks, and
+   * the next reset() grows the buffer to the highest usage seen, so that a
+   * loop with a steady per-frame footprint performs no heap allocation.
+   * Only trivially destructible types should be stored. Not thread safe,
+   * allocate before entering parallel regions.
+   */
+  class ScratchArena {
+    public:
+      ScratchArena(const size_t capacity = 0) : 
+        capacity_(capacity), offset_(0), peak_(0) {
+        if(capacity_ > 0) buffer_.reset(new char[capacity_]);
+      }
+
+      /*! \brief Allocates uninitialised storage for n elements of type U,
+       * valid until the next reset.
+       */
+      template <typename U>
+      U * allocate(const size_t n) {
+        const size_t bytes = n * sizeof(U);
+        const size_t begin = align(offset_, alignof(U));
+        offset_ = begin + bytes;
+        peak_ = std::max(peak_, offset_);
+        if(offset_ <= capacity_) {
+          return reinterpret_cast<U *>(buffer_.get() + begin);
+        }
+        overflow_.emplace_back(new char[bytes + alignof(U)]);
+        char * chunk = overflow_.back().get();
+        return reinterpret_cast<U *>(chunk + 
+            (align(reinterpret_cast<size_t>(chunk), alignof(U)) - 
+             reinterpret_cast<size_t>(chunk)));
+      }
+
+      /*! \brief Releases every allocation at once. 
+       */
+      void reset() {
+        if(peak_ > capacity_) {
+          overflow_.clear();
+          capacity_ = peak_;
+          buffer_.reset(new char[capacity_]);
+        }
+        offset_ = 0;
+      }
+
+      size_t capacity() const { return capacity_; }
+      size_t used() const { return offset_; }
+
+    private:
+      static size_t align(const size_t offset, const size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+      }
+
+      std::unique_ptr<char[]> buffer_;
+      size_t capacity_;
+      size_t offset_;
+      size_t peak_;
+      std::vector<std::unique_ptr<char[]> > overflow_;
+
+      ScratchArena(const ScratchArena&) = delete;
+      ScratchArena& operator=(const ScratchArena&) = delete;
+  };
+
+  /*! \brief Standard allocator drawing from a ScratchArena, so that standard
+   * containers can hold per-frame temporaries. Deallocation is a no-op,
+   * memory is reclaimed by ScratchArena::reset.
+   */
+  template <typename U>
+  class ScratchAllocator {
+    public:
+      typedef U value_type;
+
+      ScratchAllocator(ScratchArena& arena) : arena_(&arena) { }
+
+      template <typename V>
+      ScratchAllocator(const ScratchAllocator<V>& other) : 
+        arena_(other.arena()) { }
+
+      U * allocate(const size_t n) { return arena_->allocate<U>(n); }
+      void deallocate(U *, const size_t) { }
+
+      ScratchArena * arena() const { return arena_; }
+
+    private:
+      ScratchArena * arena_;
+  };
+
+  template <typename U, typename V>
+  bool operator==(const ScratchAllocator<U>& a, const ScratchAllocator<V>& b) {
+    return a.arena() == b.arena();
+  }
+
+  template <typename U, typename V>
+  bool operator!=(const ScratchAllocator<U>& a, const ScratchAllocator<V>& b) {
+    return !(a == b);
+  }
+
+  template <typename U>
+  using scratch_vector = std::vector<U, ScratchAllocator<U> >;
+}
+#endif
@@ -0,0 +1,111 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "octree.hpp"
+#include "algorithms/point_cloud.hpp"
+#include "gtest/gtest.h"
+
+struct testT {
+  float x;
+  float y;
+};
+
+template <>
+struct voxel_traits<testT> {
+  typedef testT value_type;
+  static inline value_type empty(){ return {1.f, 0.f}; }
+  static inline value_type initValue(){ return {1.f, 0.f}; }
+};
+
+class PointCloudTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      oct_.init(64, 6.4f);
+      // A single layer of blocks, z in [8, 16), with a plane at z = 12.5
+      const int side = se::VoxelBlock<testT>::side;
+      for(int y = 0; y < oct_.size(); y += side)
+        for(int x = 0; x < oct_.size(); x += side) {
+          se::VoxelBlock<testT> * block = oct_.insert(x, y, 8);
+          const Eigen::Vector3i start = block->coordinates();
+          for(int k = 0; k < side; ++k)
+            for(int j = 0; j < side; ++j)
+              for(int i = 0; i < side; ++i) {
+                const Eigen::Vector3i vox = start + Eigen::Vector3i(i, j, k);
+                block->data(vox, {(vox(2) - plane_) / side, 1.f});
+              }
+        }
+    }
+
+  se::Octree<testT> oct_;
+  const float plane_ = 12.5f;
+};
+
+TEST_F(PointCloudTest, PlaneCrossings) {
+  std::vector<Eigen::Vector3f> points, normals;
+  se::algorithms::zero_crossings(oct_, 
+      [](const testT& val) { return val.x; },
+      [](const testT& val) { return val.x < 0.f; }, points, normals);
+
+  const float voxel_size = oct_.dim() / oct_.size();
+  ASSERT_EQ(points.size(), oct_.size() * oct_.size());
+  ASSERT_EQ(normals.size(), points.size());
+  for(size_t i = 0; i < points.size(); ++i) {
+    ASSERT_NEAR(points[i](2), plane_ * voxel_size, 1e-5f);
+    ASSERT_NEAR(normals[i].norm(), 1.f, 1e-5f);
+    ASSERT_GT(normals[i](2), 0.9f);
+  }
+}
+
+TEST_F(PointCloudTest, NormalsPointOutside) {
+  std::vector<Eigen::Vector3f> points, normals;
+  // Occupancy-like: the positive side of the plane is the inside
+  se::algorithms::zero_crossings(oct_, 
+      [](const testT& val) { return val.x; },
+      [](const testT& val) { return val.x > 0.f; }, points, normals);
+
+  ASSERT_EQ(points.size(), oct_.size() * oct_.size());
+  for(size_t i = 0; i < normals.size(); ++i) 
+    ASSERT_LT(normals[i](2), -0.9f);
+}
+
+TEST_F(PointCloudTest, UnobservedVoxelsIgnored) {
+  const int side = se::VoxelBlock<testT>::side;
+  se::VoxelBlock<testT> * block = oct_.fetch(0, 0, 8);
+  for(int k = 0; k < side; ++k)
+    for(int j = 0; j < side; ++j)
+      for(int i = 0; i < side; ++i)
+        block->data(Eigen::Vector3i(i, j, k + 8), {1.f, 0.f});
+
+  std::vector<Eigen::Vector3f> points, normals;
+  se::algorithms::zero_crossings(oct_, 
+      [](const testT& val) { return val.x; },
+      [](const testT& val) { return val.x < 0.f; }, points, normals);
+  ASSERT_EQ(points.size(), oct_.size() * oct_.size() - side * side);
+}
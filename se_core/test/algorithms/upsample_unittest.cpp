@@ -0,0 +1,109 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "octree.hpp"
+#include "algorithms/upsample.hpp"
+#include "gtest/gtest.h"
+
+typedef float testT;
+
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 0.f; }
+  static inline value_type interpolate(const value_type& a, 
+      const value_type& b, const float t) { return a + t * (b - a); }
+};
+
+typedef int nearestT;
+
+template <>
+struct voxel_traits<nearestT> {
+  typedef int value_type;
+  static inline value_type empty(){ return 0; }
+  static inline value_type initValue(){ return 0; }
+};
+
+static float linear(int x, int y, int z) {
+  return 1.f + x + 2.f * y - 3.f * z;
+}
+
+TEST(UpsampleTest, InterpolatesLinearFields) {
+  const int side = se::VoxelBlock<testT>::side;
+  for(unsigned int scale = 1; scale < se::VoxelBlock<testT>::max_scale; 
+      ++scale) {
+    const int stride = 1 << scale;
+    se::VoxelBlock<testT> block;
+    for(int z = 0; z < side; z += stride)
+      for(int y = 0; y < side; y += stride)
+        for(int x = 0; x < side; x += stride)
+          block.data(Eigen::Vector3i(x, y, z), linear(x, y, z));
+
+    se::algorithms::upsample(&block, scale);
+    for(int z = 0; z < side; ++z)
+      for(int y = 0; y < side; ++y)
+        for(int x = 0; x < side; ++x)
+          ASSERT_FLOAT_EQ(block.data(Eigen::Vector3i(x, y, z)), 
+              linear(x, y, z));
+  }
+}
+
+TEST(UpsampleTest, NearestSampleWithoutInterpolation) {
+  const int side = se::VoxelBlock<nearestT>::side;
+  se::VoxelBlock<nearestT> block;
+  for(int z = 0; z < side; z += 2)
+    for(int y = 0; y < side; y += 2)
+      for(int x = 0; x < side; x += 2)
+        block.data(Eigen::Vector3i(x, y, z), x + side * y + side * side * z);
+
+  se::algorithms::upsample(&block, 1);
+  for(int z = 0; z < side; ++z)
+    for(int y = 0; y < side; ++y)
+      for(int x = 0; x < side; ++x) {
+        // Extrapolated voxels past the last sample take that sample
+        const Eigen::Vector3i nearest = Eigen::Vector3i(x, y, z) - 
+          Eigen::Vector3i(x % 2, y % 2, z % 2) + 
+          Eigen::Vector3i(x % 2 && x < side - 1, y % 2 && y < side - 1, 
+              z % 2 && z < side - 1) * 2;
+        ASSERT_EQ(block.data(Eigen::Vector3i(x, y, z)), 
+            nearest.x() + side * nearest.y() + side * side * nearest.z());
+      }
+}
+
+TEST(UpsampleTest, SingleSampleFillsBlock) {
+  const unsigned int scale = se::VoxelBlock<testT>::max_scale;
+  se::VoxelBlock<testT> block;
+  block.data(0, 3.f);
+  se::algorithms::upsample(&block, scale);
+  for(int v = 0; v < 512; ++v) {
+    ASSERT_EQ(block.data(v), 3.f);
+  }
+}
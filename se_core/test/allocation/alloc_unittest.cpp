@@ -121,3 +121,123 @@ TEST(AllocationTest, MortonPrefixMask) {
     edge = edge/2;
   }
 }
+
+TEST(AllocationTest, BuildMatchesInsert) {
+  typedef se::Octree<float> OctreeF;
+  OctreeF oct, ref;
+  oct.init(512, 5);
+  ref.init(512, 5);
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> dis(0, 511);
+
+  constexpr int num_samples = 2000;
+  std::vector<se::key_t> keys(num_samples);
+  for(int i = 0; i < num_samples; ++i) {
+    const Eigen::Vector3i vox = {dis(gen), dis(gen), dis(gen)};
+    keys[i] = oct.hash(vox(0), vox(1), vox(2));
+    ref.insert(vox(0), vox(1), vox(2));
+  }
+  oct.allocate(keys.data(), num_samples);
+
+  std::vector<se::VoxelBlock<float> *> blocks;
+  oct.getBlockList(blocks, false);
+  ASSERT_EQ(blocks.size(), ref.getBlockBuffer().size());
+  ASSERT_EQ(oct.getNodesBuffer().size(), ref.getNodesBuffer().size());
+  for(auto block : blocks) {
+    const Eigen::Vector3i c = block->coordinates();
+    ASSERT_EQ(block, oct.fetch(c(0), c(1), c(2)));
+    ASSERT_NE(ref.fetch(c(0), c(1), c(2)), nullptr);
+    ASSERT_EQ(block->side_, (int) se::VoxelBlock<float>::side);
+  }
+
+  // Allocating again must reuse the existing octants
+  oct.allocate(keys.data(), num_samples);
+  ASSERT_EQ(oct.getBlockBuffer().size(), ref.getBlockBuffer().size());
+  ASSERT_EQ(oct.getNodesBuffer().size(), ref.getNodesBuffer().size());
+}
+
+TEST(AllocationTest, BuildPayload) {
+  typedef se::Octree<float> OctreeF;
+  OctreeF oct;
+  oct.init(256, 5);
+  std::vector<se::key_t> keys = {
+    oct.hash(0, 0, 0, 2),
+    oct.hash(16, 0, 0, 4),
+    oct.hash(130, 17, 33),
+    oct.hash(200, 200, 200, 5)
+  };
+  std::sort(keys.begin(), keys.end());
+  std::vector<se::Node<float> *> nodes(keys.size());
+  oct.build(keys.data(), keys.size(), [&nodes](int i, se::Node<float> * n) {
+      nodes[i] = n;
+      });
+
+  for(unsigned int i = 0; i < keys.size(); ++i) {
+    const Eigen::Vector3i c = se::keyops::decode(keys[i]);
+    const int level = std::min(se::keyops::level(keys[i]), 5);
+    ASSERT_EQ(nodes[i], oct.fetch_octant(c(0), c(1), c(2), level));
+  }
+  ASSERT_NE(oct.fetch(130, 17, 33), nullptr);
+  ASSERT_EQ(oct.fetch(0, 0, 0), nullptr);
+}
+
+TEST(AllocationTest, MergeOctrees) {
+  typedef se::Octree<float> OctreeF;
+  OctreeF a, b;
+  a.init(256, 5);
+  b.init(256, 5);
+  a.insert(10, 10, 10);
+  a.set(10, 10, 10, 1.f);
+  b.insert(10, 10, 10);
+  b.set(10, 10, 10, 2.f);
+  b.insert(100, 200, 50);
+  b.set(100, 200, 50, 3.f);
+
+  a.merge(b, [](float& dst, const float& src) { dst += src; });
+  EXPECT_EQ(a.get(10, 10, 10), 3.f);
+  EXPECT_EQ(a.get(100, 200, 50), 3.f);
+  EXPECT_EQ(a.getBlockBuffer().size(), 2);
+
+  OctreeF c;
+  c.init(128, 5);
+  EXPECT_FALSE(a.merge(c));
+}
+
+TEST(AllocationTest, ClearReusesPools) {
+  typedef se::Octree<float> OctreeF;
+  OctreeF oct;
+  oct.init(256, 5);
+  std::vector<se::key_t> alloc_list;
+  for(int i = 0; i < 10; ++i) 
+    alloc_list.push_back(oct.hash(20 * i, 8 * i, 255 - 16 * i));
+  oct.allocate(alloc_list.data(), alloc_list.size());
+  const int num_blocks = oct.getBlockBuffer().size();
+  const int num_nodes = oct.getNodesBuffer().size();
+  std::vector<se::VoxelBlock<float> *> blocks;
+  for(int i = 0; i < num_blocks; ++i) {
+    se::VoxelBlock<float> * block = oct.getBlockBuffer()[i];
+    block->data(7, 2.f);
+    block->scale(0);
+    blocks.push_back(block);
+  }
+
+  const int max_scale = se::VoxelBlock<float>::max_scale;
+  oct.clear();
+  ASSERT_EQ(oct.getBlockBuffer().size(), 0);
+  ASSERT_EQ(oct.getNodesBuffer().size(), 1);
+  ASSERT_EQ(oct.fetch(20, 8, 255), nullptr);
+  EXPECT_EQ(oct.get(20, 8, 255), voxel_traits<float>::empty());
+
+  // The same octants land in the same memory, reinitialised
+  oct.allocate(alloc_list.data(), alloc_list.size());
+  ASSERT_EQ(oct.getBlockBuffer().size(), num_blocks);
+  ASSERT_EQ(oct.getNodesBuffer().size(), num_nodes);
+  for(int i = 0; i < num_blocks; ++i) {
+    se::VoxelBlock<float> * block = oct.getBlockBuffer()[i];
+    ASSERT_EQ(block, blocks[i]);
+    ASSERT_EQ(block->data(7), voxel_traits<float>::initValue());
+    ASSERT_EQ(block->scale(), max_scale);
+  }
+  for(int i = 0; i < 10; ++i) 
+    ASSERT_NE(oct.fetch(20 * i, 8 * i, 255 - 16 * i), nullptr);
+}
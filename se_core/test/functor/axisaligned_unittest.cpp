@@ -113,3 +113,24 @@ TEST_F(AxisAlignedTest, BBoxTest) {
         }
       }
 }
+
+TEST_F(AxisAlignedTest, BBoxNodes) {
+
+  auto set_to_ten = [](auto& handler, const Eigen::Vector3i&) {
+          handler.set(10.f);
+    };
+
+  se::functor::axis_aligned_map(oct_, set_to_ten, 
+      Eigen::Vector3i::Constant(0), Eigen::Vector3i::Constant(64));
+
+  // Only nodes overlapping the box can have been visited
+  auto& nodes = oct_.getNodesBuffer();
+  for(unsigned int i = 0; i < nodes.size(); ++i) {
+    se::Node<testT> * n = nodes[i];
+    const Eigen::Vector3i corner = se::keyops::decode(n->code_);
+    if((corner.array() < 64).all()) continue;
+    for(int c = 0; c < 8; ++c) {
+      ASSERT_NE(n->value_[c], 10.f);
+    }
+  }
+}
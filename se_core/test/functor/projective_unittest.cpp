@@ -0,0 +1,405 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "octree.hpp"
+#include "functors/projective_functor.hpp"
+#include "gtest/gtest.h"
+
+typedef float testT;
+
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 0.f; }
+};
+
+// Order dependent update, so that the multi-camera pass must apply the
+// cameras in the same order as sequential single-camera passes
+struct scale_add_update {
+  template <typename DataHandlerT>
+  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f& pos, const Eigen::Vector2f&) {
+    handler.set(0.5f * handler.get() + offset + pos(2));
+  }
+  float offset;
+};
+
+// Counts the updates of every voxel, reporting it as changing on request
+struct converging_update {
+  template <typename DataHandlerT>
+  bool operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f&, const Eigen::Vector2f&) {
+    handler.set(handler.get() + 1.f);
+    return *changing;
+  }
+  const bool * changing;
+};
+
+// Updates the voxels up to band behind the measured depth, counting the
+// voxels visited
+struct band_update {
+  template <typename DataHandlerT>
+  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f& pos, const Eigen::Vector2f& pixel) {
+    ++*visited;
+    const Eigen::Vector2i px = pixel.cast<int>();
+    const float d = depth[px(0) + size(0) * px(1)];
+    if (d <= 0.f || d - pos(2) < -band) return;
+    handler.set(handler.get() + 1.f);
+  }
+  const float * depth;
+  Eigen::Vector2i size;
+  float band;
+  int * visited;
+};
+
+class ProjectiveTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      K_ = Eigen::Matrix4f::Identity();
+      K_(0, 0) = K_(1, 1) = 100.f;
+      K_(0, 2) = 80.f;
+      K_(1, 2) = 60.f;
+
+      // Three cameras around the volume centre, looking at it
+      const Eigen::Vector3f centre = Eigen::Vector3f::Constant(1.28f);
+      for(int c = 0; c < 3; ++c) {
+        const float angle = c * 2.f * M_PI / 3.f;
+        const Eigen::Vector3f eye = centre + 1.5f * 
+          Eigen::Vector3f(std::cos(angle), 0.f, std::sin(angle));
+        const Eigen::Vector3f z = (centre - eye).normalized();
+        const Eigen::Vector3f x = Eigen::Vector3f::UnitY().cross(z).normalized();
+        Eigen::Matrix3f R;
+        R << x, z.cross(x), z;
+        Tcw_.push_back(Sophus::SE3f(R, eye).inverse());
+      }
+
+      for(int i = 0; i < 2; ++i) {
+        maps_[i].init(256, 2.56f);
+        std::vector<se::key_t> alloc_list;
+        for(int z = 112; z < 144; z += 8) {
+          for(int y = 112; y < 144; y += 8) {
+            for(int x = 112; x < 144; x += 8) {
+              alloc_list.push_back(maps_[i].hash(x, y, z));
+            }
+          }
+        }
+        maps_[i].allocate(alloc_list.data(), alloc_list.size());
+      }
+    }
+
+  se::Octree<testT> maps_[2];
+  Eigen::Matrix4f K_;
+  std::vector<Sophus::SE3f, Eigen::aligned_allocator<Sophus::SE3f> > Tcw_;
+};
+
+TEST_F(ProjectiveTest, MultiCameraMatchesSequential) {
+  const Eigen::Vector2i frame_size(160, 120);
+  se::ScratchArena scratch;
+  se::functor::projective_cameras<scale_add_update> cameras;
+  for(unsigned int c = 0; c < Tcw_.size(); ++c) {
+    scale_add_update update = {float(c + 1)};
+    se::functor::projective_map(maps_[0], Tcw_[c], K_, frame_size, update, 
+        scratch);
+    scratch.reset();
+    cameras.push_back({Tcw_[c], K_, frame_size, update});
+  }
+  se::functor::projective_map(maps_[1], cameras, scratch);
+
+  auto& blocks = maps_[0].getBlockBuffer();
+  int updated = 0;
+  for(unsigned int i = 0; i < blocks.size(); ++i) {
+    const Eigen::Vector3i base = blocks[i]->coordinates();
+    se::VoxelBlock<testT> * other = maps_[1].fetch(base(0), base(1), base(2));
+    ASSERT_NE(other, nullptr);
+    for(int v = 0; v < 512; ++v) {
+      ASSERT_FLOAT_EQ(blocks[i]->data(v), other->data(v));
+      updated += blocks[i]->data(v) != 0.f;
+    }
+  }
+  ASSERT_GT(updated, 0);
+
+  auto& nodes = maps_[0].getNodesBuffer();
+  for(unsigned int i = 0; i < nodes.size(); ++i) {
+    se::Node<testT> * n = nodes[i];
+    const Eigen::Vector3i base = se::keyops::decode(n->code_);
+    se::Node<testT> * other = maps_[1].fetch_octant(base(0), base(1), base(2),
+        se::keyops::level(n->code_));
+    for(int c = 0; c < 8; ++c) {
+      ASSERT_FLOAT_EQ(n->value_[c], other->value_[c]);
+    }
+  }
+}
+
+TEST_F(ProjectiveTest, SkipsConvergedBlocks) {
+  const Eigen::Vector2i frame_size(160, 120);
+  const se::functor::convergence_policy policy = {2, 3};
+  se::ScratchArena scratch;
+  bool changing = false;
+  converging_update update = {&changing};
+
+  auto integrate = [&](int frames) {
+    for(int f = 0; f < frames; ++f) {
+      se::functor::projective_map(maps_[0], Tcw_[0], K_, frame_size, update,
+          scratch, policy);
+      scratch.reset();
+    }
+  };
+  auto check_updates = [&](float expected) {
+    auto& blocks = maps_[0].getBlockBuffer();
+    int updated = 0;
+    for(unsigned int i = 0; i < blocks.size(); ++i) {
+      for(int v = 0; v < 512; ++v) {
+        const float value = blocks[i]->data(v);
+        if(value != 0.f) {
+          ASSERT_EQ(value, expected);
+          ++updated;
+        }
+      }
+    }
+    ASSERT_GT(updated, 0);
+  };
+
+  // Converged after two visits, then updated every third visit only
+  integrate(6);
+  check_updates(4.f);
+
+  // A change seen at the next revisit re-enables the blocks
+  changing = true;
+  integrate(2);
+  check_updates(4.f);
+  integrate(3);
+  check_updates(7.f);
+}
+
+TEST_F(ProjectiveTest, DepthCullingKeepsUpdates) {
+  const Eigen::Vector2i frame_size(160, 120);
+  // A surface crossing the volume, with a hole on the right
+  std::vector<float> depth(frame_size.x() * frame_size.y());
+  for(int y = 0; y < frame_size.y(); ++y) {
+    for(int x = 0; x < frame_size.x(); ++x) {
+      depth[x + y * frame_size.x()] = x > 120 ? 0.f : 1.3f + 0.002f * y;
+    }
+  }
+  se::DepthPyramid pyramid;
+  pyramid.build(depth.data(), frame_size);
+
+  const float band = 0.05f;
+  int visited[2] = {0, 0};
+  se::ScratchArena scratch;
+  for(int i = 0; i < 2; ++i) {
+    band_update update = {depth.data(), frame_size, band, &visited[i]};
+    const se::functor::depth_culling culling = {i == 0 ? nullptr : &pyramid,
+      std::numeric_limits<float>::infinity(), band};
+    se::functor::projective_map(maps_[i], Tcw_[0], K_, frame_size, update, 
+        scratch, se::functor::convergence_policy{0, 1}, culling);
+    scratch.reset();
+  }
+  ASSERT_LT(visited[1], visited[0]);
+
+  auto& blocks = maps_[0].getBlockBuffer();
+  int updated = 0;
+  for(unsigned int i = 0; i < blocks.size(); ++i) {
+    const Eigen::Vector3i base = blocks[i]->coordinates();
+    se::VoxelBlock<testT> * other = maps_[1].fetch(base(0), base(1), base(2));
+    for(int v = 0; v < 512; ++v) {
+      ASSERT_EQ(blocks[i]->data(v), other->data(v));
+      updated += blocks[i]->data(v) != 0.f;
+    }
+  }
+  ASSERT_GT(updated, 0);
+}
+
+TEST_F(ProjectiveTest, CulledBlocksLeaveActiveList) {
+  const Eigen::Vector2i frame_size(160, 120);
+  std::vector<float> depth(frame_size.x() * frame_size.y(), 1.5f);
+  se::DepthPyramid pyramid;
+  pyramid.build(depth.data(), frame_size);
+  const se::functor::depth_culling culling = {&pyramid, 
+    std::numeric_limits<float>::infinity(), 0.1f};
+  se::ScratchArena scratch;
+  int visited = 0;
+  band_update update = {depth.data(), frame_size, 10.f, &visited};
+
+  auto integrate = [&](const Sophus::SE3f& Tcw) {
+    se::functor::projective_map(maps_[0], Tcw, K_, frame_size, update, 
+        scratch, se::functor::convergence_policy{0, 1}, culling);
+    scratch.reset();
+  };
+  auto active_blocks = [&]() {
+    auto& blocks = maps_[0].getBlockBuffer();
+    int active = 0;
+    for(unsigned int i = 0; i < blocks.size(); ++i) 
+      active += blocks[i]->active();
+    return active;
+  };
+
+  integrate(Tcw_[0]);
+  ASSERT_GT(active_blocks(), 0);
+
+  // Sideways the blocks are still in front of the camera but project
+  // outside the image
+  const Sophus::SE3f moved = 
+    Sophus::SE3f(Eigen::Matrix3f::Identity(), Eigen::Vector3f(-3.f, 0.f, 0.f)) *
+    Tcw_[0];
+  visited = 0;
+  integrate(moved);
+  ASSERT_EQ(visited, 0);
+  ASSERT_EQ(active_blocks(), 0);
+
+  integrate(Tcw_[0]);
+  ASSERT_GT(active_blocks(), 0);
+}
+
+TEST_F(ProjectiveTest, MultiCameraCullsPerCamera) {
+  const Eigen::Vector2i frame_size(160, 120);
+  const int num_pixels = frame_size.x() * frame_size.y();
+  // Surface across the blocks, the same surface with its right half missing,
+  // and a surface in front of all the blocks
+  std::vector<float> depths[3] = {std::vector<float>(num_pixels, 1.5f),
+    std::vector<float>(num_pixels, 1.5f), std::vector<float>(num_pixels, 0.5f)};
+  for(int y = 0; y < frame_size.y(); ++y) {
+    for(int x = frame_size.x() / 2; x < frame_size.x(); ++x) {
+      depths[1][x + y * frame_size.x()] = 0.f;
+    }
+  }
+  se::DepthPyramid pyramids[3];
+  const float band = 0.05f;
+  int visited[2] = {0, 0};
+  se::ScratchArena scratch;
+  se::functor::projective_cameras<band_update> cameras;
+  for(unsigned int c = 0; c < Tcw_.size(); ++c) {
+    pyramids[c].build(depths[c].data(), frame_size);
+    const se::functor::depth_culling culling = {&pyramids[c],
+      std::numeric_limits<float>::infinity(), band};
+    band_update update = {depths[c].data(), frame_size, band, &visited[0]};
+    se::functor::projective_map(maps_[0], Tcw_[c], K_, frame_size, update, 
+        scratch, se::functor::convergence_policy{0, 1}, culling);
+    scratch.reset();
+    update.visited = &visited[1];
+    cameras.push_back({Tcw_[c], K_, frame_size, update, culling});
+  }
+  se::functor::projective_map(maps_[1], cameras, scratch);
+  ASSERT_EQ(visited[0], visited[1]);
+
+  auto& blocks = maps_[0].getBlockBuffer();
+  int updated = 0;
+  for(unsigned int i = 0; i < blocks.size(); ++i) {
+    const Eigen::Vector3i base = blocks[i]->coordinates();
+    se::VoxelBlock<testT> * other = maps_[1].fetch(base(0), base(1), base(2));
+    ASSERT_NE(other, nullptr);
+    for(int v = 0; v < 512; ++v) {
+      ASSERT_EQ(blocks[i]->data(v), other->data(v));
+      updated += blocks[i]->data(v) != 0.f;
+    }
+  }
+  ASSERT_GT(updated, 0);
+}
+
+TEST_F(ProjectiveTest, FarBlocksUpdatedAtCoarseScale) {
+  const Eigen::Vector2i frame_size(160, 120);
+  std::vector<float> depth(frame_size.x() * frame_size.y(), 2.f);
+  se::ScratchArena scratch;
+
+  auto integrate = [&](const se::functor::scale_policy& scales) {
+    int visited = 0;
+    band_update update = {depth.data(), frame_size, 10.f, &visited};
+    se::functor::projective_map(maps_[0], Tcw_[0], K_, frame_size, update,
+        scratch, se::functor::convergence_policy{0, 1}, 
+        se::functor::depth_culling{nullptr, 0.f, 0.f}, scales);
+    scratch.reset();
+    return visited;
+  };
+  auto check_blocks = [&](unsigned int scale, float expected) {
+    auto& blocks = maps_[0].getBlockBuffer();
+    for(unsigned int i = 0; i < blocks.size(); ++i) {
+      ASSERT_EQ(blocks[i]->scale(), scale);
+      for(int v = 0; v < 512; ++v) {
+        ASSERT_EQ(blocks[i]->data(v), expected);
+      }
+    }
+  };
+
+  // The blocks lie more than a metre away: only one voxel in 4^3 is updated
+  // and the block is filled from it. Octants are updated as before.
+  const int num_blocks = maps_[0].getBlockBuffer().size();
+  const se::functor::scale_policy coarse = {0.5f, 2};
+  const int coarse_visits = integrate(coarse);
+  check_blocks(2, 1.f);
+
+  // Full resolution updates refine the blocks for good
+  const int fine_visits = integrate(se::functor::scale_policy{0.f, 0});
+  ASSERT_EQ(fine_visits - coarse_visits, num_blocks * (512 - 8));
+  check_blocks(0, 2.f);
+  ASSERT_EQ(integrate(coarse), fine_visits);
+  check_blocks(0, 3.f);
+}
+
+TEST_F(ProjectiveTest, MultiCameraRefinesCoarseBlocks) {
+  const Eigen::Vector2i frame_size(160, 120);
+  std::vector<float> depth(frame_size.x() * frame_size.y(), 2.f);
+  se::ScratchArena scratch;
+  int visited = 0;
+  band_update update = {depth.data(), frame_size, 10.f, &visited};
+  const se::functor::scale_policy coarse = {0.5f, 2};
+
+  auto integrate = [&]() {
+    visited = 0;
+    se::functor::projective_map(maps_[0], Tcw_[0], K_, frame_size, update,
+        scratch, se::functor::convergence_policy{0, 1}, 
+        se::functor::depth_culling{nullptr, 0.f, 0.f}, coarse);
+    scratch.reset();
+    return visited;
+  };
+  auto check_blocks = [&](unsigned int scale, float expected) {
+    auto& blocks = maps_[0].getBlockBuffer();
+    for(unsigned int i = 0; i < blocks.size(); ++i) {
+      ASSERT_EQ(blocks[i]->scale(), scale);
+      for(int v = 0; v < 512; ++v) {
+        ASSERT_EQ(blocks[i]->data(v), expected);
+      }
+    }
+  };
+
+  const int coarse_visits = integrate();
+  check_blocks(2, 1.f);
+
+  // The multi-camera pass writes every voxel, so the blocks are refined and
+  // the following coarse-policy updates stay at full resolution
+  se::functor::projective_cameras<band_update> cameras;
+  cameras.push_back({Tcw_[0], K_, frame_size, update, 
+      se::functor::depth_culling{nullptr, 0.f, 0.f}});
+  se::functor::projective_map(maps_[0], cameras, scratch);
+  scratch.reset();
+  check_blocks(0, 2.f);
+  ASSERT_GT(integrate(), coarse_visits);
+  check_blocks(0, 3.f);
+}
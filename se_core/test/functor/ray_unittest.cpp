@@ -0,0 +1,133 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "octree.hpp"
+#include "functors/ray_functor.hpp"
+#include "gtest/gtest.h"
+
+typedef float testT;
+
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 0.f; }
+};
+
+// Stores the signed distance of the voxel to the measured point along the
+// ray, read from the range image as the projective updates do
+struct range_update {
+  template <typename DataHandlerT>
+  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f& pos, const Eigen::Vector2f& pixel) {
+    const Eigen::Vector2i px = pixel.cast<int>();
+    handler.set(ranges[px(0) + size(0) * px(1)] - pos(2));
+  }
+  const float * ranges;
+  Eigen::Vector2i size;
+};
+
+struct count_update {
+  template <typename DataHandlerT>
+  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f&, const Eigen::Vector2f&) {
+    handler.set(handler.get() + 1.f);
+  }
+};
+
+class RayTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      map_.init(256, 2.56f);
+    }
+
+  se::Octree<testT> map_;
+  se::ScratchArena scratch_;
+};
+
+TEST_F(RayTest, UpdatesBandAroundPoints) {
+  const Eigen::Vector3f origins[] = {
+    Eigen::Vector3f(0.205f, 1.285f, 1.285f), 
+    Eigen::Vector3f(1.285f, 0.305f, 1.285f)};
+  const Eigen::Vector3f points[] = {
+    Eigen::Vector3f(2.005f, 1.285f, 1.285f), 
+    Eigen::Vector3f(1.285f, 1.505f, 1.285f)};
+  const float ranges[] = {1.8f, 1.2f};
+  const float band = 0.1f;
+  range_update update = {ranges, Eigen::Vector2i(2, 1)};
+  se::functor::ray_map(map_, points, origins, 2, band, band, update, 
+      scratch_);
+
+  // Only the blocks around the points are allocated
+  EXPECT_EQ(map_.fetch(100, 128, 128), nullptr);
+  EXPECT_EQ(map_.fetch(128, 60, 128), nullptr);
+  for(int x = 191; x <= 209; ++x) {
+    ASSERT_NE(map_.fetch(x, 128, 128), nullptr);
+    const float t = 0.01f * (x - 20.5f);
+    EXPECT_NEAR(map_.get(x, 128, 128), ranges[0] - t, 1e-4f);
+  }
+  for(int y = 141; y <= 159; ++y) {
+    ASSERT_NE(map_.fetch(128, y, 128), nullptr);
+    const float t = 0.01f * (y - 30.5f);
+    EXPECT_NEAR(map_.get(128, y, 128), ranges[1] - t, 1e-4f);
+  }
+  // Voxels off the rays are untouched
+  EXPECT_EQ(map_.get(200, 129, 128), 0.f);
+}
+
+TEST_F(RayTest, RaysSharingBlocksAccumulate) {
+  const int num_rays = 64;
+  std::vector<Eigen::Vector3f> origins, points;
+  const Eigen::Vector3f target(1.285f, 1.285f, 1.285f);
+  for(int i = 0; i < num_rays; ++i) {
+    const float angle = i * 2.f * M_PI / num_rays;
+    origins.push_back(target + 
+        Eigen::Vector3f(std::cos(angle), std::sin(angle), 0.3f));
+    points.push_back(target);
+  }
+  count_update update;
+  se::functor::ray_map(map_, points.data(), origins.data(), num_rays, 0.05f, 
+      0.05f, update, scratch_);
+  EXPECT_EQ(map_.get(128, 128, 128), float(num_rays));
+
+  // Every ray updates each voxel of its segment once
+  auto& blocks = map_.getBlockBuffer();
+  float total = 0.f;
+  for(unsigned int i = 0; i < blocks.size(); ++i) {
+    const Eigen::Vector3i base = blocks[i]->coordinates();
+    const int side = se::VoxelBlock<testT>::side;
+    for(int z = 0; z < side; ++z)
+      for(int y = 0; y < side; ++y)
+        for(int x = 0; x < side; ++x)
+          total += blocks[i]->data(base + Eigen::Vector3i(x, y, z));
+  }
+  EXPECT_GE(total, num_rays * 10.f);
+  EXPECT_LE(total, num_rays * 3 * 10.f + num_rays);
+}
@@ -0,0 +1,147 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London 
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+
+*/
+#include <random>
+#include "octree.hpp"
+#include "region_iterator.hpp"
+#include "gtest/gtest.h"
+
+typedef float testT;
+
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 1.f; }
+};
+
+class RegionIteratorTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      oct_.init(512, 5);
+      std::mt19937 gen(1);
+      std::uniform_int_distribution<int> dis(0, 511);
+      std::vector<se::key_t> alloc_list(2000);
+      for(auto& key : alloc_list) {
+        key = oct_.hash(dis(gen), dis(gen), dis(gen));
+      }
+      oct_.allocate(alloc_list.data(), alloc_list.size());
+    }
+
+    template <typename RegionT>
+    void expect_same_blocks(const RegionT& region) {
+      std::vector<se::VoxelBlock<testT> *> expected;
+      auto& blocks = oct_.getBlockBuffer();
+      for(unsigned int i = 0; i < blocks.size(); ++i) {
+        if(region.intersects(blocks[i]->coordinates(), blockSide)) 
+          expected.push_back(blocks[i]);
+      }
+
+      std::vector<se::VoxelBlock<testT> *> found;
+      se::region_blocks(oct_, region, found);
+      for(unsigned int i = 1; i < found.size(); ++i) {
+        ASSERT_LT(found[i-1]->code_, found[i]->code_);
+      }
+      std::sort(expected.begin(), expected.end());
+      std::sort(found.begin(), found.end());
+      ASSERT_FALSE(expected.empty());
+      ASSERT_EQ(expected, found);
+    }
+
+  typedef se::Octree<testT> OctreeF;
+  OctreeF oct_;
+  static constexpr int blockSide = se::VoxelBlock<testT>::side;
+};
+
+TEST_F(RegionIteratorTest, AABB) {
+  expect_same_blocks(se::geometry::aabb_region({100, 37, 250}, {300, 200, 400}));
+  expect_same_blocks(se::geometry::aabb_region({0, 0, 0}, {512, 512, 512}));
+}
+
+TEST_F(RegionIteratorTest, Sphere) {
+  expect_same_blocks(se::geometry::sphere_region({256.f, 100.f, 300.f}, 90.f));
+}
+
+TEST_F(RegionIteratorTest, Frustum) {
+  // Camera at the centre of the volume looking along +z
+  const float voxel_size = 0.01f;
+  Eigen::Matrix4f K = Eigen::Matrix4f::Identity();
+  K(0, 0) = K(1, 1) = 300.f;
+  K(0, 2) = 320.f;
+  K(1, 2) = 240.f;
+  Eigen::Matrix4f Tcw = Eigen::Matrix4f::Identity();
+  Tcw.topRightCorner<3, 1>() = -Eigen::Vector3f(2.56f, 2.56f, 1.f);
+  expect_same_blocks(se::geometry::frustum_region(K * Tcw, {640, 480}, 
+        voxel_size, 0.1f, 3.f));
+}
+
+TEST_F(RegionIteratorTest, NodesIntersect) {
+  const se::geometry::aabb_region region({10, 400, 20}, {200, 500, 100});
+  se::region_iterator<testT, se::geometry::aabb_region> it(oct_, region);
+  se::Node<testT> * node;
+  int num_nodes = 0;
+  while((node = it.next())) {
+    const int side = oct_.size() >> se::keyops::level(node->code_);
+    ASSERT_TRUE(region.intersects(se::keyops::decode(node->code_), side));
+    ++num_nodes;
+  }
+  ASSERT_GT(num_nodes, 1);
+}
+
+TEST_F(RegionIteratorTest, Chunks) {
+  const se::geometry::sphere_region region({200.f, 300.f, 250.f}, 150.f);
+  std::vector<se::VoxelBlock<testT> *> expected;
+  se::region_blocks(oct_, region, expected);
+
+  std::vector<se::Node<testT> *> chunks;
+  se::region_octants(oct_, region, 3, chunks);
+  ASSERT_GT(chunks.size(), 1);
+  std::vector<se::VoxelBlock<testT> *> found;
+  for(auto chunk : chunks) {
+    ASSERT_EQ(se::keyops::level(chunk->code_), 3);
+    se::region_iterator<testT, se::geometry::sphere_region> 
+      it(oct_, region, chunk);
+    se::VoxelBlock<testT> * block;
+    while((block = it.next_block())) found.push_back(block);
+  }
+  ASSERT_EQ(expected, found);
+}
+
+TEST_F(RegionIteratorTest, NodesAndBlocks) {
+  const se::geometry::aabb_region region({10, 300, 20}, {300, 500, 200});
+  std::vector<se::Node<testT> *> expected_nodes, nodes;
+  std::vector<se::VoxelBlock<testT> *> expected_blocks, blocks;
+  se::region_nodes(oct_, region, expected_nodes);
+  se::region_blocks(oct_, region, expected_blocks);
+  se::region_octants(oct_, region, nodes, blocks);
+  ASSERT_FALSE(blocks.empty());
+  ASSERT_EQ(expected_nodes, nodes);
+  ASSERT_EQ(expected_blocks, blocks);
+}
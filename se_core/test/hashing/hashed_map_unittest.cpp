@@ -0,0 +1,285 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London 
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+*/
+#include <cmath>
+#include <random>
+#include <thread>
+#include "octree.hpp"
+#include "hashed_map.hpp"
+#include "ray_iterator.hpp"
+#include "block_ray_iterator.hpp"
+#include "utils/math_utils.h"
+#include "gtest/gtest.h"
+#include "functors/axis_aligned_functor.hpp"
+
+typedef float testT;
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 1.f; }
+};
+
+float test_fun(float x, float y, float z) {
+  return se::math::sq(z) + std::sin(2*x + y);
+}
+
+class HashedMapTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      const unsigned size = 256;
+      const float dim = 5.f;
+      oct_.init(size, dim);
+      map_.init(size, dim);
+
+      const int band = 40;
+      const Eigen::Vector3i offset = Eigen::Vector3i::Constant(size/2 - band/2);
+      const unsigned leaf_level = log2(size) - log2(se::Octree<testT>::blockSide);
+      for(int z = 0; z < band; ++z) {
+        for(int y = 0; y < band; ++y) {
+          for(int x = 0; x < band; ++x) {
+            const Eigen::Vector3i vox = offset + Eigen::Vector3i(x, y, z);
+            alloc_list_.push_back(oct_.hash(vox(0), vox(1), vox(2), leaf_level));
+          }
+        }
+      }
+      std::vector<se::key_t> tmp = alloc_list_;
+      oct_.allocate(tmp.data(), tmp.size());
+      map_.allocate(alloc_list_.data(), alloc_list_.size());
+
+      auto initialise = [](auto& handler, const Eigen::Vector3i& v) {
+        handler.set(test_fun(v(0), v(1), v(2)));
+      };
+      se::functor::axis_aligned_map(oct_, initialise);
+      se::functor::axis_aligned_map(map_, initialise);
+    }
+
+  se::Octree<testT> oct_;
+  se::HashedMap<testT> map_;
+  std::vector<se::key_t> alloc_list_;
+};
+
+TEST_F(HashedMapTest, SameBlocksAsOctree) {
+  ASSERT_EQ(map_.leavesCount(), oct_.getBlockBuffer().size());
+  ASSERT_EQ(map_.getNodesBuffer().size(), 0);
+  auto& blocks = oct_.getBlockBuffer();
+  for(size_t i = 0; i < blocks.size(); ++i) {
+    const Eigen::Vector3i c = blocks[i]->coordinates();
+    se::VoxelBlock<testT> * block = map_.fetch(c(0) + 3, c(1) + 5, c(2) + 7);
+    ASSERT_NE(block, nullptr);
+    ASSERT_EQ(block->coordinates(), c);
+    ASSERT_EQ(block->code_, blocks[i]->code_);
+  }
+  ASSERT_EQ(map_.fetch(0, 0, 0), nullptr);
+  ASSERT_EQ(map_.get(0, 0, 0), voxel_traits<testT>::initValue());
+}
+
+TEST_F(HashedMapTest, SetGet) {
+  const Eigen::Vector3i vox(130, 131, 129);
+  ASSERT_EQ(map_.get_fine(vox(0), vox(1), vox(2)), test_fun(130, 131, 129));
+  map_.set(vox(0), vox(1), vox(2), 42.f);
+  ASSERT_EQ(map_.get(vox(0), vox(1), vox(2)), 42.f);
+}
+
+TEST_F(HashedMapTest, InterpAndGradMatchOctree) {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dis(112.f, 142.f);
+  auto select = [](const auto& val) { return val; };
+  for(int i = 0; i < 1000; ++i) {
+    const Eigen::Vector3f p(dis(gen), dis(gen), dis(gen));
+    ASSERT_FLOAT_EQ(map_.interp(p, select), oct_.interp(p, select));
+    const Eigen::Vector3f g_map = map_.grad(p, select);
+    const Eigen::Vector3f g_oct = oct_.grad(p, select);
+    ASSERT_NEAR(g_map(0), g_oct(0), 1e-5f);
+    ASSERT_NEAR(g_map(1), g_oct(1), 1e-5f);
+    ASSERT_NEAR(g_map(2), g_oct(2), 1e-5f);
+  }
+}
+
+TEST(HashedMapAllocation, ConcurrentInsertDuplicates) {
+  se::HashedMap<testT> map;
+  map.init(512, 5.f);
+  const int num_keys = 20000;
+  std::vector<se::key_t> keys;
+  std::mt19937 gen(2);
+  std::uniform_int_distribution<int> dis(0, 511);
+  for(int i = 0; i < num_keys; ++i)
+    keys.push_back(map.hash(dis(gen), dis(gen), dis(gen)));
+  std::vector<se::key_t> unique_keys = keys;
+  std::sort(unique_keys.begin(), unique_keys.end());
+  unique_keys.erase(std::unique(unique_keys.begin(), unique_keys.end()),
+      unique_keys.end());
+
+  // Every key is repeated several times and keys are not sorted: racing
+  // inserts of the same block must still allocate it exactly once.
+  std::vector<se::key_t> all;
+  for(int i = 0; i < 4; ++i) all.insert(all.end(), keys.begin(), keys.end());
+  map.allocate(all.data(), all.size());
+
+  ASSERT_EQ(map.leavesCount(), unique_keys.size());
+  for(const se::key_t k : unique_keys) {
+    const Eigen::Vector3i c = se::keyops::decode(k);
+    ASSERT_NE(map.fetch(c(0), c(1), c(2)), nullptr);
+  }
+
+  // Growing the table must keep all blocks reachable.
+  std::vector<se::key_t> more;
+  for(int i = 0; i < num_keys; ++i)
+    more.push_back(map.hash(dis(gen), dis(gen), dis(gen)));
+  map.allocate(more.data(), more.size());
+  for(const se::key_t k : unique_keys) {
+    const Eigen::Vector3i c = se::keyops::decode(k);
+    ASSERT_NE(map.fetch(c(0), c(1), c(2)), nullptr);
+  }
+}
+
+TEST(HashedMapAllocation, ConcurrentInsertGrows) {
+  se::HashedMap<testT> map;
+  map.init(512, 5.f);
+  const int num_threads = 4;
+  const int per_thread = 2000;
+  std::vector<std::vector<Eigen::Vector3i> > coords(num_threads);
+  std::mt19937 gen(4);
+  std::uniform_int_distribution<int> dis(0, 511);
+  for(auto& c : coords)
+    for(int i = 0; i < per_thread; ++i)
+      c.emplace_back(dis(gen), dis(gen), dis(gen));
+
+  // Enough blocks to rehash the table several times while other threads
+  // are inserting, and allocate running alongside
+  std::vector<se::key_t> keys;
+  for(int i = 0; i < per_thread; ++i)
+    keys.push_back(map.hash(dis(gen), dis(gen), dis(gen)));
+  std::vector<std::thread> threads;
+  for(int t = 0; t < num_threads; ++t)
+    threads.emplace_back([&map, &coords, t]() {
+      for(const Eigen::Vector3i& c : coords[t])
+        ASSERT_NE(map.insert(c(0), c(1), c(2)), nullptr);
+    });
+  map.allocate(keys.data(), keys.size());
+  for(std::thread& thread : threads) thread.join();
+
+  std::vector<se::key_t> unique_keys = keys;
+  for(const auto& c : coords)
+    for(const Eigen::Vector3i& v : c)
+      unique_keys.push_back(map.hash(v(0), v(1), v(2)));
+  std::sort(unique_keys.begin(), unique_keys.end());
+  unique_keys.erase(std::unique(unique_keys.begin(), unique_keys.end()),
+      unique_keys.end());
+  ASSERT_EQ(map.leavesCount(), unique_keys.size());
+  for(const se::key_t k : unique_keys) {
+    const Eigen::Vector3i c = se::keyops::decode(k);
+    ASSERT_NE(map.fetch(c(0), c(1), c(2)), nullptr);
+  }
+}
+
+TEST_F(HashedMapTest, LoadFromOctree) {
+  const std::string filename = "hashed_map_test.bin";
+  oct_.save(filename);
+  se::HashedMap<testT> loaded;
+  loaded.load(filename);
+  ASSERT_EQ(loaded.size(), oct_.size());
+  ASSERT_EQ(loaded.dim(), oct_.dim());
+  ASSERT_EQ(loaded.leavesCount(), map_.leavesCount());
+  auto test = [&loaded](auto& handler, const Eigen::Vector3i& v) {
+    ASSERT_EQ(loaded.get(v(0), v(1), v(2)), handler.get());
+  };
+  se::functor::axis_aligned_map(map_, test);
+}
+
+TEST_F(HashedMapTest, BlockRayIterator) {
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<float> dis(-1.f, 1.f);
+  const Eigen::Vector3f centre = Eigen::Vector3f::Constant(oct_.dim() / 2);
+  size_t hits = 0;
+  for(int i = 0; i < 100; ++i) {
+    const Eigen::Vector3f origin = centre + 2.f * Eigen::Vector3f(dis(gen),
+        dis(gen), dis(gen));
+    const Eigen::Vector3f dir = (centre - origin +
+        0.2f * Eigen::Vector3f(dis(gen), dis(gen), dis(gen))).normalized();
+
+    std::vector<se::VoxelBlock<testT> *> expected;
+    se::ray_iterator<testT> oct_ray(oct_, origin, dir, 0.1f, 10.f);
+    while(se::VoxelBlock<testT> * b = oct_ray.next()) expected.push_back(b);
+
+    se::block_ray_iterator<testT, se::HashedMap> ray(map_, origin, dir, 0.1f, 10.f);
+    ASSERT_NEAR(ray.tmin(), oct_ray.tmin(), 1e-3f);
+    ASSERT_NEAR(ray.tmax(), oct_ray.tmax(), 1e-3f);
+    std::vector<se::VoxelBlock<testT> *> blocks;
+    while(se::VoxelBlock<testT> * b = ray.next()) blocks.push_back(b);
+
+    ASSERT_EQ(blocks.size(), expected.size());
+    for(size_t b = 0; b < blocks.size(); ++b)
+      ASSERT_EQ(blocks[b]->coordinates(), expected[b]->coordinates());
+    hits += blocks.size();
+  }
+  ASSERT_GT(hits, 0);
+}
+
+TEST_F(HashedMapTest, BoundedAxisAligned) {
+  auto set_to_ten = [](auto& handler, const Eigen::Vector3i&) {
+    handler.set(10.f);
+  };
+  const Eigen::Vector3i min(100, 110, 95);
+  const Eigen::Vector3i max(131, 140, 150);
+  se::functor::axis_aligned_map(oct_, set_to_ten, min, max);
+  se::functor::axis_aligned_map(map_, set_to_ten, min, max);
+
+  // Wide box, resolved by scanning the allocated blocks
+  const Eigen::Vector3i wide_min(0, 0, 120);
+  const Eigen::Vector3i wide_max(256, 256, 124);
+  se::functor::axis_aligned_map(oct_, set_to_ten, wide_min, wide_max);
+  se::functor::axis_aligned_map(map_, set_to_ten, wide_min, wide_max);
+
+  for(int z = 90; z < 160; ++z)
+    for(int y = 90; y < 160; ++y)
+      for(int x = 90; x < 160; ++x) {
+        if(!map_.fetch(x, y, z)) continue;
+        ASSERT_EQ(map_.get(x, y, z), oct_.get(x, y, z));
+      }
+  ASSERT_EQ(map_.get(110, 120, 110), 10.f);
+  ASSERT_NE(map_.get(135, 120, 110), 10.f);
+}
+
+TEST_F(HashedMapTest, Clear) {
+  const int num_blocks = map_.leavesCount();
+  ASSERT_GT(num_blocks, 0);
+  se::VoxelBlock<testT> * block = map_.getBlockBuffer()[0];
+  const Eigen::Vector3i coords = block->coordinates();
+  block->data(0, 5.f);
+
+  map_.clear();
+  ASSERT_EQ(map_.leavesCount(), 0);
+  ASSERT_EQ(map_.fetch(coords(0), coords(1), coords(2)), nullptr);
+
+  ASSERT_EQ(map_.insert(coords(0), coords(1), coords(2)), block);
+  ASSERT_EQ(block->data(0), voxel_traits<testT>::initValue());
+  ASSERT_EQ(map_.fetch(coords(0), coords(1), coords(2)), block);
+  ASSERT_EQ(map_.leavesCount(), 1);
+}
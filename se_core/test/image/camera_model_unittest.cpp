@@ -0,0 +1,77 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <cmath>
+#include <image/camera_model.hpp>
+#include "gtest/gtest.h"
+
+TEST(CameraModelTest, RaysBackProjectPixels) {
+  const Eigen::Vector4f k(525.f, 525.f, 319.5f, 239.5f);
+  const Eigen::Vector2i size(640, 480);
+  se::CameraModel camera;
+  camera.update(k, size, 3);
+  ASSERT_EQ(camera.levels(), 3);
+
+  for(int l = 0; l < camera.levels(); ++l) {
+    const Eigen::Vector4f kl = k / float(1 << l);
+    const se::Image<Eigen::Vector3f>& rays = camera.rays(l);
+    const se::Image<float>& lengths = camera.lengths(l);
+    ASSERT_EQ(rays.width(), size.x() >> l);
+    ASSERT_EQ(rays.height(), size.y() >> l);
+    for(int y = 0; y < rays.height(); y += 7) {
+      for(int x = 0; x < rays.width(); x += 5) {
+        const float depth = 2.5f;
+        const Eigen::Vector3f expected(depth * (x - kl.z()) / kl.x(), 
+            depth * (y - kl.w()) / kl.y(), depth);
+        const Eigen::Vector3f vertex = (depth * lengths(x, y)) * rays(x, y);
+        EXPECT_NEAR(rays(x, y).norm(), 1.f, 1e-6f);
+        EXPECT_NEAR((vertex - expected).norm(), 0.f, 1e-5f);
+        // Length factor used to turn depth differences into distances
+        EXPECT_NEAR(lengths(x, y), expected.norm() / depth, 1e-6f);
+      }
+    }
+  }
+}
+
+TEST(CameraModelTest, UpdateOnlyOnChange) {
+  const Eigen::Vector4f k(400.f, 400.f, 80.f, 60.f);
+  se::CameraModel camera;
+  camera.update(k, Eigen::Vector2i(160, 120), 2);
+  const Eigen::Vector3f* rays = camera.rays(0).data();
+  camera.update(k, Eigen::Vector2i(160, 120), 2);
+  EXPECT_EQ(camera.rays(0).data(), rays);
+  EXPECT_EQ(camera.intrinsics(), k);
+
+  camera.update(2.f * k, Eigen::Vector2i(320, 240), 1);
+  EXPECT_EQ(camera.levels(), 1);
+  EXPECT_EQ(camera.rays(0).width(), 320);
+  EXPECT_EQ(camera.intrinsics(), 2.f * k);
+  EXPECT_EQ(camera.size(), Eigen::Vector2i(320, 240));
+}
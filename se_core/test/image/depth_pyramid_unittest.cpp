@@ -0,0 +1,82 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <limits>
+#include <random>
+#include <image/depth_pyramid.hpp>
+#include "gtest/gtest.h"
+
+TEST(DepthPyramidTest, RangeBoundsPixels) {
+  const Eigen::Vector2i size(157, 93);
+  std::vector<float> depth(size.x() * size.y());
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dis(0.f, 4.f);
+  for(auto& d : depth) {
+    d = dis(gen);
+    if(d < 1.f) d = 0.f;
+  }
+
+  se::DepthPyramid pyramid;
+  pyramid.build(depth.data(), size);
+  ASSERT_EQ(pyramid.level(pyramid.levels() - 1).size(), 1u);
+
+  std::uniform_int_distribution<int> coord(-10, 170);
+  for(int t = 0; t < 500; ++t) {
+    Eigen::Vector2i lower(coord(gen), coord(gen));
+    Eigen::Vector2i upper = lower + Eigen::Vector2i(coord(gen), coord(gen)) / 8;
+
+    float brute_min = std::numeric_limits<float>::max();
+    float brute_max = -std::numeric_limits<float>::max();
+    for(int y = std::max(lower.y(), 0); y <= std::min(upper.y(), size.y() - 1); ++y) {
+      for(int x = std::max(lower.x(), 0); x <= std::min(upper.x(), size.x() - 1); ++x) {
+        const float d = depth[x + y * size.x()];
+        if(d <= 0.f) continue;
+        brute_min = std::min(brute_min, d);
+        brute_max = std::max(brute_max, d);
+      }
+    }
+
+    float min, max;
+    const bool valid = pyramid.range(lower, upper, min, max);
+    if(brute_min <= brute_max) {
+      ASSERT_TRUE(valid);
+      ASSERT_LE(min, brute_min);
+      ASSERT_GE(max, brute_max);
+    } else if(valid) {
+      // Tiles may extend past the rectangle, but only over valid depths
+      ASSERT_LE(min, max);
+    }
+  }
+
+  // Single pixels are exact
+  float min, max;
+  ASSERT_TRUE(pyramid.range(Eigen::Vector2i(3, 4), Eigen::Vector2i(3, 4), 
+        min, max) == (depth[3 + 4 * size.x()] > 0.f));
+}
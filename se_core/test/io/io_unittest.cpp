@@ -31,6 +31,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fstream>
 #include <string>
 #include <random>
+#include <sstream>
 #include "io/se_serialise.hpp"
 #include "node.hpp"
 #include "octree.hpp"
@@ -164,3 +165,202 @@ TEST(SerialiseUnitTest, SerialiseTree) {
   ASSERT_EQ(block_buffer_base.size(), block_buffer_copy.size());
 }
 
+
+TEST(SerialiseUnitTest, RunLengthRoundTrip) {
+  std::mt19937 gen(2);
+  std::uniform_int_distribution<> dis(0, 3);
+  std::vector<unsigned char> in;
+  for(int i = 0; i < 2000; ++i) in.push_back(dis(gen));
+  in.insert(in.end(), 1000, 7);
+  in.push_back(8);
+  in.insert(in.end(), 2, 9);
+
+  std::vector<unsigned char> encoded;
+  se::internal::rle_encode(in.data(), in.size(), encoded);
+  std::vector<unsigned char> out(in.size());
+  const unsigned char * ptr = encoded.data();
+  ASSERT_TRUE(se::internal::rle_decode(ptr, encoded.data() + encoded.size(), 
+        out.data(), out.size()));
+  ASSERT_EQ(ptr, encoded.data() + encoded.size());
+  ASSERT_TRUE(in == out);
+
+  // Truncated input is rejected
+  ptr = encoded.data();
+  ASSERT_FALSE(se::internal::rle_decode(ptr, 
+        encoded.data() + encoded.size() - 1, out.data(), out.size()));
+}
+
+TEST(SerialiseUnitTest, SerialiseTreeData) {
+  se::Octree<Occupancy> tree;
+  tree.init(512, 5.12f);
+  const int side = se::VoxelBlock<Occupancy>::side;
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<> dis(0, 511);
+  std::uniform_real_distribution<float> val(-1.f, 1.f);
+  // Enough blocks for several chunks, filled with smooth and noisy data
+  for(size_t i = 0; i < 3 * se::internal::block_chunk_size; ++i) {
+    se::VoxelBlock<Occupancy> * block = tree.insert(dis(gen), dis(gen), 
+        dis(gen));
+    const float noise = i % 2 ? val(gen) : 0.f;
+    for(int v = 0; v < side * side * side; ++v)
+      block->data(v, {v * 0.01f + noise * val(gen), double(i)});
+  }
+  std::string filename = "octree-data-test.bin";
+  tree.save(filename);
+
+  se::Octree<Occupancy> tree_copy;
+  tree_copy.load(filename);
+  ASSERT_EQ(tree_copy.size(), tree.size());
+  ASSERT_EQ(tree_copy.dim(), tree.dim());
+
+  auto& nodes = tree.getNodesBuffer();
+  auto& nodes_copy = tree_copy.getNodesBuffer();
+  ASSERT_EQ(nodes.size(), nodes_copy.size());
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    ASSERT_EQ(nodes[i]->code_, nodes_copy[i]->code_);
+    ASSERT_EQ(nodes[i]->side_, nodes_copy[i]->side_);
+    ASSERT_EQ(nodes[i]->children_mask_, nodes_copy[i]->children_mask_);
+  }
+
+  auto& blocks = tree.getBlockBuffer();
+  auto& blocks_copy = tree_copy.getBlockBuffer();
+  ASSERT_EQ(blocks.size(), blocks_copy.size());
+  for(size_t i = 0; i < blocks.size(); ++i) {
+    ASSERT_EQ(blocks[i]->code_, blocks_copy[i]->code_);
+    ASSERT_TRUE(blocks[i]->coordinates() == blocks_copy[i]->coordinates());
+    ASSERT_EQ(tree_copy.fetch(blocks[i]->coordinates()(0), 
+          blocks[i]->coordinates()(1), blocks[i]->coordinates()(2)), 
+        blocks_copy[i]);
+    for(int v = 0; v < side * side * side; ++v) {
+      ASSERT_EQ(blocks[i]->data(v).x, blocks_copy[i]->data(v).x);
+      ASSERT_EQ(blocks[i]->data(v).y, blocks_copy[i]->data(v).y);
+    }
+  }
+}
+
+TEST(SerialiseUnitTest, LoadUncompressedTree) {
+  se::Octree<testT> tree;
+  tree.init(256, 2.56f);
+  se::VoxelBlock<testT> * block = tree.insert(100, 20, 30);
+  block->data(5, 3.f);
+
+  // Layout written by save before blocks were encoded in chunks
+  std::string filename = "octree-legacy-test.bin";
+  {
+    std::ofstream os(filename, std::ios::binary);
+    int size = tree.size();
+    float dim = tree.dim();
+    os.write(reinterpret_cast<char *>(&size), sizeof(size));
+    os.write(reinterpret_cast<char *>(&dim), sizeof(dim));
+    auto& nodes = tree.getNodesBuffer();
+    size_t n = nodes.size();
+    os.write(reinterpret_cast<char *>(&n), sizeof(size_t));
+    for(size_t i = 0; i < n; ++i) se::internal::serialise(os, *nodes[i]);
+    auto& blocks = tree.getBlockBuffer();
+    n = blocks.size();
+    os.write(reinterpret_cast<char *>(&n), sizeof(size_t));
+    for(size_t i = 0; i < n; ++i) se::internal::serialise(os, *blocks[i]);
+  }
+
+  se::Octree<testT> tree_copy;
+  tree_copy.load(filename);
+  ASSERT_EQ(tree_copy.size(), 256);
+  ASSERT_EQ(tree_copy.getBlockBuffer().size(), 1u);
+  ASSERT_EQ(tree_copy.fetch(100, 20, 30)->data(5), 3.f);
+}
+
+TEST(SerialiseUnitTest, SerialiseTreeToStream) {
+  se::Octree<testT> tree;
+  tree.init(256, 2.56f);
+  tree.insert(100, 20, 30)->data(5, 3.f);
+  tree.insert(200, 120, 10)->data(7, 4.f);
+
+  // Maps can be embedded in other files, loading starts where they start
+  std::stringstream stream;
+  const int header = 42;
+  stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  tree.save(stream);
+  stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  int value = 0;
+  stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+  se::Octree<testT> tree_copy;
+  ASSERT_TRUE(tree_copy.load(stream));
+  stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+  ASSERT_EQ(value, header);
+  ASSERT_EQ(tree_copy.getBlockBuffer().size(), 2u);
+  ASSERT_EQ(tree_copy.fetch(100, 20, 30)->data(5), 3.f);
+  ASSERT_EQ(tree_copy.fetch(200, 120, 10)->data(7), 4.f);
+
+  // Truncated data is reported
+  std::stringstream truncated(stream.str().substr(0, 100));
+  truncated.read(reinterpret_cast<char *>(&value), sizeof(value));
+  se::Octree<testT> tree_bad;
+  ASSERT_FALSE(tree_bad.load(truncated));
+}
+
+TEST(SerialiseUnitTest, SaveSnapshot) {
+  se::Octree<testT> tree;
+  tree.init(256, 2.56f);
+  tree.insert(100, 20, 30)->data(5, 3.f);
+  tree.insert(200, 120, 10)->data(7, 4.f);
+  std::stringstream saved;
+  tree.save(saved);
+
+  // The snapshot keeps the contents at the time it was taken
+  se::MapSnapshot<testT> snapshot;
+  tree.snapshot(snapshot);
+  tree.fetch(100, 20, 30)->data(5, 8.f);
+  tree.insert(10, 220, 130)->data(1, 2.f);
+  std::stringstream snapshot_saved;
+  snapshot.save(snapshot_saved);
+  ASSERT_EQ(snapshot_saved.str(), saved.str());
+
+  se::Octree<testT> tree_copy;
+  ASSERT_TRUE(tree_copy.load(snapshot_saved));
+  ASSERT_EQ(tree_copy.getBlockBuffer().size(), 2u);
+  ASSERT_EQ(tree_copy.fetch(100, 20, 30)->data(5), 3.f);
+
+  // Taking a smaller snapshot into the same buffers
+  se::Octree<testT> small;
+  small.init(256, 2.56f);
+  small.insert(100, 20, 30)->data(5, 1.f);
+  std::stringstream small_saved, small_snapshot_saved;
+  small.save(small_saved);
+  small.snapshot(snapshot);
+  snapshot.save(small_snapshot_saved);
+  ASSERT_EQ(small_snapshot_saved.str(), small_saved.str());
+}
+
+TEST(SerialiseUnitTest, LoadCorruptCounts) {
+  se::Octree<testT> tree;
+  tree.init(256, 2.56f);
+  tree.insert(100, 20, 30)->data(5, 3.f);
+  tree.insert(200, 120, 10)->data(7, 4.f);
+  std::stringstream stream;
+  tree.save(stream);
+  const std::string data = stream.str();
+
+  // Tag and version, size, dim, node count and records, then the block
+  // count, the chunk size and the chunk lengths
+  const size_t blocks_offset = 2 * sizeof(uint32_t) + sizeof(int) + 
+    sizeof(float) + sizeof(size_t) + tree.getNodesBuffer().size() * 
+    se::internal::node_record_size<testT>();
+  const size_t lengths_offset = blocks_offset + 2 * sizeof(size_t);
+  auto corrupt = [&data](size_t offset, uint64_t value) {
+    std::string bad = data;
+    std::memcpy(&bad[offset], &value, sizeof(value));
+    std::stringstream bad_stream(bad);
+    se::Octree<testT> bad_tree;
+    return bad_tree.load(bad_stream);
+  };
+  ASSERT_TRUE(corrupt(lengths_offset, 
+        data.size() - lengths_offset - sizeof(uint64_t)));
+  ASSERT_FALSE(corrupt(2 * sizeof(uint32_t) + sizeof(int) + sizeof(float), 
+        uint64_t(1) << 60));
+  ASSERT_FALSE(corrupt(blocks_offset, uint64_t(1) << 60));
+  ASSERT_FALSE(corrupt(blocks_offset, data.size()));
+  ASSERT_FALSE(corrupt(blocks_offset + sizeof(size_t), 1));
+  ASSERT_FALSE(corrupt(lengths_offset, ~uint64_t(0)));
+  ASSERT_FALSE(corrupt(lengths_offset, data.size()));
+}
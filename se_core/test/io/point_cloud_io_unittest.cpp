@@ -0,0 +1,91 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <fstream>
+#include <string>
+#include <vector>
+#include "io/point_cloud_io.hpp"
+#include "gtest/gtest.h"
+
+class PointCloudIOTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      for(int i = 0; i < 10; ++i) {
+        points_.push_back(Eigen::Vector3f(i, 2.f * i, -0.5f * i));
+        normals_.push_back(Eigen::Vector3f::Unit(i % 3));
+      }
+    }
+
+    void expect_data(std::istream& is) {
+      for(size_t i = 0; i < points_.size(); ++i) {
+        float data[6];
+        is.read(reinterpret_cast<char *>(data), sizeof(data));
+        ASSERT_TRUE(bool(is));
+        for(int j = 0; j < 3; ++j) {
+          ASSERT_EQ(data[j], points_[i](j));
+          ASSERT_EQ(data[3 + j], normals_[i](j));
+        }
+      }
+      is.peek();
+      ASSERT_TRUE(is.eof());
+    }
+
+  std::vector<Eigen::Vector3f> points_;
+  std::vector<Eigen::Vector3f> normals_;
+};
+
+TEST_F(PointCloudIOTest, WriteReadPLY) {
+  const std::string filename = "test-points.ply";
+  ASSERT_TRUE(se::save_point_cloud_ply(filename, points_, normals_));
+
+  std::ifstream is(filename, std::ios::binary);
+  std::string line;
+  std::vector<std::string> header;
+  while(std::getline(is, line) && line != "end_header")
+    header.push_back(line);
+  ASSERT_EQ(line, "end_header");
+  ASSERT_EQ(header[0], "ply");
+  ASSERT_EQ(header[1], "format binary_little_endian 1.0");
+  ASSERT_EQ(header[2], "element vertex 10");
+  ASSERT_EQ(header.size(), 9u);
+  expect_data(is);
+}
+
+TEST_F(PointCloudIOTest, WriteReadRaw) {
+  const std::string filename = "test-points.raw";
+  ASSERT_TRUE(se::save_point_cloud_raw(filename, points_, normals_));
+  std::ifstream is(filename, std::ios::binary);
+  expect_data(is);
+}
+
+TEST_F(PointCloudIOTest, UnwritableFile) {
+  ASSERT_FALSE(se::save_point_cloud_ply("/nonexistent/points.ply", points_, 
+        normals_));
+}
@@ -0,0 +1,150 @@
+/*
+
+Copyright 2016 Emanuele Vespa, Imperial College London
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "octree.hpp"
+#include "utils/scratch_arena.hpp"
+#include "algorithms/filter.hpp"
+#include "functors/projective_functor.hpp"
+#include "gtest/gtest.h"
+
+// Allocation-counting hook: every global operator new is recorded, so that
+// tests can assert the absence of heap allocations in steady state.
+static std::atomic<long> num_allocations(0);
+
+void * operator new(size_t size) {
+  num_allocations++;
+  void * ptr = std::malloc(size ? size : 1);
+  if(!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete(void * ptr) noexcept { std::free(ptr); }
+void operator delete[](void * ptr) noexcept { std::free(ptr); }
+void operator delete(void * ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void * ptr, size_t) noexcept { std::free(ptr); }
+
+typedef float testT;
+template <>
+struct voxel_traits<testT> {
+  typedef float value_type;
+  static inline value_type empty(){ return 0.f; }
+  static inline value_type initValue(){ return 1.f; }
+};
+
+TEST(ScratchArenaTest, GrowsToPeakUsage) {
+  se::ScratchArena arena(64);
+  for(int frame = 0; frame < 3; ++frame) {
+    const long before = num_allocations;
+    int * a = arena.allocate<int>(100);
+    double * b = arena.allocate<double>(50);
+    char * c = arena.allocate<char>(3);
+    float * d = arena.allocate<float>(10);
+    ASSERT_EQ(reinterpret_cast<size_t>(b) % alignof(double), 0);
+    ASSERT_EQ(reinterpret_cast<size_t>(d) % alignof(float), 0);
+    for(int i = 0; i < 100; ++i) a[i] = i;
+    for(int i = 0; i < 50; ++i) b[i] = i;
+    c[2] = 'c';
+    ASSERT_EQ(a[99], 99);
+    if(frame > 0) {
+      ASSERT_EQ(num_allocations - before, 0);
+    }
+    arena.reset();
+    ASSERT_EQ(arena.used(), 0);
+  }
+  ASSERT_GE(arena.capacity(), 100*sizeof(int) + 50*sizeof(double));
+}
+
+class SteadyStateTest : public ::testing::Test {
+  protected:
+    virtual void SetUp() {
+      oct_.init(256, 2.56f);
+      std::vector<se::key_t> alloc_list;
+      for(int z = 0; z < 256; z += 32) {
+        for(int y = 0; y < 256; y += 32) {
+          for(int x = 0; x < 256; x += 32) {
+            alloc_list.push_back(oct_.hash(x, y, z));
+          }
+        }
+      }
+      oct_.allocate(alloc_list.data(), alloc_list.size());
+    }
+
+  se::Octree<testT> oct_;
+};
+
+TEST_F(SteadyStateTest, Filter) {
+  se::ScratchArena arena;
+  auto is_even = [](const se::VoxelBlock<testT> * b) { 
+    return (b->coordinates()(0) / 32) % 2 == 0; 
+  };
+  for(int frame = 0; frame < 3; ++frame) {
+    const long before = num_allocations;
+    se::scratch_vector<se::VoxelBlock<testT> *> 
+      out((se::ScratchAllocator<se::VoxelBlock<testT> *>(arena)));
+    se::algorithms::filter(out, oct_.getBlockBuffer(), is_even);
+    ASSERT_EQ(out.size(), oct_.getBlockBuffer().size() / 2);
+    if(frame > 0) {
+      ASSERT_EQ(num_allocations - before, 0);
+    }
+    arena.reset();
+  }
+}
+
+TEST_F(SteadyStateTest, ProjectiveMap) {
+  se::ScratchArena arena;
+  Eigen::Matrix4f K = Eigen::Matrix4f::Identity();
+  K(0, 0) = K(1, 1) = 100.f;
+  K(0, 2) = 80.f;
+  K(1, 2) = 60.f;
+  Eigen::Matrix4f Twc = Eigen::Matrix4f::Identity();
+  Twc.topRightCorner<3, 1>() = Eigen::Vector3f(1.28f, 1.28f, -1.f);
+  const Sophus::SE3f Tcw = Sophus::SE3f(Twc).inverse();
+  std::atomic<int> updated(0);
+  auto update = [&updated](auto& handler, const Eigen::Vector3i&, 
+      const Eigen::Vector3f&, const Eigen::Vector2f&) {
+    handler.set(2.f);
+    updated++;
+  };
+
+  for(int frame = 0; frame < 3; ++frame) {
+    const long before = num_allocations;
+    se::functor::projective_map(oct_, Tcw, K, Eigen::Vector2i(160, 120), 
+        update, arena);
+    if(frame > 0) {
+      ASSERT_EQ(num_allocations - before, 0);
+    }
+    arena.reset();
+  }
+  ASSERT_GT(updated, 0);
+}
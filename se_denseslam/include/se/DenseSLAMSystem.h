@@ -37,13 +37,18 @@
 
 #include <cstdlib>
 #include <se/commons.h>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <perfstats.h>
 #include <timings.h>
 #include <se/config.h>
 #include <se/octree.hpp>
+#include <se/hashed_map.hpp>
 #include <se/image/image.hpp>
+#include <se/image/depth_pyramid.hpp>
+#include <se/image/camera_model.hpp>
+#include <se/utils/scratch_arena.hpp>
 #include "volume_traits.hpp"
 #include "continuous/volume_template.hpp"
 #include <Eigen/Dense>
@@ -52,8 +57,68 @@
  * Use SE_FIELD_TYPE macro to define the DenseSLAMSystem instance.
  */
 typedef SE_FIELD_TYPE FieldType;
+
+/*
+ * Use SE_MAP_TYPE macro to select the map backend (se::Octree or
+ * se::HashedMap). Defaults to the octree.
+ */
+#ifndef SE_MAP_TYPE
+#define SE_MAP_TYPE se::Octree
+#endif
+template <typename T>
+using DiscreteMap = SE_MAP_TYPE<T>;
 template <typename T>
-using Volume = VolumeTemplate<T, se::Octree>;
+using Volume = VolumeTemplate<T, DiscreteMap>;
+
+/**
+ * A depth frame from one of the cameras of a rig, ready for integration.
+ */
+struct DepthView {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  /** Depth in metres, row major. */
+  const float* depth;
+  /** Width and height of the depth frame in pixels. */
+  Eigen::Vector2i size;
+  /** Intrinsic camera parameters. See ::Configuration.camera for details. */
+  Eigen::Vector4f k;
+  /** Camera to world transformation. */
+  Eigen::Matrix4f pose;
+};
+typedef std::vector<DepthView, Eigen::aligned_allocator<DepthView> > 
+  DepthViews;
+
+/**
+ * A virtual camera for which to render the depth predicted by the map.
+ */
+struct VirtualCamera {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  /** Camera to world transformation. */
+  Eigen::Matrix4f pose;
+  /** Intrinsic camera parameters. See ::Configuration.camera for details. */
+  Eigen::Vector4f k;
+  /** Width and height of the rendered images in pixels. */
+  Eigen::Vector2i size;
+};
+typedef std::vector<VirtualCamera, Eigen::aligned_allocator<VirtualCamera> >
+  VirtualCameras;
+
+/**
+ * Measurements behind the integration gating decision of the last frame and
+ * running counters. See ::Configuration.integration_gating.
+ */
+struct GatingStats {
+  /** Camera translation since the last integrated frame, in metres. */
+  float translation = 0.f;
+  /** Camera rotation since the last integrated frame, in radians. */
+  float rotation = 0.f;
+  /** Blocks allocated by the frame over the active blocks it touches. */
+  float new_blocks = 0.f;
+  /** ICP RMS residual of the frame in metres, negative if not tracked. */
+  float residual = -1.f;
+  /** Number of frames integrated and skipped as redundant so far. */
+  unsigned int integrated = 0;
+  unsigned int skipped = 0;
+};
 
 class DenseSLAMSystem {
 
@@ -64,6 +129,9 @@ class DenseSLAMSystem {
     Eigen::Vector3f volume_dimension_;
     Eigen::Vector3i volume_resolution_;
     std::vector<int> iterations_;
+    // The iterations per level the pipeline was constructed with, before
+    // any adaptation, see checkpoint()
+    std::vector<int> configured_iterations_;
     bool tracked_;
     bool integrated_;
     Eigen::Vector3f init_pose_;
@@ -79,7 +147,7 @@ class DenseSLAMSystem {
     se::Image<Eigen::Vector3f> normal_;
 
     std::vector<se::key_t> allocation_list_;
-    std::shared_ptr<se::Octree<FieldType> > discrete_vol_ptr_;
+    std::shared_ptr<DiscreteMap<FieldType> > discrete_vol_ptr_;
     Volume<FieldType> volume_;
 
     // intra-frame
@@ -87,11 +155,72 @@ class DenseSLAMSystem {
     std::vector<se::Image<float>  > scaled_depth_;
     std::vector<se::Image<Eigen::Vector3f> > input_vertex_;
     std::vector<se::Image<Eigen::Vector3f> > input_normal_;
+    // Per-pixel rays of every scaled_depth_ level, shared by all kernels
+    se::CameraModel camera_;
+    // Ranges of the points of the last integrated point cloud
+    std::vector<float> scan_ranges_;
+    // Linear indices of the valid pixels of every scaled_depth_ level
+    std::vector<std::vector<int> > valid_pixels_;
     se::Image<float> float_depth_;
+    // Depth range pyramid of float_depth_, culls blocks in integration
+    se::DepthPyramid depth_pyramid_;
     std::vector<TrackData>  tracking_result_;
+    // Per-frame temporaries, reset at every integration
+    se::ScratchArena scratch_;
+
+    // Integration gating state. tracking_frame_ is the last frame whose ICP
+    // residuals are in reduction_output_.
+    Eigen::Matrix4f last_integrated_pose_;
+    int tracking_frame_;
+    GatingStats gating_stats_;
+    bool isRedundant(unsigned int frame, size_t blocks_before);
+
+    // Frames queued for batched integration with their depth pyramids and
+    // valid pixels. Buffers are reused across batches, only the first
+    // batch_size_ entries are valid.
+    std::vector<se::Image<float> > batch_depth_;
+    std::vector<se::DepthPyramid> batch_pyramids_;
+    std::vector<std::vector<int> > batch_pixels_;
+    DepthViews batch_views_;
+    std::vector<unsigned> batch_frames_;
+    size_t batch_size_;
+
+    // Updates the allocated blocks from views[0, count) in order, frame[i]
+    // being the index of the frame of views[i]. Each block is traversed once
+    // and culled against pyramids[i] for view i unless pyramids is null.
+    void updateViews(const DepthView* views, const unsigned* frames,
+        const se::DepthPyramid* pyramids, size_t count, float mu);
+
     Eigen::Matrix4f old_pose_;
     Eigen::Matrix4f raycast_pose_;
 
+    // Bumped whenever the map changes. raycast_version_ is the map version
+    // vertex_ and normal_ were raycast from, so that raycasting an unchanged
+    // map keeps the cached render.
+    unsigned int map_version_;
+    unsigned int raycast_version_;
+    // Last volume render, valid for render_view_ and render_size_ at
+    // render_version_, and at render_raycast_version_ if it was shaded from
+    // the raycast model. Free viewpoint renders are refined progressively:
+    // render_stride_ is the lattice stride rendered so far, 1 once complete
+    // and 0 when nothing is cached. render_depth_ holds the lattice depths.
+    Eigen::Matrix4f render_view_;
+    Eigen::Vector2i render_size_;
+    unsigned int render_version_;
+    unsigned int render_raycast_version_;
+    int render_stride_;
+    std::vector<unsigned char> render_image_;
+    std::vector<float> render_depth_;
+
+    // Background write of the last checkpoint, see checkpoint()
+    std::future<bool> checkpoint_writer_;
+    // Copy of the map encoded by the writer, reused by the next checkpoint
+    std::shared_ptr<se::MapSnapshot<FieldType> > checkpoint_snapshot_;
+    // Ray tables of the virtual cameras of renderExpectedDepth, one per
+    // distinct intrinsics and size
+    std::vector<se::CameraModel, Eigen::aligned_allocator<se::CameraModel> >
+      virtual_models_;
+
   public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
     
@@ -189,12 +318,89 @@ class DenseSLAMSystem {
      * \param[in] frame The index of the current frame (starts from 0).
      * \return true if the current 3D reconstruction was added to the octree
      * and false if it wasn't.
+     *
+     * @note With ::Configuration.integration_gating set, a frame that adds
+     * no new information is allocated but not integrated. See
+     * getGatingStats().
      */
     bool integration(const Eigen::Vector4f& k,
                      unsigned               integration_rate,
                      float                  mu,
                      unsigned               frame);
 
+    /**
+     * Integrate the depth frames of several cameras, e.g. those of a rig, in
+     * a single step. The blocks to allocate are collected from all views at
+     * once and each visible block is traversed only once, with its voxels
+     * updated from every camera whose frustum intersects it.
+     *
+     * \param[in] views The depth frame, intrinsics and pose of each camera.
+     * Blocks are traversed once per group of up to 32 views, larger rigs
+     * take several traversals.
+     * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
+     * details.
+     * \param[in] frame The index of the current frame (starts from 0).
+     * \return true (does not fail).
+     */
+    bool integration(const DepthViews& views,
+                     float             mu,
+                     unsigned          frame);
+
+    /**
+     * Queue the current depth frame and camera pose for batched integration,
+     * meant for offline reconstruction with known poses. The queued frames
+     * are integrated by flushIntegration(): their blocks are allocated frame
+     * by frame, then every block is traversed once for up to 32 frames,
+     * which update it in frame order while it is in cache. Each frame keeps
+     * culling the blocks away from its own depths. The queue is flushed
+     * automatically once batch_size frames are queued.
+     *
+     * @note Tracking and raycasting see the map as of the last flush.
+     * Integration gating, block skipping and multi-resolution integration
+     * do not apply to queued frames.
+     *
+     * \param[in] k The intrinsic camera parameters. See
+     * ::Configuration.camera for details.
+     * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
+     * details.
+     * \param[in] frame The index of the current frame (starts from 0).
+     * \param[in] batch_size Number of frames integrated at once.
+     * \return true if the queue was flushed.
+     */
+    bool queueIntegration(const Eigen::Vector4f& k,
+                          float                  mu,
+                          unsigned               frame,
+                          unsigned               batch_size);
+
+    /**
+     * Integrate all the frames queued by queueIntegration().
+     *
+     * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
+     * details.
+     * \return true if any frame was integrated.
+     */
+    bool flushIntegration(float mu);
+
+    /**
+     * Integrate a point cloud, e.g. a LiDAR scan, without going through a
+     * depth image. Every point is integrated along the ray from its sensor
+     * origin with the same update as a depth measurement of the same range.
+     * The blocks around the points are allocated as in integration().
+     *
+     * \param[in] points The measured points in the map frame, in meters.
+     * \param[in] origins The sensor origin of each point, in the map frame.
+     * \param[in] num_points The number of points.
+     * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
+     * details.
+     * \param[in] frame The index of the current frame (starts from 0).
+     * \return true (does not fail).
+     */
+    bool integratePointCloud(const Eigen::Vector3f* points,
+                             const Eigen::Vector3f* origins,
+                             size_t                 num_points,
+                             float                  mu,
+                             unsigned               frame);
+
     /**
      * Raycast the 3D reconstruction after integration to update the values of
      * the TSDF. This is the fourth stage of the pipeline.
@@ -224,7 +430,75 @@ class DenseSLAMSystem {
     void dump_mesh(const std::string filename);
 
     /**
-     * Render the current 3D reconstruction.
+     * Write the points where the reconstructed surface crosses the edges
+     * between observed voxels, with their normals. Blocks are processed in
+     * parallel.
+     *
+     * \param[in] filename The output file, written as binary PLY if it ends
+     * in .ply and as a raw stream of x y z nx ny nz floats otherwise.
+     * \return The number of points written, or -1 if the file could not be
+     * written.
+     */
+    long dump_point_cloud(const std::string& filename);
+
+    /**
+     * Checkpoint the pipeline so that it can resume tracking from the next
+     * frame after a restart: the map, the camera, raycast and last
+     * integrated poses, the raycast vertex and normal maps, the
+     * integration gating state and the options they depend on. The state and
+     * the voxel blocks are copied before returning, so the caller is blocked
+     * only for a copy of the block pool. The map is then encoded and the
+     * file written in the background, first to filename.tmp and renamed
+     * once complete so that an interrupted write never replaces the
+     * previous checkpoint. Frames queued by queueIntegration() are flushed
+     * first.
+     *
+     * \param[in] filename The checkpoint file.
+     * \param[in] frame The index of the next frame to be processed.
+     * \return false if the previous checkpoint is still being written, in
+     * which case nothing is done.
+     */
+    bool checkpoint(const std::string& filename, unsigned int frame);
+
+    /**
+     * Wait for the checkpoint being written in the background, if any.
+     *
+     * \return false if the last checkpoint could not be written.
+     */
+    bool waitCheckpoint();
+
+    /**
+     * Restore a checkpoint written by checkpoint(), replacing the map and
+     * the tracking state. The pipeline must have been constructed with the
+     * same computation size, volume resolution and size, pyramid iterations
+     * per level and field type, and with the same mapping, tracking and
+     * gating options, e.g. mu and icp_threshold. The iterations as adapted
+     * at the time of the checkpoint are then restored.
+     *
+     * \param[in] filename The checkpoint file.
+     * \param[out] frame The index of the next frame to be processed.
+     * \return false, leaving the pipeline unchanged, if the file could not
+     * be read or does not match this pipeline.
+     */
+    bool restore(const std::string& filename, unsigned int& frame);
+
+    /**
+     * Start a new session: empty the map and restore the tracking state of
+     * a newly constructed pipeline. The memory of the map and of all the
+     * buffers is kept, so the new session runs at full speed from its first
+     * frame.
+     *
+     * \param[in] initPose The initial camera pose, as passed to the
+     * constructor.
+     */
+    void reset(const Eigen::Matrix4f& initPose);
+
+    /**
+     * Render the current 3D reconstruction. The render is cached until the
+     * view pose or the map change. Views other than the tracking camera are
+     * first rendered every ::Configuration.render_downsample pixels and
+     * upsampled, then refined by the following calls until they reach full
+     * resolution.
      *
      * \param[out] out A pointer to an array containing the rendered frame.
      * The array must be allocated before calling this function. The storage
@@ -237,8 +511,9 @@ class DenseSLAMSystem {
      * ::Configuration.camera for details.
      * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
      * details.
+     * \return true if out was written, false on the frames skipped by rate.
      */
-    void renderVolume(unsigned char*         out,
+    bool renderVolume(unsigned char*         out,
                       const Eigen::Vector2i& outputSize,
                       int                    frame,
                       int                    rate,
@@ -285,6 +560,27 @@ class DenseSLAMSystem {
     void renderDepth(unsigned char*         out,
                      const Eigen::Vector2i& outputSize);
 
+    /**
+     * Render the depth predicted by the map for a batch of virtual cameras,
+     * e.g. to evaluate candidate viewpoints. The map is only read. The rows
+     * of all the cameras are raycast in a single parallel pass, and cameras
+     * with the same intrinsics and size share their ray tables, which are
+     * kept across calls.
+     *
+     * \param[in] cameras The cameras to render, of any pose, intrinsics and
+     * size.
+     * \param[out] depths The depth along the optical axis in metres for each
+     * camera, 0 where no surface is visible.
+     * \param[out] masks The visibility of each camera, 1 where a surface is
+     * visible and 0 elsewhere.
+     * \param[in] mu TSDF truncation bound. See ::Configuration.mu for more
+     * details.
+     */
+    void renderExpectedDepth(const VirtualCameras&            cameras,
+                             std::vector<se::Image<float> >&         depths,
+                             std::vector<se::Image<unsigned char> >& masks,
+                             float                            mu);
+
     //
     // Getters
     //
@@ -292,7 +588,7 @@ class DenseSLAMSystem {
     /*
      * TODO Document this.
      */
-    void getMap(std::shared_ptr<se::Octree<FieldType> >& out) {
+    void getMap(std::shared_ptr<DiscreteMap<FieldType> >& out) {
       out = discrete_vol_ptr_;
     }
 
@@ -310,6 +606,14 @@ class DenseSLAMSystem {
       return (integrated_);
     }
 
+    /**
+     * Get the integration gating measurements of the last integrated or
+     * skipped frame, and the gating counters.
+     */
+    const GatingStats& getGatingStats() const {
+      return gating_stats_;
+    }
+
     /**
      * Get the current camera position.
      *
@@ -355,6 +659,19 @@ class DenseSLAMSystem {
       pose_.block<3,1>(0,3) += init_pose_;
     }
 
+    /**
+     * Set the number of ICP iterations performed at each pyramid level.
+     *
+     * @note The number of pyramid levels is fixed at construction, only the
+     * iteration counts can be changed.
+     *
+     * \param[in] iterations The iterations per level, finest level first.
+     */
+    void setIterations(const std::vector<int>& iterations) {
+      assert(iterations.size() == iterations_.size());
+      iterations_ = iterations;
+    }
+
     /**
      * Set the camera pose used to render the 3D reconstruction.
      *
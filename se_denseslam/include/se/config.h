@@ -103,6 +103,14 @@ struct Configuration {
    */
   std::string dump_volume_file;
 
+  /**
+   * File to write the surface points of the final map to, with their
+   * normals. Files ending in .ply are written as binary PLY, any other name
+   * as a raw stream of x y z nx ny nz floats.
+   * <br>\em Default: ""
+   */
+  std::string dump_point_cloud_file;
+
   /*
    * TODO
    * <br>\em Default: ""
@@ -136,6 +144,119 @@ struct Configuration {
    */
   Eigen::Matrix4f gt_transform;
 
+  /**
+   * The path to a text file where the estimated camera pose of every frame
+   * is written, in the same format as ::Configuration.groundtruth_file. The
+   * positions are relative to the initial pose, so the file can be replayed
+   * as a ground truth file to repeat the mapping without tracking.
+   * <br>\em Default: ""
+   */
+  std::string trajectory_file;
+
+  /**
+   * Whether to raycast the reconstruction when replaying poses from a ground
+   * truth file. Raycasting is only needed for tracking, so it is skipped by
+   * default when the poses are known.
+   * <br>\em Default: false
+   */
+  bool replay_raycast;
+
+  /**
+   * Number of frames queued before they are integrated together, each block
+   * being traversed once per batch, see DenseSLAMSystem::queueIntegration().
+   * Meant for replaying ground truth poses, as tracking only sees the map as
+   * of the last batch. 0 integrates every frame on its own.
+   * <br>\em Default: 0
+   */
+  unsigned int integration_batch;
+
+  /**
+   * The target computation time per frame in milliseconds. When non-zero,
+   * the integration rate, rendering rate and ICP iterations are adapted at
+   * runtime to hold it, never going above the configured quality.
+   * <br>\em Default: 0
+   */
+  float frame_budget;
+
+  /**
+   * Whether to skip the integration of redundant frames. A frame is redundant
+   * when the camera moved less than gating_translation and gating_rotation
+   * since the last integrated frame, its new blocks make up less than a
+   * gating_new_blocks fraction of the blocks in view and, if it was tracked,
+   * its ICP RMS residual is below gating_residual. Frames that were not
+   * tracked, e.g. with replayed poses, have no residual and are judged on
+   * the other criteria alone.
+   * <br>\em Default: false
+   */
+  bool integration_gating;
+
+  /**
+   * Integration gating thresholds: translation in metres, rotation in
+   * radians, fraction of newly allocated blocks and ICP RMS residual in
+   * metres.
+   * <br>\em Default: 0.02, 0.035, 0.01, 0.01
+   */
+  float gating_translation;
+  float gating_rotation;
+  float gating_new_blocks;
+  float gating_residual;
+
+  /**
+   * Number of consecutive integrations without significant change after
+   * which a block is considered converged, 0 disables block skipping.
+   * Converged blocks are integrated only once every revisit_period frames,
+   * and they are re-enabled as soon as a measurement disagrees with them.
+   * <br>\em Default: 0, 4
+   */
+  unsigned int converged_visits;
+  unsigned int revisit_period;
+
+  /**
+   * Depth in metres beyond which SDF blocks are updated at half resolution,
+   * doubling it once more for every further scale up to multires_scales.
+   * Coarse updates only touch every 2^s-th voxel of a block and interpolate
+   * the rest. 0 disables multi-resolution integration.
+   * <br>\em Default: 0, 2
+   */
+  float multires_distance;
+  unsigned int multires_scales;
+
+  /**
+   * Whether to estimate the normals of the raycast model from neighbouring
+   * raycast vertices, like the input normals, instead of from the gradient
+   * of the volume at every hit.
+   * <br>\em Default: false
+   */
+  bool image_normals;
+
+  /**
+   * Pixel stride of the first render of a view other than the tracking
+   * camera, a power of two. The following renders of an unchanged view and
+   * map halve it until the full resolution is reached, 1 always renders at
+   * full resolution.
+   * <br>\em Default: 4
+   */
+  int render_downsample;
+
+  /**
+   * File the pipeline is checkpointed to every checkpoint_rate frames and,
+   * when it exists at start-up, restored from, skipping the frames it
+   * already holds. Empty disables checkpointing.
+   * <br>\em Default: "", 100
+   */
+  std::string checkpoint_file;
+  int checkpoint_rate;
+
+  /**
+   * Directory the depth, track and volume renders of every frame are
+   * written to as numbered PNGs by background threads. Frames are dropped
+   * when the writers fall behind. With dump_frames_raw the PNGs are stored
+   * uncompressed. Empty disables dumping.
+   * <br>\em Default: "", false
+   */
+  std::string dump_frames_dir;
+  bool dump_frames_raw;
+
   /**
    * The intrinsic camera parameters. camera.x, camera.y, camera.z and
    * camera.w are the x-axis focal length, y-axis focal length, horizontal
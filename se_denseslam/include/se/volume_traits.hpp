@@ -48,6 +48,13 @@ struct voxel_traits<SDF> {
   typedef SDF value_type;
   static inline value_type empty(){ return {1.f, -1.f}; }
   static inline value_type initValue(){ return {1.f, 0.f}; }
+  // Used to fill blocks updated at a coarse scale. The weight is the lowest
+  // of the two, so voxels next to unobserved ones stay unobserved.
+  static inline value_type interpolate(const value_type& a, 
+      const value_type& b, const float t) {
+    return {se::math::clamp(a.x + t * (b.x - a.x), -1.f, 1.f), 
+      fminf(a.y, b.y)};
+  }
 };
 
 /******************************************************************************
@@ -80,4 +87,11 @@ struct voxel_traits<OFusion> {
 #define TOP_CLAMP     1000.f
 #define BOTTOM_CLAMP  (-TOP_CLAMP)
 
+// Log-odds magnitude past which further agreeing updates are negligible
+#define SATURATED_LOGODDS 100.f
+
+// Upper bound of the measurement standard deviation. Voxels more than
+// 6*MAX_SIGMA behind the measured surface are not updated.
+#define MAX_SIGMA     0.05f
+
 #endif
@@ -35,8 +35,14 @@
  */
 
 #include <se/DenseSLAMSystem.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <se/ray_iterator.hpp>
+#include <se/functors/ray_functor.hpp>
 #include <se/algorithms/meshing.hpp>
+#include <se/algorithms/point_cloud.hpp>
+#include <se/io/point_cloud_io.hpp>
 #include <se/geometry/octree_collision.hpp>
 #include <se/vtk-io.h>
 #include "timings.h"
@@ -69,9 +75,16 @@ DenseSLAMSystem::DenseSLAMSystem(const Eigen::Vector2i& inputSize,
                                  std::vector<int> & pyramid,
                                  const Configuration& config) :
   computation_size_(inputSize),
+  config_(config),
   vertex_(computation_size_.x(), computation_size_.y()),
   normal_(computation_size_.x(), computation_size_.y()),
-  float_depth_(computation_size_.x(), computation_size_.y())
+  float_depth_(computation_size_.x(), computation_size_.y()),
+  tracking_frame_(-1),
+  batch_size_(0),
+  map_version_(0),
+  raycast_version_(0),
+  render_raycast_version_(0),
+  render_stride_(0)
   {
 
     this->init_pose_ = initPose.block<3,1>(0,3);
@@ -80,12 +93,14 @@ DenseSLAMSystem::DenseSLAMSystem(const Eigen::Vector2i& inputSize,
     this->mu_ = config.mu;
     pose_ = initPose;
     raycast_pose_ = initPose;
+    last_integrated_pose_ = initPose;
 
     this->iterations_.clear();
     for (std::vector<int>::iterator it = pyramid.begin();
         it != pyramid.end(); it++) {
       this->iterations_.push_back(*it);
     }
+    this->configured_iterations_ = this->iterations_;
 
     viewPose_ = &pose_;
 
@@ -95,6 +110,7 @@ DenseSLAMSystem::DenseSLAMSystem(const Eigen::Vector2i& inputSize,
     // internal buffers to initialize
     reduction_output_.resize(8 * 32);
     tracking_result_.resize(computation_size_.x() * computation_size_.y());
+    valid_pixels_.resize(iterations_.size());
 
     for (unsigned int i = 0; i < iterations_.size(); ++i) {
       int downsample = 1 << i;
@@ -119,7 +135,7 @@ DenseSLAMSystem::DenseSLAMSystem(const Eigen::Vector2i& inputSize,
 
     // ********* END : Generate the gaussian *************
 
-    discrete_vol_ptr_ = std::make_shared<se::Octree<FieldType> >();
+    discrete_vol_ptr_ = std::make_shared<DiscreteMap<FieldType> >();
     discrete_vol_ptr_->init(volume_resolution_.x(), volume_dimension_.x());
     volume_ = Volume<FieldType>(volume_resolution_.x(), volume_dimension_.x(),
         discrete_vol_ptr_.get());
@@ -129,9 +145,13 @@ bool DenseSLAMSystem::preprocessing(const unsigned short * inputDepth,
     const Eigen::Vector2i& inputSize, const bool filterInput){
 
     mm2metersKernel(float_depth_, inputDepth, inputSize);
+    depth_pyramid_.build(float_depth_.data(), computation_size_);
+    // The bilateral filter preserves the set of valid pixels, so the list of
+    // float_depth_ also holds for scaled_depth_[0]
+    compactValidPixelsKernel(valid_pixels_[0], float_depth_);
     if(filterInput){
         bilateralFilterKernel(scaled_depth_[0], float_depth_, gaussian_,
-            e_delta, radius);
+            e_delta, radius, &valid_pixels_[0]);
     }
     else {
       std::memcpy(scaled_depth_[0].data(), float_depth_.data(),
@@ -146,16 +166,19 @@ bool DenseSLAMSystem::tracking(const Eigen::Vector4f& k,
 	if (frame % tracking_rate != 0)
 		return false;
 
+  camera_.update(k, computation_size_, iterations_.size());
+
 	// half sample the input depth maps into the pyramid levels
 	for (unsigned int i = 1; i < iterations_.size(); ++i) {
 		halfSampleRobustImageKernel(scaled_depth_[i], scaled_depth_[i - 1], e_delta * 3, 1);
+		compactValidPixelsKernel(valid_pixels_[i], scaled_depth_[i]);
 	}
 
 	// prepare the 3D information from the input depth maps
   Eigen::Vector2i localimagesize = computation_size_;
 	for (unsigned int i = 0; i < iterations_.size(); ++i) {
-    Eigen::Matrix4f invK = getInverseCameraMatrix(k / float(1 << i));
-		depth2vertexKernel(input_vertex_[i], scaled_depth_[i], invK);
+		depth2vertexKernel(input_vertex_[i], scaled_depth_[i], camera_.rays(i),
+        camera_.lengths(i), &valid_pixels_[i]);
     if(k.y() < 0)
       vertex2normalKernel<true>(input_normal_[i], input_vertex_[i]);
     else
@@ -170,11 +193,17 @@ bool DenseSLAMSystem::tracking(const Eigen::Vector4f& k,
     Eigen::Vector2i localimagesize(
 				computation_size_.x() / (int) pow(2, level),
 				computation_size_.y() / (int) pow(2, level));
+    // Only the valid pixels are tracked, mark the rest once for all iterations
+    for (int y = 0; y < localimagesize.y(); ++y) {
+      for (int x = 0; x < localimagesize.x(); ++x) {
+        tracking_result_[x + y * computation_size_.x()].result = -1;
+      }
+    }
 		for (int i = 0; i < iterations_[level]; ++i) {
 
       trackKernel(tracking_result_.data(), input_vertex_[level], input_normal_[level],
           vertex_, normal_, pose_, projectReference,
-          dist_threshold, normal_threshold);
+          dist_threshold, normal_threshold, &valid_pixels_[level]);
 
 			reduceKernel(reduction_output_.data(), tracking_result_.data(), computation_size_,
 					localimagesize);
@@ -184,6 +213,7 @@ bool DenseSLAMSystem::tracking(const Eigen::Vector4f& k,
 
 		}
 	}
+	tracking_frame_ = frame;
 	return checkPoseKernel(pose_, old_pose_, reduction_output_.data(),
       computation_size_, track_threshold);
 }
@@ -194,10 +224,19 @@ bool DenseSLAMSystem::raycasting(const Eigen::Vector4f& k, float mu, unsigned in
 
   if(frame > 2) {
     raycast_pose_ = pose_;
+    camera_.update(k, computation_size_, iterations_.size());
     float step = volume_dimension_.x() / volume_resolution_.x();
-    raycastKernel(volume_, vertex_, normal_,
-        raycast_pose_ * getInverseCameraMatrix(k), nearPlane,
-        farPlane, mu, step, step*BLOCK_SIDE);
+    raycastKernel(volume_, vertex_, normal_, raycast_pose_, camera_.rays(0),
+        nearPlane, farPlane, mu, step, step*BLOCK_SIDE, !config_.image_normals);
+    // Same orientation as the input normals, as the cross product commutes
+    // with the camera rotation
+    if(config_.image_normals) {
+      if(k.y() < 0)
+        vertex2normalKernel<true>(normal_, vertex_);
+      else
+        vertex2normalKernel<false>(normal_, vertex_);
+    }
+    raycast_version_ = map_version_;
     doRaycast = true;
   }
   return doRaycast;
@@ -208,49 +247,75 @@ bool DenseSLAMSystem::integration(const Eigen::Vector4f& k, unsigned int integra
 
   if (((frame % integration_rate) == 0) || (frame <= 3)) {
 
+    scratch_.reset();
+    camera_.update(k, computation_size_, iterations_.size());
     float voxelsize =  volume_._dim/volume_._size;
     int num_vox_per_pix = volume_._dim/((se::VoxelBlock<FieldType>::side)*voxelsize);
     size_t total = num_vox_per_pix * computation_size_.x() *
       computation_size_.y();
     allocation_list_.reserve(total);
 
+    const se::functor::scale_policy scales = 
+      {config_.multires_distance, config_.multires_scales};
     unsigned int allocated = 0;
     if(std::is_same<FieldType, SDF>::value) {
      allocated  = buildAllocationList(allocation_list_.data(),
          allocation_list_.capacity(),
         *volume_._map_index, pose_, getCameraMatrix(k), float_depth_.data(),
         computation_size_, volume_._size,
-      voxelsize, 2*mu);
+      voxelsize, 2*mu, valid_pixels_[0].data(), valid_pixels_[0].size(),
+      scales);
     } else if(std::is_same<FieldType, OFusion>::value) {
      allocated = buildOctantList(allocation_list_.data(), allocation_list_.capacity(),
          *volume_._map_index,
          pose_, getCameraMatrix(k), float_depth_.data(), computation_size_, voxelsize,
-         compute_stepsize, step_to_depth, 6*mu);
+         compute_stepsize, step_to_depth, 6*mu, valid_pixels_[0].data(),
+         valid_pixels_[0].size());
     }
 
+    const size_t blocks_before = volume_._map_index->getBlockBuffer().size();
     volume_._map_index->allocate(allocation_list_.data(), allocated);
 
+    // The first frames are always integrated, as in the tracking failure
+    // handling of the pipeline
+    if(config_.integration_gating && frame > 3 && 
+        isRedundant(frame, blocks_before)) {
+      ++gating_stats_.skipped;
+      return false;
+    }
+
+    const se::functor::convergence_policy policy = 
+      {config_.converged_visits, config_.revisit_period};
+    // Both updates carve free space, so only blocks behind the band they
+    // update are culled
+    const float infinity = std::numeric_limits<float>::infinity();
     if(std::is_same<FieldType, SDF>::value) {
       struct sdf_update funct(float_depth_.data(),
-          Eigen::Vector2i(computation_size_.x(), computation_size_.y()), mu, 100);
+          Eigen::Vector2i(computation_size_.x(), computation_size_.y()), mu, 100,
+          0.1f, camera_.lengths(0).data());
       se::functor::projective_map(*volume_._map_index,
           Sophus::SE3f(pose_).inverse(),
           getCameraMatrix(k),
           Eigen::Vector2i(computation_size_.x(), computation_size_.y()),
-          funct);
+          funct, scratch_, policy, 
+          se::functor::depth_culling{&depth_pyramid_, infinity, mu}, scales);
     } else if(std::is_same<FieldType, OFusion>::value) {
 
       float timestamp = (1.f/30.f)*frame;
       struct bfusion_update funct(float_depth_.data(),
           Eigen::Vector2i(computation_size_.x(), computation_size_.y()), 
-          mu, timestamp, voxelsize);
+          mu, timestamp, voxelsize, camera_.lengths(0).data());
 
       se::functor::projective_map(*volume_._map_index,
           Sophus::SE3f(pose_).inverse(),
           getCameraMatrix(k),
           Eigen::Vector2i(computation_size_.x(), computation_size_.y()),
-          funct);
+          funct, scratch_, policy,
+          se::functor::depth_culling{&depth_pyramid_, infinity, 6*MAX_SIGMA});
     }
+    last_integrated_pose_ = pose_;
+    ++gating_stats_.integrated;
+    ++map_version_;
 
     // if(frame % 15 == 0) {
     //   std::stringstream f;
@@ -267,11 +332,227 @@ bool DenseSLAMSystem::integration(const Eigen::Vector4f& k, unsigned int integra
   return true;
 }
 
+bool DenseSLAMSystem::isRedundant(unsigned int frame, size_t blocks_before) {
+
+  const Eigen::Matrix3f rotation = 
+    last_integrated_pose_.topLeftCorner<3,3>().transpose() * 
+    pose_.topLeftCorner<3,3>();
+  gating_stats_.translation = (pose_.topRightCorner<3,1>() - 
+      last_integrated_pose_.topRightCorner<3,1>()).norm();
+  gating_stats_.rotation = Eigen::AngleAxisf(rotation).angle();
+
+  // Relative to the blocks in view, which allocation marks as active, so
+  // that the threshold does not loosen as the map grows
+  const auto& blocks = volume_._map_index->getBlockBuffer();
+  const int num_blocks = blocks.size();
+  int touched = 0;
+#pragma omp parallel for reduction(+:touched)
+  for(int i = 0; i < num_blocks; ++i) {
+    touched += blocks[i]->active();
+  }
+  gating_stats_.new_blocks = touched == 0 ? 0.f : 
+    float(num_blocks - blocks_before) / touched;
+
+  // ICP residuals are only meaningful if this frame was tracked
+  gating_stats_.residual = -1.f;
+  if(tracking_frame_ == int(frame) && reduction_output_[28] > 0) {
+    gating_stats_.residual = 
+      std::sqrt(reduction_output_[0] / reduction_output_[28]);
+  }
+
+  // Frames posed without ICP, replayed from ground truth or between
+  // tracking_rate frames, have no residual and are judged on the motion and
+  // new blocks criteria alone
+  const bool residual_known = gating_stats_.residual >= 0.f;
+  return gating_stats_.translation < config_.gating_translation &&
+    gating_stats_.rotation < config_.gating_rotation &&
+    gating_stats_.new_blocks < config_.gating_new_blocks &&
+    (!residual_known || gating_stats_.residual < config_.gating_residual);
+}
+
+bool DenseSLAMSystem::integration(const DepthViews& views, float mu,
+    unsigned int frame) {
+
+  float voxelsize =  volume_._dim/volume_._size;
+  int num_vox_per_pix = volume_._dim/((se::VoxelBlock<FieldType>::side)*voxelsize);
+  const std::vector<unsigned> frames(views.size(), frame);
+  // Views are updated together in groups of at most max_projective_cameras,
+  // each group allocating its own blocks right before its update
+  const size_t max_group = se::functor::max_projective_cameras;
+  for(size_t first = 0; first < views.size(); first += max_group) {
+    const size_t count = std::min(max_group, views.size() - first);
+    scratch_.reset();
+    size_t total = 0;
+    for(size_t i = first; i < first + count; ++i) {
+      total += num_vox_per_pix * views[i].size.x() * views[i].size.y();
+    }
+    allocation_list_.reserve(total);
+
+    // Union of the allocation lists of all views of the group
+    size_t allocated = 0;
+    for(size_t i = first; i < first + count; ++i) {
+      const DepthView& view = views[i];
+      se::key_t * list = allocation_list_.data() + allocated;
+      const size_t reserved = allocation_list_.capacity() - allocated;
+      if(std::is_same<FieldType, SDF>::value) {
+        allocated += buildAllocationList(list, reserved,
+            *volume_._map_index, view.pose, getCameraMatrix(view.k), 
+            view.depth, view.size, volume_._size, voxelsize, 2*mu);
+      } else if(std::is_same<FieldType, OFusion>::value) {
+        allocated += buildOctantList(list, reserved, *volume_._map_index,
+            view.pose, getCameraMatrix(view.k), view.depth, view.size, 
+            voxelsize, compute_stepsize, step_to_depth, 6*mu);
+      }
+      allocated = std::min(allocated, allocation_list_.capacity());
+    }
+
+    volume_._map_index->allocate(allocation_list_.data(), allocated);
+    updateViews(views.data() + first, frames.data() + first, nullptr, count,
+        mu);
+  }
+  return true;
+}
+
+bool DenseSLAMSystem::queueIntegration(const Eigen::Vector4f& k, float mu,
+    unsigned int frame, unsigned int batch_size) {
+
+  if(batch_depth_.size() == batch_size_) {
+    batch_depth_.emplace_back(computation_size_.x(), computation_size_.y());
+    batch_pyramids_.emplace_back();
+    batch_pixels_.emplace_back();
+  }
+  se::Image<float>& depth = batch_depth_[batch_size_];
+  std::memcpy(depth.data(), float_depth_.data(), 
+      sizeof(float) * float_depth_.size());
+  batch_pyramids_[batch_size_].build(depth.data(), computation_size_);
+  batch_pixels_[batch_size_] = valid_pixels_[0];
+  batch_views_.resize(batch_size_ + 1);
+  batch_views_[batch_size_] = {depth.data(), computation_size_, k, pose_};
+  batch_frames_.resize(batch_size_ + 1);
+  batch_frames_[batch_size_] = frame;
+  ++batch_size_;
+
+  if(batch_size_ < batch_size) return false;
+  return flushIntegration(mu);
+}
+
+bool DenseSLAMSystem::flushIntegration(float mu) {
+
+  if(batch_size_ == 0) return false;
+  camera_.update(batch_views_[0].k, computation_size_, iterations_.size());
+  float voxelsize =  volume_._dim/volume_._size;
+  int num_vox_per_pix = volume_._dim/((se::VoxelBlock<FieldType>::side)*voxelsize);
+  // Frames are applied together in groups of at most max_projective_cameras
+  const size_t max_group = se::functor::max_projective_cameras;
+  for(size_t first = 0; first < batch_size_; first += max_group) {
+    const size_t count = std::min(max_group, batch_size_ - first);
+    scratch_.reset();
+
+    // Allocation stays per frame: later frames then skip the blocks already
+    // allocated, which keeps each list as short as in integration()
+    for(size_t i = first; i < first + count; ++i) {
+      const DepthView& view = batch_views_[i];
+      const std::vector<int>& pixels = batch_pixels_[i];
+      allocation_list_.reserve(num_vox_per_pix * view.size.x() * view.size.y());
+      size_t allocated = 0;
+      if(std::is_same<FieldType, SDF>::value) {
+        allocated = buildAllocationList(allocation_list_.data(), 
+            allocation_list_.capacity(), *volume_._map_index, view.pose, 
+            getCameraMatrix(view.k), view.depth, view.size, volume_._size, 
+            voxelsize, 2*mu, pixels.data(), pixels.size());
+      } else if(std::is_same<FieldType, OFusion>::value) {
+        allocated = buildOctantList(allocation_list_.data(), 
+            allocation_list_.capacity(), *volume_._map_index, view.pose, 
+            getCameraMatrix(view.k), view.depth, view.size, voxelsize, 
+            compute_stepsize, step_to_depth, 6*mu, pixels.data(), 
+            pixels.size());
+      }
+      volume_._map_index->allocate(allocation_list_.data(), allocated);
+    }
+
+    updateViews(batch_views_.data() + first, batch_frames_.data() + first,
+        batch_pyramids_.data() + first, count, mu);
+  }
+  last_integrated_pose_ = batch_views_[batch_size_ - 1].pose;
+  gating_stats_.integrated += batch_size_;
+  batch_size_ = 0;
+  return true;
+}
+
+void DenseSLAMSystem::updateViews(const DepthView* views,
+    const unsigned* frames, const se::DepthPyramid* pyramids, size_t count,
+    float mu) {
+
+  const float voxelsize =  volume_._dim/volume_._size;
+  // Both updates carve free space, so only blocks behind the band they
+  // update are culled
+  const float infinity = std::numeric_limits<float>::infinity();
+  if(std::is_same<FieldType, SDF>::value) {
+    se::functor::projective_cameras<sdf_update> cameras;
+    for(size_t i = 0; i < count; ++i) {
+      const DepthView& view = views[i];
+      // Ray lengths are only cached for the intrinsics of camera_
+      const float* lengths = view.k == camera_.intrinsics() && 
+        view.size == camera_.size() ? camera_.lengths(0).data() : nullptr;
+      cameras.push_back({Sophus::SE3f(view.pose).inverse(),
+          getCameraMatrix(view.k), view.size, 
+          sdf_update(view.depth, view.size, mu, 100, 0.1f, lengths),
+          se::functor::depth_culling{pyramids ? &pyramids[i] : nullptr, 
+            infinity, mu}});
+    }
+    se::functor::projective_map(*volume_._map_index, cameras, scratch_);
+  } else if(std::is_same<FieldType, OFusion>::value) {
+    se::functor::projective_cameras<bfusion_update> cameras;
+    for(size_t i = 0; i < count; ++i) {
+      const DepthView& view = views[i];
+      const float timestamp = (1.f/30.f)*frames[i];
+      cameras.push_back({Sophus::SE3f(view.pose).inverse(),
+          getCameraMatrix(view.k), view.size, 
+          bfusion_update(view.depth, view.size, mu, timestamp, voxelsize),
+          se::functor::depth_culling{pyramids ? &pyramids[i] : nullptr, 
+            infinity, 6*MAX_SIGMA}});
+    }
+    se::functor::projective_map(*volume_._map_index, cameras, scratch_);
+  }
+  ++map_version_;
+}
+
+bool DenseSLAMSystem::integratePointCloud(const Eigen::Vector3f* points,
+    const Eigen::Vector3f* origins, size_t num_points, float mu, 
+    unsigned frame) {
+
+  scratch_.reset();
+  const float voxelsize =  volume_._dim/volume_._size;
+  // Each ray is the optical axis of a one pixel camera, see
+  // se::functor::ray_functor, reading its range from a num_points x 1 image
+  scan_ranges_.resize(num_points);
+#pragma omp parallel for
+  for(size_t i = 0; i < num_points; ++i) {
+    scan_ranges_[i] = (points[i] - origins[i]).norm();
+  }
+  const Eigen::Vector2i size(num_points, 1);
+
+  // Same bands as the allocation of the projective integration
+  if(std::is_same<FieldType, SDF>::value) {
+    struct sdf_update funct(scan_ranges_.data(), size, mu, 100);
+    se::functor::ray_map(*volume_._map_index, points, origins, num_points, 
+        mu, mu, funct, scratch_);
+  } else if(std::is_same<FieldType, OFusion>::value) {
+    const float timestamp = (1.f/30.f)*frame;
+    struct bfusion_update funct(scan_ranges_.data(), size, mu, timestamp, 
+        voxelsize);
+    se::functor::ray_map(*volume_._map_index, points, origins, num_points, 
+        3*mu, 3*mu, funct, scratch_);
+  }
+  ++map_version_;
+  return true;
+}
+
 void DenseSLAMSystem::dump_volume(std::string ) {
 
 }
 
-void DenseSLAMSystem::renderVolume(unsigned char* out,
+bool DenseSLAMSystem::renderVolume(unsigned char* out,
     const Eigen::Vector2i& outputSize,
     int frame,
 		int raycast_rendering_rate,
@@ -280,13 +561,44 @@ void DenseSLAMSystem::renderVolume(unsigned char* out,
 
 	if (frame % raycast_rendering_rate == 0) {
     const float step = volume_dimension_.x() / volume_resolution_.x();
-		renderVolumeKernel(volume_, out, outputSize,
-	*(this->viewPose_) * getInverseCameraMatrix(k), nearPlane,
-	farPlane * 2.0f, mu_, step, largestep,
-        this->viewPose_->topRightCorner<3, 1>(), ambient,
-        !(this->viewPose_->isApprox(raycast_pose_)), vertex_,
-        normal_);
+    const Eigen::Matrix4f view = *(this->viewPose_) * getInverseCameraMatrix(k);
+    const size_t bytes = 4 * outputSize.x() * outputSize.y();
+    const bool from_raycast = this->viewPose_->isApprox(raycast_pose_);
+    const bool cached = render_stride_ > 0 && 
+      render_version_ == map_version_ && render_size_ == outputSize && 
+      render_view_ == view && 
+      (!from_raycast || render_raycast_version_ == raycast_version_);
+    if (!cached || render_stride_ > 1) {
+      render_image_.resize(bytes);
+      if (from_raycast) {
+        // Shaded from the raycast model
+        renderVolumeKernel(volume_, render_image_.data(), outputSize, view, 
+            nearPlane, farPlane * 2.0f, mu_, step, largestep,
+            this->viewPose_->topRightCorner<3, 1>(), ambient, false, vertex_,
+            normal_);
+        render_raycast_version_ = raycast_version_;
+        render_stride_ = 1;
+      } else {
+        const int stride = cached ? render_stride_ / 2 : 
+          config_.render_downsample;
+        render_depth_.resize(outputSize.x() * outputSize.y());
+        renderVolumeLatticeKernel(volume_, render_image_.data(), 
+            render_depth_.data(), outputSize, view, nearPlane, 
+            farPlane * 2.0f, mu_, step, largestep,
+            this->viewPose_->topRightCorner<3, 1>(), ambient, stride, cached);
+        if (stride > 1)
+          upsampleRenderKernel(render_image_.data(), render_depth_.data(), 
+              outputSize, stride);
+        render_stride_ = stride;
+      }
+      render_view_ = view;
+      render_size_ = outputSize;
+      render_version_ = map_version_;
+    }
+    std::memcpy(out, render_image_.data(), bytes);
+    return true;
   }
+  return false;
 }
 
 void DenseSLAMSystem::renderTrack(unsigned char* out,
@@ -299,6 +611,39 @@ void DenseSLAMSystem::renderDepth(unsigned char* out,
         renderDepthKernel(out, float_depth_.data(), outputSize, nearPlane, farPlane);
 }
 
+void DenseSLAMSystem::renderExpectedDepth(const VirtualCameras& cameras,
+    std::vector<se::Image<float> >& depths,
+    std::vector<se::Image<unsigned char> >& masks, float mu) {
+
+  // Bound the tables kept for planners sweeping over intrinsics
+  if(virtual_models_.size() > 32) virtual_models_.clear();
+  std::vector<size_t> model_index(cameras.size());
+  depths.clear();
+  masks.clear();
+  for(size_t c = 0; c < cameras.size(); ++c) {
+    const VirtualCamera& camera = cameras[c];
+    auto model = std::find_if(virtual_models_.begin(), virtual_models_.end(),
+        [&camera](const se::CameraModel& m) {
+          return m.intrinsics() == camera.k && m.size() == camera.size;
+        });
+    model_index[c] = model - virtual_models_.begin();
+    if(model == virtual_models_.end()) {
+      virtual_models_.emplace_back();
+      virtual_models_.back().update(camera.k, camera.size, 1);
+    }
+    depths.emplace_back(camera.size.x(), camera.size.y());
+    masks.emplace_back(camera.size.x(), camera.size.y());
+  }
+  std::vector<const se::Image<Eigen::Vector3f>*> rays(cameras.size());
+  for(size_t c = 0; c < cameras.size(); ++c) {
+    rays[c] = &virtual_models_[model_index[c]].rays(0);
+  }
+
+  const float step = volume_dimension_.x() / volume_resolution_.x();
+  renderDepthBatchKernel(volume_, cameras, rays, depths, masks, nearPlane,
+      farPlane, mu, step, step*BLOCK_SIDE);
+}
+
 void DenseSLAMSystem::dump_mesh(const std::string filename){
 
   std::vector<Triangle> mesh;
@@ -320,3 +665,280 @@ void DenseSLAMSystem::dump_mesh(const std::string filename){
   se::algorithms::marching_cube(*volume_._map_index, select, inside, mesh);
   writeVtkMesh(filename.c_str(), mesh);
 }
+
+long DenseSLAMSystem::dump_point_cloud(const std::string& filename) {
+
+  // Surfaces are the SDF zero crossings or the occupancy boundaries
+  auto inside = [](const Volume<FieldType>::value_type& val) {
+    return std::is_same<FieldType, SDF>::value ? val.x < 0.f : 
+      val.x > SURF_BOUNDARY;
+  };
+  auto select = [](const Volume<FieldType>::value_type& val) {
+    return std::is_same<FieldType, SDF>::value ? val.x : 
+      val.x - SURF_BOUNDARY;
+  };
+
+  std::vector<Eigen::Vector3f> points, normals;
+  se::algorithms::zero_crossings(*volume_._map_index, select, inside, points,
+      normals);
+  const std::string ext = ".ply";
+  const bool ply = filename.size() >= ext.size() && 
+    filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+  const bool written = ply ? 
+    se::save_point_cloud_ply(filename, points, normals) :
+    se::save_point_cloud_raw(filename, points, normals);
+  return written ? long(points.size()) : -1;
+}
+
+// Checkpoint files start with this tag and version, see checkpoint()
+static const uint32_t checkpoint_magic = 0x4b434553; // "SECK"
+static const uint32_t checkpoint_version = 3;
+
+template <typename T>
+static void write_pod(std::ostream& os, const T& value) {
+  os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void read_pod(std::istream& is, T& value) {
+  is.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+typedef std::vector<std::pair<const char *, double> > CheckpointOptions;
+
+// The options a checkpoint must be resumed with, as the map and the
+// tracking and gating state depend on them
+static CheckpointOptions checkpoint_options(const Configuration& config) {
+  return CheckpointOptions{
+    {"mu", config.mu},
+    {"icp_threshold", config.icp_threshold},
+    {"tracking_rate", config.tracking_rate},
+    {"integration_rate", config.integration_rate},
+    {"bilateral_filter", config.bilateralFilter},
+    {"integration_gating", config.integration_gating},
+    {"gating_translation", config.gating_translation},
+    {"gating_rotation", config.gating_rotation},
+    {"gating_new_blocks", config.gating_new_blocks},
+    {"gating_residual", config.gating_residual},
+    {"converged_visits", config.converged_visits},
+    {"revisit_period", config.revisit_period},
+    {"multires_distance", config.multires_distance},
+    {"multires_scales", config.multires_scales},
+    {"image_normals", config.image_normals},
+    {"render_downsample", config.render_downsample}};
+}
+
+bool DenseSLAMSystem::checkpoint(const std::string& filename, 
+    unsigned int frame) {
+
+  if (checkpoint_writer_.valid() && checkpoint_writer_.wait_for(
+        std::chrono::seconds(0)) != std::future_status::ready)
+    return false;
+  flushIntegration(mu_);
+
+  // The state identifying the pipeline is checked on restore
+  std::ostringstream os(std::ios::binary);
+  const uint32_t field = std::is_same<FieldType, SDF>::value ? 0 : 1;
+  const uint32_t levels = iterations_.size();
+  write_pod(os, checkpoint_magic);
+  write_pod(os, checkpoint_version);
+  write_pod(os, field);
+  write_pod(os, computation_size_);
+  write_pod(os, volume_resolution_);
+  write_pod(os, volume_dimension_);
+  write_pod(os, levels);
+  os.write(reinterpret_cast<const char *>(configured_iterations_.data()), 
+      levels * sizeof(int));
+  os.write(reinterpret_cast<const char *>(iterations_.data()), 
+      levels * sizeof(int));
+  const CheckpointOptions options = checkpoint_options(config_);
+  write_pod(os, static_cast<uint32_t>(options.size()));
+  for (const auto& option : options)
+    write_pod(os, option.second);
+
+  write_pod(os, frame);
+  write_pod(os, init_pose_);
+  write_pod(os, pose_);
+  write_pod(os, old_pose_);
+  write_pod(os, raycast_pose_);
+  write_pod(os, last_integrated_pose_);
+  write_pod(os, static_cast<unsigned char>(tracked_));
+  write_pod(os, static_cast<unsigned char>(integrated_));
+  write_pod(os, tracking_frame_);
+  write_pod(os, gating_stats_);
+  os.write(reinterpret_cast<const char *>(reduction_output_.data()), 
+      reduction_output_.size() * sizeof(float));
+  os.write(reinterpret_cast<const char *>(vertex_.data()), 
+      vertex_.size() * sizeof(Eigen::Vector3f));
+  os.write(reinterpret_cast<const char *>(normal_.data()), 
+      normal_.size() * sizeof(Eigen::Vector3f));
+
+  // Only the copy is made here, the previous writer is done with the
+  // snapshot and the map is encoded by the new one
+  if (!checkpoint_snapshot_)
+    checkpoint_snapshot_ = std::make_shared<se::MapSnapshot<FieldType> >();
+  discrete_vol_ptr_->snapshot(*checkpoint_snapshot_);
+
+  checkpoint_writer_ = std::async(std::launch::async, 
+      [filename, data = os.str(), snapshot = checkpoint_snapshot_]() {
+        const std::string tmp = filename + ".tmp";
+        {
+          std::ofstream out(tmp, std::ios::binary);
+          out.write(data.data(), data.size());
+          snapshot->save(out);
+          if (!out) {
+            std::cerr << "Error: could not write " << tmp << std::endl;
+            return false;
+          }
+        }
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+          std::cerr << "Error: could not rename " << tmp << std::endl;
+          return false;
+        }
+        return true;
+      });
+  return true;
+}
+
+bool DenseSLAMSystem::waitCheckpoint() {
+  return !checkpoint_writer_.valid() || checkpoint_writer_.get();
+}
+
+bool DenseSLAMSystem::restore(const std::string& filename, 
+    unsigned int& frame) {
+
+  std::ifstream is(filename, std::ios::binary);
+  uint32_t magic = 0, version = 0, field = 0, levels = 0;
+  Eigen::Vector2i computation_size;
+  Eigen::Vector3i volume_resolution;
+  Eigen::Vector3f volume_dimension;
+  read_pod(is, magic);
+  read_pod(is, version);
+  read_pod(is, field);
+  read_pod(is, computation_size);
+  read_pod(is, volume_resolution);
+  read_pod(is, volume_dimension);
+  read_pod(is, levels);
+  if (!is || magic != checkpoint_magic || version != checkpoint_version ||
+      field != (std::is_same<FieldType, SDF>::value ? 0u : 1u) ||
+      computation_size != computation_size_ || 
+      volume_resolution != volume_resolution_ || 
+      volume_dimension != volume_dimension_ || 
+      levels != iterations_.size()) 
+    return false;
+
+  // Everything is read aside first, so that a truncated file leaves the
+  // pipeline untouched
+  std::vector<int> configured(levels), iterations(levels);
+  is.read(reinterpret_cast<char *>(configured.data()), levels * sizeof(int));
+  is.read(reinterpret_cast<char *>(iterations.data()), levels * sizeof(int));
+  if (!is)
+    return false;
+  for (unsigned int level = 0; level < levels; ++level) {
+    if (configured[level] != configured_iterations_[level]) {
+      std::cerr << "Error: checkpoint written with " << configured[level] 
+        << " iterations at pyramid level " << level << ", not " 
+        << configured_iterations_[level] << std::endl;
+      return false;
+    }
+  }
+  const CheckpointOptions options = checkpoint_options(config_);
+  uint32_t num_options = 0;
+  read_pod(is, num_options);
+  if (!is || num_options != options.size())
+    return false;
+  for (const auto& option : options) {
+    double value;
+    read_pod(is, value);
+    if (!is)
+      return false;
+    if (value != option.second) {
+      std::cerr << "Error: checkpoint written with " << option.first << " " 
+        << value << ", not " << option.second << std::endl;
+      return false;
+    }
+  }
+  unsigned int next_frame;
+  Eigen::Vector3f init_pose;
+  Eigen::Matrix4f pose, old_pose, raycast_pose, last_integrated_pose;
+  unsigned char tracked, integrated;
+  int tracking_frame;
+  GatingStats gating_stats;
+  read_pod(is, next_frame);
+  read_pod(is, init_pose);
+  read_pod(is, pose);
+  read_pod(is, old_pose);
+  read_pod(is, raycast_pose);
+  read_pod(is, last_integrated_pose);
+  read_pod(is, tracked);
+  read_pod(is, integrated);
+  read_pod(is, tracking_frame);
+  read_pod(is, gating_stats);
+  std::vector<float> reduction_output(reduction_output_.size());
+  is.read(reinterpret_cast<char *>(reduction_output.data()), 
+      reduction_output.size() * sizeof(float));
+  se::Image<Eigen::Vector3f> vertex(vertex_.width(), vertex_.height());
+  se::Image<Eigen::Vector3f> normal(normal_.width(), normal_.height());
+  is.read(reinterpret_cast<char *>(vertex.data()), 
+      vertex.size() * sizeof(Eigen::Vector3f));
+  is.read(reinterpret_cast<char *>(normal.data()), 
+      normal.size() * sizeof(Eigen::Vector3f));
+  if (!is)
+    return false;
+  std::shared_ptr<DiscreteMap<FieldType> > map = 
+    std::make_shared<DiscreteMap<FieldType> >();
+  if (!map->load(is))
+    return false;
+
+  iterations_ = iterations;
+  init_pose_ = init_pose;
+  pose_ = pose;
+  old_pose_ = old_pose;
+  raycast_pose_ = raycast_pose;
+  last_integrated_pose_ = last_integrated_pose;
+  tracked_ = tracked;
+  integrated_ = integrated;
+  tracking_frame_ = tracking_frame;
+  gating_stats_ = gating_stats;
+  reduction_output_ = reduction_output;
+  std::copy(vertex.data(), vertex.data() + vertex.size(), vertex_.data());
+  std::copy(normal.data(), normal.data() + normal.size(), normal_.data());
+  discrete_vol_ptr_ = map;
+  volume_ = Volume<FieldType>(volume_resolution_.x(), volume_dimension_.x(),
+      discrete_vol_ptr_.get());
+
+  // Queued frames and cached renders refer to the replaced map
+  batch_size_ = 0;
+  render_stride_ = 0;
+  ++map_version_;
+  raycast_version_ = map_version_;
+  frame = next_frame;
+  return true;
+}
+
+void DenseSLAMSystem::reset(const Eigen::Matrix4f& initPose) {
+
+  discrete_vol_ptr_->clear();
+
+  init_pose_ = initPose.block<3,1>(0,3);
+  pose_ = initPose;
+  old_pose_ = initPose;
+  raycast_pose_ = initPose;
+  last_integrated_pose_ = initPose;
+  tracked_ = false;
+  integrated_ = false;
+  tracking_frame_ = -1;
+  gating_stats_ = GatingStats();
+
+  // Nothing has been raycast yet, the first frames must not track against
+  // the previous session's model
+  std::fill(vertex_.data(), vertex_.data() + vertex_.size(), 
+      Eigen::Vector3f::Zero());
+  std::fill(normal_.data(), normal_.data() + normal_.size(), 
+      Eigen::Vector3f::Zero());
+
+  batch_size_ = 0;
+  render_stride_ = 0;
+  ++map_version_;
+  raycast_version_ = map_version_;
+}
@@ -57,7 +57,8 @@ size_t buildOctantList(HashType* allocationList, size_t reserved,
     OctreeT<FieldType>& map_index, const Eigen::Matrix4f& pose, 
     const Eigen::Matrix4f& K, const float *depthmap, const Eigen::Vector2i &imageSize, 
     const float voxelSize, StepF compute_stepsize, DepthF step_to_depth,
-    const float band) {
+    const float band, const int* pixels = nullptr,
+    const size_t num_pixels = 0) {
 
   const float inverseVoxelSize = 1.f/voxelSize;
   Eigen::Matrix4f invK = K.inverse();
@@ -75,54 +76,56 @@ size_t buildOctantList(HashType* allocationList, size_t reserved,
 
   const Eigen::Vector3f camera = pose.topRightCorner<3, 1>();
   voxelCount = 0;
+  const int num_visits = pixels ? num_pixels : imageSize.x() * imageSize.y();
 #pragma omp parallel for
-  for (int y = 0; y < imageSize.y(); ++y) {
-    for (int x = 0; x < imageSize.x(); ++x) {
-      if(depthmap[x + y*imageSize.x()] == 0)
-        continue;
-      int tree_depth = max_depth; 
-      float stepsize = voxelSize;
-      const float depth = depthmap[x + y*imageSize.x()];
-      Eigen::Vector3f worldVertex = (kPose * Eigen::Vector3f((x + 0.5f) * depth, 
-            (y + 0.5f) * depth, depth).homogeneous()).head<3>();
+  for (int p = 0; p < num_visits; ++p) {
+    const int pos = pixels ? pixels[p] : p;
+    if(depthmap[pos] == 0)
+      continue;
+    const int x = pos % imageSize.x();
+    const int y = pos / imageSize.x();
+    int tree_depth = max_depth; 
+    float stepsize = voxelSize;
+    const float depth = depthmap[pos];
+    Eigen::Vector3f worldVertex = (kPose * Eigen::Vector3f((x + 0.5f) * depth, 
+          (y + 0.5f) * depth, depth).homogeneous()).head<3>();
 
-      Eigen::Vector3f direction = (camera - worldVertex).normalized();
-      const Eigen::Vector3f origin = worldVertex - (band * 0.5f) * direction;
-      const float dist = (camera - origin).norm(); 
-      Eigen::Vector3f step = direction*stepsize;
+    Eigen::Vector3f direction = (camera - worldVertex).normalized();
+    const Eigen::Vector3f origin = worldVertex - (band * 0.5f) * direction;
+    const float dist = (camera - origin).norm(); 
+    Eigen::Vector3f step = direction*stepsize;
 
-      Eigen::Vector3f voxelPos = origin;
-      float travelled = 0.f;
-      for(; travelled < dist; travelled += stepsize){
+    Eigen::Vector3f voxelPos = origin;
+    float travelled = 0.f;
+    for(; travelled < dist; travelled += stepsize){
 
-        Eigen::Vector3f voxelScaled = (voxelPos * inverseVoxelSize).array().floor();
-        if((voxelScaled.x() < size) && (voxelScaled.y() < size) &&
-           (voxelScaled.z() < size) && (voxelScaled.x() >= 0) &&
-           (voxelScaled.y() >= 0)   && (voxelScaled.z() >= 0)){
-          const Eigen::Vector3i voxel = voxelScaled.cast<int>();
-          auto node_ptr = map_index.fetch_octant(voxel.x(), voxel.y(), voxel.z(), 
-              tree_depth);
-          if(!node_ptr){
-            HashType k = map_index.hash(voxel.x(), voxel.y(), voxel.z(), 
-                std::min(tree_depth, leaves_depth));
-            unsigned int idx = voxelCount++;
-            if(idx < reserved) {
-              allocationList[idx] = k;
-            }
-          } else if(tree_depth >= leaves_depth) { 
-            static_cast<se::VoxelBlock<FieldType>*>(node_ptr)->active(true);
+      Eigen::Vector3f voxelScaled = (voxelPos * inverseVoxelSize).array().floor();
+      if((voxelScaled.x() < size) && (voxelScaled.y() < size) &&
+         (voxelScaled.z() < size) && (voxelScaled.x() >= 0) &&
+         (voxelScaled.y() >= 0)   && (voxelScaled.z() >= 0)){
+        const Eigen::Vector3i voxel = voxelScaled.cast<int>();
+        auto node_ptr = map_index.fetch_octant(voxel.x(), voxel.y(), voxel.z(), 
+            tree_depth);
+        if(!node_ptr){
+          HashType k = map_index.hash(voxel.x(), voxel.y(), voxel.z(), 
+              std::min(tree_depth, leaves_depth));
+          unsigned int idx = voxelCount++;
+          if(idx < reserved) {
+            allocationList[idx] = k;
           }
+        } else if(tree_depth >= leaves_depth) { 
+          static_cast<se::VoxelBlock<FieldType>*>(node_ptr)->active(true);
         }
-        stepsize = compute_stepsize(travelled, band, voxelSize);  
-        // int last_depth = tree_depth;
-        tree_depth = step_to_depth(stepsize, max_depth, voxelSize);
-        // if(tree_depth != last_depth) {
-        //   std::cout << "Break Here!" << std::endl;
-        // }
-        
-        step = direction*stepsize;
-        voxelPos +=step;
       }
+      stepsize = compute_stepsize(travelled, band, voxelSize);  
+      // int last_depth = tree_depth;
+      tree_depth = step_to_depth(stepsize, max_depth, voxelSize);
+      // if(tree_depth != last_depth) {
+      //   std::cout << "Break Here!" << std::endl;
+      // }
+      
+      step = direction*stepsize;
+      voxelPos +=step;
     }
   }
   return (size_t) voxelCount >= reserved ? reserved : (size_t) voxelCount;
@@ -154,22 +154,27 @@ static inline float applyWindow(const float occupancy, const float ,
   return occupancy * fraction;
 }
 
+/*
+ * Returns whether the voxel is still converging, that is its log-odds are not
+ * saturated yet or the measurement disagrees with its occupancy.
+ */
 struct bfusion_update {
 
   template <typename DataHandlerT>
-  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+  bool operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
       const Eigen::Vector3f& pos, const Eigen::Vector2f& pixel) {
 
     const Eigen::Vector2i px = pixel.cast <int> ();
-    const float depthSample = depth[px(0) + depthSize(0)*px(1)];
-    if (depthSample <=  0) return;
+    const int idx = px(0) + depthSize(0)*px(1);
+    const float depthSample = depth[idx];
+    if (depthSample <=  0) return false;
 
-    const float diff = (pos(2) - depthSample)
-      * std::sqrt( 1 + se::math::sq(pos(0) / pos(2)) + se::math::sq(pos(1) / pos(2)));
+    const float diff = (pos(2) - depthSample) * (rayLengths ? rayLengths[idx] :
+      std::sqrt( 1 + se::math::sq(pos(0) / pos(2)) + se::math::sq(pos(1) / pos(2))));
     float sigma = se::math::clamp(noiseFactor * se::math::sq(pos(2)), 
-        2*voxelsize, 0.05f);
+        2*voxelsize, MAX_SIGMA);
     float sample = HNew(diff/sigma, pos(2));
-    if(sample == 0.5f) return;
+    if(sample == 0.5f) return false;
     sample = se::math::clamp(sample, 0.03f, 0.97f);
     auto data = handler.get();
     const double delta_t = timestamp - data.y;
@@ -177,16 +182,21 @@ struct bfusion_update {
     data.x = se::math::clamp(updateLogs(data.x, sample), BOTTOM_CLAMP, TOP_CLAMP);
     data.y = timestamp;
     handler.set(data);
+    return fabsf(data.x) < SATURATED_LOGODDS || (data.x > 0.f) != (sample > 0.5f);
   } 
 
   bfusion_update(const float * d, const Eigen::Vector2i framesize, float n, 
-      float t, float vs): depth(d), depthSize(framesize), noiseFactor(n), 
-  timestamp(t), voxelsize(vs){};
+      float t, float vs, const float * l = nullptr): depth(d), 
+  depthSize(framesize), noiseFactor(n), timestamp(t), voxelsize(vs), 
+  rayLengths(l){};
 
   const float * depth;
   Eigen::Vector2i depthSize;
   float noiseFactor;
   float timestamp;
   float voxelsize;
+  // Optional per-pixel ray length factors of the depth frame, see
+  // se::CameraModel. Computed from the voxel position when null.
+  const float * rayLengths;
 };
 #endif
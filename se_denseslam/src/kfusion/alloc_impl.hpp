@@ -33,6 +33,7 @@
 #include <se/utils/math_utils.h> 
 #include <se/node.hpp>
 #include <se/utils/morton_utils.hpp>
+#include <se/functors/projective_functor.hpp>
 
 /* 
  * \brief Given a depth map and camera matrix it computes the list of 
@@ -49,13 +50,20 @@
  * \param size discrete extent of the map, in number of voxels
  * \param voxelSize spacing between two consegutive voxels, in metric space
  * \param band maximum extent of the allocating region, per ray
+ * \param pixels optional list of the linear indices of the valid pixels of
+ * depthmap; when null every pixel is visited and the invalid ones skipped
+ * \param num_pixels number of entries in pixels
+ * \param scales update scales of the integration; measurements updated at
+ * scale s are walked in steps of 2^s voxels
  */
 template <typename FieldType, template <typename> class OctreeT, typename HashType>
 unsigned int buildAllocationList(HashType * allocationList, size_t reserved,
     OctreeT<FieldType>& map_index, const Eigen::Matrix4f& pose, 
     const Eigen::Matrix4f& K, 
     const float *depthmap, const Eigen::Vector2i& imageSize, 
-    const unsigned int size,  const float voxelSize, const float band) {
+    const unsigned int size,  const float voxelSize, const float band,
+    const int* pixels = nullptr, const size_t num_pixels = 0,
+    const se::functor::scale_policy& scales = se::functor::scale_policy{0.f, 0}) {
 
   const float inverseVoxelSize = 1/voxelSize;
   const unsigned block_scale = log2(size) - se::math::log2_const(se::VoxelBlock<FieldType>::side);
@@ -73,44 +81,47 @@ unsigned int buildAllocationList(HashType * allocationList, size_t reserved,
   const Eigen::Vector3f camera = pose.topRightCorner<3, 1>();
   const int numSteps = ceil(band*inverseVoxelSize);
   voxelCount = 0;
+  const int num_visits = pixels ? num_pixels : imageSize.x() * imageSize.y();
 #pragma omp parallel for
-  for (int y = 0; y < imageSize.y(); ++y) {
-    for (int x = 0; x < imageSize.x(); ++x) {
-      if(depthmap[x + y*imageSize.x()] == 0)
-        continue;
-      const float depth = depthmap[x + y*imageSize.x()];
-      Eigen::Vector3f worldVertex = (kPose * Eigen::Vector3f((x + 0.5f) * depth, 
-            (y + 0.5f) * depth, depth).homogeneous()).head<3>();
+  for (int p = 0; p < num_visits; ++p) {
+    const int pos = pixels ? pixels[p] : p;
+    const float depth = depthmap[pos];
+    if(depth == 0)
+      continue;
+    const int x = pos % imageSize.x();
+    const int y = pos / imageSize.x();
+    Eigen::Vector3f worldVertex = (kPose * Eigen::Vector3f((x + 0.5f) * depth, 
+          (y + 0.5f) * depth, depth).homogeneous()).head<3>();
 
-      Eigen::Vector3f direction = (camera - worldVertex).normalized();
-      const Eigen::Vector3f origin = worldVertex - (band * 0.5f) * direction;
-      const Eigen::Vector3f step = (direction*band)/numSteps;
+    Eigen::Vector3f direction = (camera - worldVertex).normalized();
+    const Eigen::Vector3f origin = worldVertex - (band * 0.5f) * direction;
+    const int depthSteps = std::max(numSteps >> scales.scale(depth), 1);
+    const Eigen::Vector3f step = (direction*band)/depthSteps;
 
-      Eigen::Vector3i voxel;
-      Eigen::Vector3f voxelPos = origin;
-      for(int i = 0; i < numSteps; i++){
-        Eigen::Vector3f voxelScaled = (voxelPos * inverseVoxelSize).array().floor();
-        if( (voxelScaled.x() < size) && (voxelScaled.y() < size) &&
-            (voxelScaled.z() < size) && (voxelScaled.x() >= 0) &&
-            (voxelScaled.y() >= 0) &&   (voxelScaled.z() >= 0)){
-          voxel = voxelScaled.cast<int>();
-          se::VoxelBlock<FieldType> * n = map_index.fetch(voxel.x(), 
-              voxel.y(), voxel.z());
-          if(!n){
-            HashType k = map_index.hash(voxel.x(), voxel.y(), voxel.z(), 
-                block_scale);
-            unsigned int idx = voxelCount++;
-            if(idx < reserved) {
-              allocationList[idx] = k;
-            } else
-              break;
-          }
-          else {
-            n->active(true); 
-          }
+    Eigen::Vector3i voxel;
+    Eigen::Vector3f voxelPos = origin;
+    for(int i = 0; i < depthSteps; i++){
+      Eigen::Vector3f voxelScaled = (voxelPos * inverseVoxelSize).array().floor();
+      if( (voxelScaled.x() < size) && (voxelScaled.y() < size) &&
+          (voxelScaled.z() < size) && (voxelScaled.x() >= 0) &&
+          (voxelScaled.y() >= 0) &&   (voxelScaled.z() >= 0)){
+        voxel = voxelScaled.cast<int>();
+        se::VoxelBlock<FieldType> * n = map_index.fetch(voxel.x(), 
+            voxel.y(), voxel.z());
+        if(!n){
+          HashType k = map_index.hash(voxel.x(), voxel.y(), voxel.z(), 
+              block_scale);
+          unsigned int idx = voxelCount++;
+          if(idx < reserved) {
+            allocationList[idx] = k;
+          } else
+            break;
+        }
+        else {
+          n->active(true); 
         }
-        voxelPos +=step;
       }
+      voxelPos +=step;
     }
   }
   const unsigned int written = voxelCount;
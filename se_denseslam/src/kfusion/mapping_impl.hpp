@@ -32,36 +32,51 @@
 #define KFUSION_MAPPING_HPP
 #include <se/node.hpp>
 
+/*
+ * Returns whether the voxel is still converging, that is it has not reached
+ * the maximum weight yet or the measurement disagrees with it by more than
+ * residual, relative to mu.
+ */
 struct sdf_update {
 
   template <typename DataHandlerT>
-  void operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
+  bool operator()(DataHandlerT& handler, const Eigen::Vector3i&, 
       const Eigen::Vector3f& pos, const Eigen::Vector2f& pixel) {
 
     const Eigen::Vector2i px = pixel.cast<int>();
-    const float depthSample = depth[px(0) + depthSize(0)*px(1)];
-    if (depthSample <=  0) return;
-    const float diff = (depthSample - pos(2)) 
-      * std::sqrt( 1 + se::math::sq(pos(0) / pos(2)) + se::math::sq(pos(1) / pos(2)));
+    const int idx = px(0) + depthSize(0)*px(1);
+    const float depthSample = depth[idx];
+    if (depthSample <=  0) return false;
+    const float diff = (depthSample - pos(2)) * (rayLengths ? rayLengths[idx] :
+      std::sqrt( 1 + se::math::sq(pos(0) / pos(2)) + se::math::sq(pos(1) / pos(2))));
     if (diff > -mu) {
       const float sdf = fminf(1.f, diff / mu);
       auto data = handler.get();
+      const float delta = fabsf(sdf - data.x);
       data.x = se::math::clamp(
           (static_cast<float>(data.y) * data.x + sdf) / (static_cast<float>(data.y) + 1.f), 
           -1.f,
           1.f);
       data.y = fminf(data.y + 1, maxweight);
       handler.set(data);
+      return data.y < maxweight || delta > residual;
     }
+    return false;
   } 
 
-  sdf_update(const float * d, const Eigen::Vector2i framesize, float m, int mw) : 
-    depth(d), depthSize(framesize), mu(m), maxweight(mw){};
+  sdf_update(const float * d, const Eigen::Vector2i framesize, float m, int mw,
+      float r = 0.1f, const float * l = nullptr) : 
+    depth(d), depthSize(framesize), mu(m), maxweight(mw), residual(r),
+    rayLengths(l){};
 
   const float * depth;
   Eigen::Vector2i depthSize;
   float mu;
   int maxweight;
+  float residual;
+  // Optional per-pixel ray length factors of the depth frame, see
+  // se::CameraModel. Computed from the voxel position when null.
+  const float * rayLengths;
 };
 
 #endif
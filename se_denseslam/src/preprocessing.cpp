@@ -36,11 +36,62 @@
 #include "timings.h"
 #include <se/utils/math_utils.h>
 
+#include <algorithm>
 #include <functional>
+#include <vector>
 #include <se/image/image.hpp>
 
+/*
+ * \brief Stream-compacts the indices of the pixels with a valid (non-zero)
+ * depth measurement into a dense list, preserving the raster order.
+ * The image is split into fixed size chunks which are counted and scattered
+ * in parallel, so that the kernels iterating over the list afterwards get
+ * balanced work regardless of where the invalid pixels are.
+ * \param pixels output list of linear pixel indices
+ * \param depth input depth map
+ */
+void compactValidPixelsKernel(std::vector<int>& pixels,
+    const se::Image<float>& depth) {
+	TICK();
+	const int num_pixels = depth.size();
+	const int chunk_size = 4096;
+	const int num_chunks = (num_pixels + chunk_size - 1) / chunk_size;
+	std::vector<int> offsets(num_chunks + 1, 0);
+	int c;
+#pragma omp parallel for \
+	    shared(offsets), private(c)
+	for (c = 0; c < num_chunks; ++c) {
+		const int end = std::min(num_pixels, (c + 1) * chunk_size);
+		int count = 0;
+		for (int i = c * chunk_size; i < end; ++i)
+			count += depth[i] != 0;
+		offsets[c + 1] = count;
+	}
+	for (c = 0; c < num_chunks; ++c)
+		offsets[c + 1] += offsets[c];
+
+	pixels.resize(offsets[num_chunks]);
+#pragma omp parallel for \
+	    shared(pixels, offsets), private(c)
+	for (c = 0; c < num_chunks; ++c) {
+		const int end = std::min(num_pixels, (c + 1) * chunk_size);
+		int out = offsets[c];
+		for (int i = c * chunk_size; i < end; ++i) {
+			if (depth[i] != 0)
+				pixels[out++] = i;
+		}
+	}
+	TOCK("compactValidPixelsKernel", num_pixels);
+}
+
+/*
+ * \brief Edge preserving bilateral filter of the input depth map. When a list
+ * of the valid pixels of in is provided only those pixels are filtered and
+ * every other output pixel is set to zero.
+ */
 void bilateralFilterKernel(se::Image<float>& out, const se::Image<float>& in,
-		const std::vector<float>& gaussian, float e_d, int r) {
+		const std::vector<float>& gaussian, float e_d, int r,
+		const std::vector<int>* pixels = nullptr) {
 
 	if ((in.width() != out.width()) || in.height() != out.height()) {
 		std::cerr << "input/output image sizes differ." << std::endl;
@@ -50,18 +101,9 @@ void bilateralFilterKernel(se::Image<float>& out, const se::Image<float>& in,
 	TICK()
     const int width = in.width();
     const int height = in.height();
-		int y;
 		float e_d_squared_2 = e_d * e_d * 2;
-#pragma omp parallel for \
-	    shared(out),private(y)   
-		for (y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-				unsigned int pos = x + y * width;
-				if (in[pos] == 0) {
-					out[pos] = 0;
-					continue;
-				}
-
+		auto filter = [&](const int x, const int y) {
+				const unsigned int pos = x + y * width;
 				float sum = 0.0f;
 				float t = 0.0f;
 
@@ -83,27 +125,66 @@ void bilateralFilterKernel(se::Image<float>& out, const se::Image<float>& in,
 					}
 				}
 				out[pos] = t / sum;
+		};
+
+		if (pixels) {
+			std::fill(out.data(), out.data() + out.size(), 0.f);
+			const int num_pixels = pixels->size();
+#pragma omp parallel for
+			for (int i = 0; i < num_pixels; ++i) {
+				const int pos = (*pixels)[i];
+				filter(pos % width, pos / width);
+			}
+		} else {
+			int y;
+#pragma omp parallel for \
+	    shared(out),private(y)
+			for (y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					if (in[x + y * width] == 0) {
+						out[x + y * width] = 0;
+						continue;
+					}
+					filter(x, y);
+				}
 			}
 		}
 		TOCK("bilateralFilterKernel", width * height);
 }
 
-  void depth2vertexKernel(se::Image<Eigen::Vector3f>& vertex, 
+/*
+ * \brief Back-projects the depth map into camera space vertices along the
+ * cached unit rays of its pixels, with a zero vertex for the invalid pixels.
+ * When the list of valid pixels of depth is provided, only those pixels are
+ * back-projected.
+ */
+void depth2vertexKernel(se::Image<Eigen::Vector3f>& vertex,
                          const se::Image<float>& depth,
-                         const Eigen::Matrix4f invK) {
+                         const se::Image<Eigen::Vector3f>& rays,
+                         const se::Image<float>& lengths,
+                         const std::vector<int>* pixels = nullptr) {
 	TICK();
-	int x, y;
+	if (pixels) {
+		std::fill(vertex.data(), vertex.data() + vertex.size(),
+				Eigen::Vector3f::Constant(0));
+		const int num_pixels = pixels->size();
 #pragma omp parallel for \
-         shared(vertex), private(x, y)
-	for (y = 0; y < depth.height(); y++) {
-		for (x = 0; x < depth.width(); x++) {
-
-			if (depth[x + y * depth.width()] > 0) {
-				vertex[x + y * depth.width()] = (depth[x + y * depth.width()]
-						* invK * Eigen::Vector4f(x, y, 1.f, 0.f)).head<3>();
-        }
+         shared(vertex)
+		for (int i = 0; i < num_pixels; ++i) {
+			const int pos = (*pixels)[i];
+			vertex[pos] = (depth[pos] * lengths[pos]) * rays[pos];
+		}
+	} else {
+		int pos;
+		const int num_pixels = depth.size();
+#pragma omp parallel for \
+         shared(vertex), private(pos)
+		for (pos = 0; pos < num_pixels; pos++) {
+			if (depth[pos] > 0) {
+				vertex[pos] = (depth[pos] * lengths[pos]) * rays[pos];
+			}
 			else {
-				vertex[x + y * depth.width()] = Eigen::Vector3f::Constant(0);
+				vertex[pos] = Eigen::Vector3f::Constant(0);
 			}
 		}
 	}
@@ -36,23 +36,50 @@
 #include <se/utils/math_utils.h>
 #include <se/commons.h>
 #include <timings.h>
+#include <algorithm>
 #include <tuple>
 
 #include <sophus/se3.hpp>
 #include <se/continuous/volume_template.hpp>
 #include <se/image/image.hpp>
 #include <se/ray_iterator.hpp>
+#include <se/block_ray_iterator.hpp>
+
+/* Ray-map intersection: the octree is traversed hierarchically, the hashed map
+ * is marched block by block. */
+template <typename T>
+inline se::ray_iterator<T> make_ray_iterator(const se::Octree<T>& map, 
+    const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, 
+    const float nearPlane, const float farPlane) {
+  return se::ray_iterator<T>(map, origin, direction, nearPlane, farPlane);
+}
+
+template <typename T>
+inline se::block_ray_iterator<T, se::HashedMap> make_ray_iterator(
+    const se::HashedMap<T>& map, const Eigen::Vector3f& origin, 
+    const Eigen::Vector3f& direction, const float nearPlane, 
+    const float farPlane) {
+  return se::block_ray_iterator<T, se::HashedMap>(map, origin, direction, 
+      nearPlane, farPlane);
+}
 
 /* Raycasting implementations */ 
 #include "bfusion/rendering_impl.hpp"
 #include "kfusion/rendering_impl.hpp"
 
+/* rays holds the camera space unit ray through every pixel of vertex. The
+ * normals are left untouched unless gradientNormals is set, for callers
+ * estimating them from vertex instead. */
 template<typename T>
 void raycastKernel(const Volume<T>& volume, se::Image<Eigen::Vector3f>& vertex,
    se::Image<Eigen::Vector3f>& normal,
-   const Eigen::Matrix4f& view, const float nearPlane, const float farPlane, 
-   const float mu, const float step, const float largestep) {
+   const Eigen::Matrix4f& pose, const se::Image<Eigen::Vector3f>& rays,
+   const float nearPlane, const float farPlane, 
+   const float mu, const float step, const float largestep,
+   const bool gradientNormals = true) {
   TICK();
+  const Eigen::Matrix3f rotation = pose.topLeftCorner<3, 3>();
+  const Eigen::Vector3f transl = pose.topRightCorner<3, 1>();
   int y;
 #pragma omp parallel for shared(normal, vertex), private(y)
   for (y = 0; y < vertex.height(); y++)
@@ -60,10 +87,9 @@ void raycastKernel(const Volume<T>& volume, se::Image<Eigen::Vector3f>& vertex,
     for (int x = 0; x < vertex.width(); x++) {
 
       Eigen::Vector2i pos(x, y);
-      const Eigen::Vector3f dir = 
-        (view.topLeftCorner<3, 3>() * Eigen::Vector3f(x, y, 1.f)).normalized();
-      const Eigen::Vector3f transl = view.topRightCorner<3, 1>();
-      se::ray_iterator<T> ray(*volume._map_index, transl, dir, nearPlane, farPlane);
+      const Eigen::Vector3f dir = rotation * rays(x, y);
+      auto ray = make_ray_iterator(*volume._map_index, transl, dir, nearPlane, 
+          farPlane);
       ray.next();
       const float t_min = ray.tcmin(); /* Get distance to the first intersected block */
       const Eigen::Vector4f hit = t_min > 0.f ? 
@@ -71,6 +97,7 @@ void raycastKernel(const Volume<T>& volume, se::Image<Eigen::Vector3f>& vertex,
         Eigen::Vector4f::Constant(0.f);
       if(hit.w() > 0.0) {
         vertex[x + y * vertex.width()] = hit.head<3>();
+        if (!gradientNormals) continue;
         Eigen::Vector3f surfNorm = volume.grad(hit.head<3>(), 
             [](const auto& val){ return val.x; });
         if (surfNorm.norm() == 0) {
@@ -83,7 +110,8 @@ void raycastKernel(const Volume<T>& volume, se::Image<Eigen::Vector3f>& vertex,
         }
       } else {
         vertex[pos.x() + pos.y() * vertex.width()] = Eigen::Vector3f::Constant(0);
-        normal[pos.x() + pos.y() * normal.width()] = Eigen::Vector3f(INVALID, 0, 0);
+        if (gradientNormals)
+          normal[pos.x() + pos.y() * normal.width()] = Eigen::Vector3f(INVALID, 0, 0);
       }
     }
   TOCK("raycastKernel", inputSize.x * inputSize.y);
@@ -108,6 +136,48 @@ void raycastKernel(const Volume<T>& volume, se::Image<Eigen::Vector3f>& vertex,
 // 	TOCK("renderNormalKernel", normalSize.x * normalSize.y);
 // }
 
+/* Renders the depth along the optical axis and the visibility of every pixel
+ * of a batch of cameras, rays[c] holding the camera space unit rays of camera
+ * c. The rows of all the cameras are scheduled together, so that small
+ * cameras do not leave threads idle. */
+template <typename T>
+void renderDepthBatchKernel(const Volume<T>& volume, 
+    const VirtualCameras& cameras,
+    const std::vector<const se::Image<Eigen::Vector3f>*>& rays,
+    std::vector<se::Image<float> >& depths,
+    std::vector<se::Image<unsigned char> >& masks,
+    const float nearPlane, const float farPlane, 
+    const float mu, const float step, const float largestep) {
+  TICK();
+  std::vector<int> first_row(cameras.size() + 1, 0);
+  for (size_t c = 0; c < cameras.size(); ++c)
+    first_row[c + 1] = first_row[c] + cameras[c].size.y();
+
+  int r;
+#pragma omp parallel for private(r) schedule(dynamic)
+  for (r = 0; r < first_row.back(); r++) {
+    const int c = std::upper_bound(first_row.begin(), first_row.end(), r) - 
+      first_row.begin() - 1;
+    const int y = r - first_row[c];
+    const Eigen::Matrix3f rotation = cameras[c].pose.topLeftCorner<3, 3>();
+    const Eigen::Vector3f transl = cameras[c].pose.topRightCorner<3, 1>();
+    for (int x = 0; x < cameras[c].size.x(); x++) {
+      const Eigen::Vector3f& unit = (*rays[c])(x, y);
+      const Eigen::Vector3f dir = rotation * unit;
+      auto ray = make_ray_iterator(*volume._map_index, transl, dir, nearPlane, 
+          farPlane);
+      ray.next();
+      const float t_min = ray.tcmin();
+      const Eigen::Vector4f hit = t_min > 0.f ? 
+        raycast(volume, transl, dir, t_min, ray.tmax(), mu, step, largestep) : 
+        Eigen::Vector4f::Constant(0.f);
+      depths[c](x, y) = hit.w() > 0.f ? hit.w() * unit.z() : 0.f;
+      masks[c](x, y) = hit.w() > 0.f;
+    }
+  }
+  TOCK("renderDepthBatchKernel", first_row.back());
+}
+
 void renderDepthKernel(unsigned char* out, float * depth, 
     const Eigen::Vector2i& depthSize, const float nearPlane, 
     const float farPlane) {
@@ -211,6 +281,57 @@ void renderTrackKernel(unsigned char* out,
   TOCK("renderTrackKernel", outSize.x * outSize.y);
 }
 
+/* Raycasts the pixel (x, y) of view, returning the hit, with the distance
+ * along the ray in w, and its normal. The normal is INVALID on a miss. */
+template <typename T>
+inline Eigen::Vector4f renderRay(const Volume<T>& volume, 
+    Eigen::Vector3f& surfNorm, const int x, const int y,
+    const Eigen::Matrix4f& view, const float nearPlane, const float farPlane, 
+    const float mu, const float step, const float largestep) {
+  const Eigen::Vector3f dir = 
+    (view.topLeftCorner<3, 3>() * Eigen::Vector3f(x, y, 1.f)).normalized();
+  const Eigen::Vector3f transl = view.topRightCorner<3, 1>();
+  auto ray = make_ray_iterator(*volume._map_index, transl, dir, 
+      nearPlane, farPlane);
+  ray.next();
+  const float t_min = ray.tmin(); /* Get distance to the first intersected block */
+  const Eigen::Vector4f hit = t_min > 0.f ? 
+    raycast(volume, transl, dir, t_min, ray.tmax(), mu, step, largestep) : 
+    Eigen::Vector4f::Constant(0.f);
+  if (hit.w() > 0) {
+    surfNorm = volume.grad(hit.head<3>(), [](const auto& val){ return val.x; });
+
+    // Invert normals if SDF 
+    surfNorm = std::is_same<T, SDF>::value ? -1.f * surfNorm : surfNorm;
+  } else {
+    surfNorm = Eigen::Vector3f(INVALID, 0, 0);
+  }
+  return hit;
+}
+
+/* Writes the RGBW colour of the surface point test with normal surfNorm, lit
+ * from light, to out. Invalid normals are shaded black. */
+inline void shadePixel(unsigned char* out, const Eigen::Vector3f& test,
+    const Eigen::Vector3f& surfNorm, const Eigen::Vector3f& light,
+    const Eigen::Vector3f& ambient) {
+  if (surfNorm.x() != INVALID && surfNorm.norm() > 0) {
+    const Eigen::Vector3f diff = (test - light).normalized();
+    const Eigen::Vector3f dir = Eigen::Vector3f::Constant(fmaxf(surfNorm.normalized().dot(diff), 0.f));
+    Eigen::Vector3f col = dir + ambient;
+    se::math::clamp(col, Eigen::Vector3f::Constant(0.f), Eigen::Vector3f::Constant(1.f));
+    col *=  255.f;
+    out[0] = col.x();
+    out[1] = col.y();
+    out[2] = col.z();
+    out[3] = 0;
+  } else {
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
+    out[3] = 0;
+  }
+}
+
 template <typename T>
 void renderVolumeKernel(const Volume<T>& volume, 
     unsigned char* out, // RGBW packed
@@ -231,54 +352,110 @@ void renderVolumeKernel(const Volume<T>& volume,
 #pragma omp parallel for shared(out), private(y)
   for (y = 0; y < depthSize.y(); y++) {
     for (int x = 0; x < depthSize.x(); x++) {
-      Eigen::Vector4f hit;
       Eigen::Vector3f test, surfNorm;
       const int idx = (x + depthSize.x()*y) * 4;
 
       if(render) {
-        const Eigen::Vector3f dir = 
-          (view.topLeftCorner<3, 3>() * Eigen::Vector3f(x, y, 1.f)).normalized();
-        const Eigen::Vector3f transl = view.topRightCorner<3, 1>();
-        se::ray_iterator<typename Volume<T>::field_type> ray(*volume._map_index, 
-            transl, dir, nearPlane, farPlane);
-        ray.next();
-        const float t_min = ray.tmin(); /* Get distance to the first intersected block */
-        hit = t_min > 0.f ? 
-          raycast(volume, transl, dir, t_min, ray.tmax(), mu, step, largestep) : 
-          Eigen::Vector4f::Constant(0.f);
-        if (hit.w() > 0) {
-          test = hit.head<3>();
-          surfNorm = volume.grad(test, [](const auto& val){ return val.x; });
-
-          // Invert normals if SDF 
-          surfNorm = std::is_same<T, SDF>::value ? -1.f * surfNorm : surfNorm;
-        } else {
-          surfNorm = Eigen::Vector3f(INVALID, 0, 0);
-        }
+        test = renderRay(volume, surfNorm, x, y, view, nearPlane, farPlane, 
+            mu, step, largestep).template head<3>();
       }
       else {
         test = vertex[x + depthSize.x()*y];
         surfNorm = normal[x + depthSize.x()*y];
       }
+      shadePixel(out + idx, test, surfNorm, light, ambient);
+    }
+  }
+  TOCK("renderVolumeKernel", depthSize.x * depthSize.y);
+}
 
-      if (surfNorm.x() != INVALID && surfNorm.norm() > 0) {
-        const Eigen::Vector3f diff = (test - light).normalized();
-        const Eigen::Vector3f dir = Eigen::Vector3f::Constant(fmaxf(surfNorm.normalized().dot(diff), 0.f));
-        Eigen::Vector3f col = dir + ambient;
-        se::math::clamp(col, Eigen::Vector3f::Constant(0.f), Eigen::Vector3f::Constant(1.f));
-        col *=  255.f;
-        out[idx + 0] = col.x();
-        out[idx + 1] = col.y();
-        out[idx + 2] = col.z();
-        out[idx + 3] = 0;
-      } else {
-        out[idx + 0] = 0;
-        out[idx + 1] = 0;
-        out[idx + 2] = 0;
-        out[idx + 3] = 0;
+/* Renders the pixels of out whose coordinates are multiples of stride. When
+ * refine is set the pixels on the lattice of twice the stride are assumed
+ * rendered already and skipped. depth receives the distance along the ray of
+ * every rendered pixel, 0 on a miss. */
+template <typename T>
+void renderVolumeLatticeKernel(const Volume<T>& volume, 
+    unsigned char* out, // RGBW packed
+    float* depth,
+    const Eigen::Vector2i& depthSize, 
+    const Eigen::Matrix4f view, 
+    const float nearPlane, 
+    const float farPlane, 
+    const float mu,
+    const float step, 
+    const float largestep, 
+    const Eigen::Vector3f light,
+    const Eigen::Vector3f ambient, 
+    const int stride,
+    const bool refine) {
+  TICK();
+  int y;
+#pragma omp parallel for shared(out), private(y) schedule(dynamic)
+  for (y = 0; y < depthSize.y(); y += stride) {
+    const bool coarse_row = refine && y % (2 * stride) == 0;
+    for (int x = 0; x < depthSize.x(); x += stride) {
+      if (coarse_row && x % (2 * stride) == 0) continue;
+      Eigen::Vector3f surfNorm;
+      const int pos = x + depthSize.x()*y;
+      const Eigen::Vector4f hit = renderRay(volume, surfNorm, x, y, view, 
+          nearPlane, farPlane, mu, step, largestep);
+      depth[pos] = hit.w() > 0 ? hit.w() : 0.f;
+      shadePixel(out + 4 * pos, hit.head<3>(), surfNorm, light, ambient);
+    }
+  }
+  TOCK("renderVolumeLatticeKernel", depthSize.x * depthSize.y);
+}
+
+/* Fills the pixels of out off the stride lattice rendered by
+ * renderVolumeLatticeKernel. Each pixel blends the four surrounding lattice
+ * samples bilinearly, keeping only the samples on the surface of the nearest
+ * one: within a relative depth tolerance of it, or misses like it. Edges
+ * then stay sharp instead of blending foreground and background. */
+void upsampleRenderKernel(unsigned char* out, const float* depth, 
+    const Eigen::Vector2i& size, const int stride) {
+  TICK();
+  const float tolerance = 0.05f;
+  const int last_x = ((size.x() - 1) / stride) * stride;
+  const int last_y = ((size.y() - 1) / stride) * stride;
+  int y;
+#pragma omp parallel for shared(out), private(y)
+  for (y = 0; y < size.y(); y++) {
+    const int y0 = std::min((y / stride) * stride, last_y);
+    const int y1 = std::min(y0 + stride, last_y);
+    const float wy = y1 > y0 ? float(y - y0) / stride : 0.f;
+    for (int x = 0; x < size.x(); x++) {
+      if (x % stride == 0 && y % stride == 0) continue;
+      const int x0 = std::min((x / stride) * stride, last_x);
+      const int x1 = std::min(x0 + stride, last_x);
+      const float wx = x1 > x0 ? float(x - x0) / stride : 0.f;
+
+      const int samples[4] = {x0 + size.x()*y0, x1 + size.x()*y0, 
+        x0 + size.x()*y1, x1 + size.x()*y1};
+      const float weights[4] = {(1.f - wx) * (1.f - wy), wx * (1.f - wy), 
+        (1.f - wx) * wy, wx * wy};
+      int nearest = 0;
+      for (int i = 1; i < 4; ++i)
+        if (weights[i] > weights[nearest]) nearest = i;
+      const float reference = depth[samples[nearest]];
+
+      float colour[3] = {0.f, 0.f, 0.f};
+      float total = 0.f;
+      for (int i = 0; i < 4; ++i) {
+        const float d = depth[samples[i]];
+        const bool same_surface = reference > 0.f ? 
+          d > 0.f && std::fabs(d - reference) < tolerance * reference : 
+          d == 0.f;
+        if (!same_surface || weights[i] == 0.f) continue;
+        for (int c = 0; c < 3; ++c)
+          colour[c] += weights[i] * out[4 * samples[i] + c];
+        total += weights[i];
       }
+      const int idx = 4 * (x + size.x()*y);
+      for (int c = 0; c < 3; ++c)
+        out[idx + c] = colour[c] / total + 0.5f;
+      out[idx + 3] = 0;
     }
   }
-  TOCK("renderVolumeKernel", depthSize.x * depthSize.y);
+  TOCK("upsampleRenderKernel", size.x * size.y);
 }
 
@@ -38,6 +38,7 @@
 
 #include <se/commons.h>
 #include <se/image/image.hpp>
+#include <vector>
 
 static inline Eigen::Matrix<float, 6, 6> makeJTJ(const Eigen::Matrix<float, 1, 21>& v) {
 	Eigen::Matrix<float, 6, 6> C = Eigen::Matrix<float, 6, 6>::Zero();
@@ -223,6 +224,13 @@ void reduceKernel(float * out, TrackData* J, const Eigen::Vector2i Jsize,
 	TOCK("reduceKernel", 512);
 }
 
+/*
+ * \brief Computes the point-to-plane ICP residual and Jacobian of every input
+ * pixel. When the list of valid pixels of the input level is provided only
+ * those rows of output are written; the caller is expected to have marked
+ * the remaining rows of the level as invalid beforehand, which only needs to
+ * be done once per level as the list does not change across iterations.
+ */
 void trackKernel(TrackData* output, 
     const se::Image<Eigen::Vector3f>& inVertex,
 		const se::Image<Eigen::Vector3f>& inNormal, 
@@ -231,72 +239,73 @@ void trackKernel(TrackData* output,
     const Eigen::Matrix4f& Ttrack,
 		const Eigen::Matrix4f& view, 
     const float dist_threshold,
-		const float normal_threshold) {
+		const float normal_threshold,
+		const std::vector<int>* pixels = nullptr) {
 	TICK();
 	Eigen::Vector2i   pixel(0, 0);
   Eigen::Vector2i  inSize( inVertex.width(),  inVertex.height());
   Eigen::Vector2i refSize(refVertex.width(), refVertex.height());
 
-	int pixely, pixelx;
+	const int num_visits = pixels ? pixels->size() : inSize.x() * inSize.y();
+	int p;
 #pragma omp parallel for \
-	    shared(output), private(pixel,pixelx,pixely)
-	for (pixely = 0; pixely < inSize.y(); pixely++) {
-		for (pixelx = 0; pixelx < inSize.x(); pixelx++) {
-			pixel.x() = pixelx;
-			pixel.y() = pixely;
+	    shared(output), private(pixel,p)
+	for (p = 0; p < num_visits; p++) {
+		const int pos = pixels ? (*pixels)[p] : p;
+		pixel.x() = pos % inSize.x();
+		pixel.y() = pos / inSize.x();
 
-			TrackData & row = output[pixel.x() + pixel.y() * refSize.x()];
+		TrackData & row = output[pixel.x() + pixel.y() * refSize.x()];
 
-			if (inNormal[pixel.x() + pixel.y() * inSize.x()].x() == INVALID) {
-				row.result = -1;
-				continue;
-			}
+		if (inNormal[pixel.x() + pixel.y() * inSize.x()].x() == INVALID) {
+			row.result = -1;
+			continue;
+		}
 
-			const Eigen::Vector3f projectedVertex = (Ttrack * 
+		const Eigen::Vector3f projectedVertex = (Ttrack * 
           inVertex[pixel.x() + pixel.y() * inSize.x()].homogeneous()).head<3>();
-			const Eigen::Vector3f projectedPos = (view * projectedVertex.homogeneous()).head<3>();
-			const Eigen::Vector2f projPixel(
-					projectedPos.x() / projectedPos.z() + 0.5f,
-					projectedPos.y() / projectedPos.z() + 0.5f);
-			if (projPixel.x() < 0 || projPixel.x() > refSize.x() - 1
-					|| projPixel.y() < 0 || projPixel.y() > refSize.y() - 1) {
-				row.result = -2;
-				continue;
-			}
+		const Eigen::Vector3f projectedPos = (view * projectedVertex.homogeneous()).head<3>();
+		const Eigen::Vector2f projPixel(
+				projectedPos.x() / projectedPos.z() + 0.5f,
+				projectedPos.y() / projectedPos.z() + 0.5f);
+		if (projPixel.x() < 0 || projPixel.x() > refSize.x() - 1
+				|| projPixel.y() < 0 || projPixel.y() > refSize.y() - 1) {
+			row.result = -2;
+			continue;
+		}
 
-			const Eigen::Vector2i refPixel = projPixel.cast<int>();
-			const Eigen::Vector3f referenceNormal = refNormal[refPixel.x()
-					+ refPixel.y() * refSize.x()];
+		const Eigen::Vector2i refPixel = projPixel.cast<int>();
+		const Eigen::Vector3f referenceNormal = refNormal[refPixel.x()
+				+ refPixel.y() * refSize.x()];
 
-			if (referenceNormal.x() == INVALID) {
-				row.result = -3;
-				continue;
-			}
+		if (referenceNormal.x() == INVALID) {
+			row.result = -3;
+			continue;
+		}
 
-			const Eigen::Vector3f diff = refVertex[refPixel.x() + refPixel.y() * refSize.x()]
-					- projectedVertex;
-			const Eigen::Vector3f projectedNormal = Ttrack.topLeftCorner<3, 3>() * 
-					inNormal[pixel.x() + pixel.y() * inSize.x()];
+		const Eigen::Vector3f diff = refVertex[refPixel.x() + refPixel.y() * refSize.x()]
+				- projectedVertex;
+		const Eigen::Vector3f projectedNormal = Ttrack.topLeftCorner<3, 3>() * 
+				inNormal[pixel.x() + pixel.y() * inSize.x()];
 
-			if (diff.norm() > dist_threshold) {
-				row.result = -4;
-				continue;
-			}
-			if (projectedNormal.dot(referenceNormal) < normal_threshold) {
-				row.result = -5;
-				continue;
-			}
-			row.result = 1;
-			row.error = referenceNormal.dot(diff);
-			row.J[0] = referenceNormal.x();
-			row.J[1] = referenceNormal.y();
-			row.J[2] = referenceNormal.z();
+		if (diff.norm() > dist_threshold) {
+			row.result = -4;
+			continue;
+		}
+		if (projectedNormal.dot(referenceNormal) < normal_threshold) {
+			row.result = -5;
+			continue;
+		}
+		row.result = 1;
+		row.error = referenceNormal.dot(diff);
+		row.J[0] = referenceNormal.x();
+		row.J[1] = referenceNormal.y();
+		row.J[2] = referenceNormal.z();
 
       Eigen::Vector3f crossRes = projectedVertex.cross(referenceNormal);
-			row.J[3] = crossRes.x();
-			row.J[4] = crossRes.y();
-			row.J[5] = crossRes.z();
-		}
+		row.J[3] = crossRes.x();
+		row.J[4] = crossRes.y();
+		row.J[5] = crossRes.z();
 	}
 	TOCK("trackKernel", inSize.x * inSize.y);
 }